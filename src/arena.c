@@ -0,0 +1,198 @@
+// arena.c
+// Chunked bump allocator.
+
+#include "arena.h"
+
+#define _GNU_SOURCE
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+
+#define ARENA_CHUNK_SIZE (32 * 1024)
+
+/* Chunks at least this big are mmap'ed, so they can be grown with
+   mremap() instead of being copied. */
+#define ARENA_MAP_SIZE (256 * 1024)
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t cap;
+    bool mapped;
+    alignas(max_align_t) char data[];
+};
+
+static void
+chunk_release(struct arena_chunk *c)
+{
+    if (c->mapped)
+        munmap(c, sizeof *c + c->cap);
+    else
+        free(c);
+}
+
+void
+arena_init(struct arena *a)
+{
+    a->chunks = NULL;
+    a->cur = a->end = NULL;
+    a->spare = NULL;
+}
+
+void
+arena_free(struct arena *a)
+{
+    struct arena_chunk *c = a->chunks;
+    while (c) {
+        struct arena_chunk *next = c->next;
+        chunk_release(c);
+        c = next;
+    }
+    free(a->spare);
+    arena_init(a);
+}
+
+struct arena_mark
+arena_mark(struct arena *a)
+{
+    return (struct arena_mark){ .chunks = a->chunks, .cur = a->cur, .end = a->end };
+}
+
+void
+arena_reset(struct arena *a, struct arena_mark m)
+{
+    /* every chunk allocated after the mark sits in front of m.chunks */
+    while (a->chunks != m.chunks) {
+        struct arena_chunk *c = a->chunks;
+        a->chunks = c->next;
+        if (c->cap == ARENA_CHUNK_SIZE && a->spare == NULL)
+            a->spare = c;
+        else
+            chunk_release(c);
+    }
+    a->cur = m.cur;
+    a->end = m.end;
+}
+
+/* Get a chunk with room for cap bytes and push it onto the list. */
+static struct arena_chunk *
+chunk_push(struct arena *a, size_t cap)
+{
+    struct arena_chunk *c;
+    if (cap == ARENA_CHUNK_SIZE && a->spare) {
+        c = a->spare;
+        a->spare = NULL;
+    } else if (cap >= ARENA_MAP_SIZE) {
+        c = mmap(NULL, sizeof *c + cap, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (c == MAP_FAILED)
+            utils_fatal_error("arena: out of memory");
+        c->cap = cap;
+        c->mapped = true;
+    } else {
+        c = malloc(sizeof *c + cap);
+        if (!c)
+            utils_fatal_error("arena: out of memory");
+        c->cap = cap;
+        c->mapped = false;
+    }
+    c->next = a->chunks;
+    a->chunks = c;
+    return c;
+}
+
+void *
+arena_alloc(struct arena *a, size_t size)
+{
+    const size_t align = alignof(max_align_t);
+    size = size ? (size + align - 1) & ~(align - 1) : align;
+
+    if ((size_t)(a->end - a->cur) >= size) {
+        void *p = a->cur;
+        a->cur += size;
+        return p;
+    }
+
+    if (size > ARENA_CHUNK_SIZE / 4) {
+        /* big request: give it a chunk of its own but keep allocating
+           from the current one, so the space left there is not wasted */
+        return chunk_push(a, size)->data;
+    }
+
+    struct arena_chunk *c = chunk_push(a, ARENA_CHUNK_SIZE);
+    a->cur = c->data + size;
+    a->end = c->data + ARENA_CHUNK_SIZE;
+    return c->data;
+}
+
+void *
+arena_grow(struct arena *a, void *p, size_t old, size_t size)
+{
+    if (!p)
+        return arena_alloc(a, size);
+    if (size <= old)
+        return p;
+
+    struct arena_chunk *c = a->chunks;
+    if (c && p == c->data && (a->cur < c->data || a->cur > c->data + c->cap)) {
+        /* p has the newest chunk to itself: resize the chunk */
+        if (c->mapped) {
+            c = mremap(c, sizeof *c + c->cap, sizeof *c + size, MREMAP_MAYMOVE);
+            if (c == MAP_FAILED)
+                utils_fatal_error("arena: out of memory");
+            c->cap = size;
+            a->chunks = c;
+            return c->data;
+        }
+        if (size < ARENA_MAP_SIZE) {
+            c = realloc(c, sizeof *c + size);
+            if (!c)
+                utils_fatal_error("arena: out of memory");
+            c->cap = size;
+            a->chunks = c;
+            return c->data;
+        }
+        /* large enough to be mapped from now on: fall through and copy once */
+    } else {
+        const size_t align = alignof(max_align_t);
+        size_t oldsz = old ? (old + align - 1) & ~(align - 1) : align;
+        if ((char *)p + oldsz == a->cur && (size_t)(a->end - (char *)p) >= size) {
+            /* the most recent allocation, and the chunk has room */
+            a->cur = (char *)p + ((size + align - 1) & ~(align - 1));
+            return p;
+        }
+    }
+
+    void *q = arena_alloc(a, size);
+    memcpy(q, p, old);
+    return q;
+}
+
+void *
+arena_zalloc(struct arena *a, size_t size)
+{
+    void *p = arena_alloc(a, size);
+    memset(p, 0, size);
+    return p;
+}
+
+void *
+arena_memdup(struct arena *a, const void *src, size_t n)
+{
+    void *p = arena_alloc(a, n);
+    if (n)
+        memcpy(p, src, n);
+    return p;
+}
+
+char *
+arena_strndup(struct arena *a, const char *s, size_t n)
+{
+    char *p = arena_alloc(a, n + 1);
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <stddef.h>
+
+/*
+ * A bump allocator.
+ *
+ * Memory is carved out of large chunks and released all at once by
+ * arena_free(), or back to an earlier arena_mark() by arena_reset();
+ * there is no per-object free.  Used for data whose lifetime is tied to
+ * something bigger, such as the IR of a script or the evaluation of one
+ * command.
+ */
+
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk *chunks;     /* most recent first */
+    char *cur;                      /* next free byte */
+    char *end;                      /* end of the chunk cur points into */
+    struct arena_chunk *spare;      /* a released chunk kept for reuse */
+};
+
+/* A position in an arena; see arena_reset(). */
+struct arena_mark {
+    struct arena_chunk *chunks;
+    char *cur, *end;
+};
+
+void arena_init(struct arena *a);
+
+/* Release every chunk; the arena can be reused afterwards. */
+void arena_free(struct arena *a);
+
+/* Remember the current allocation position. */
+struct arena_mark arena_mark(struct arena *a);
+
+/* Release everything allocated since mark m was taken.  Marks must be
+   reset in LIFO order. */
+void arena_reset(struct arena *a, struct arena_mark m);
+
+/* Return size bytes aligned for any object.  Aborts on OOM. */
+void *arena_alloc(struct arena *a, size_t size);
+
+/* Resize the block p of old bytes to size bytes and return its new
+   address; the contents are kept.  p should be the most recent
+   allocation: then the block is extended in place when possible, and a
+   block that has a chunk of its own is resized with realloc() or, once
+   it is large, mremap(), so growing a big buffer copies nothing.  Any
+   other block is copied, and the old copy lives until the next reset. */
+void *arena_grow(struct arena *a, void *p, size_t old, size_t size);
+
+/* Like arena_alloc, but zero-filled. */
+void *arena_zalloc(struct arena *a, size_t size);
+
+/* Copy n bytes into the arena. */
+void *arena_memdup(struct arena *a, const void *src, size_t n);
+
+/* Copy n bytes into the arena and NUL-terminate them. */
+char *arena_strndup(struct arena *a, const char *s, size_t n);
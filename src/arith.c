@@ -0,0 +1,726 @@
+// arith.c
+// Arithmetic expressions: a precedence-climbing compiler to postfix code
+// and the stack machine that runs it.
+
+#include "arith.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins.h"
+#include "utils.h"
+#include "vars.h"
+
+/* How deep variables holding expressions may refer to each other. */
+#define ARITH_MAX_LEVEL 1024
+
+enum {
+    OP_PUSH,            /* imm */
+    OP_LOAD,            /* var */
+    OP_STORE,           /* var: assign the top of the stack, leaving it */
+    OP_POSTINC,         /* var: push its value, then step it */
+    OP_POSTDEC,
+    OP_STATUS,          /* $? */
+    OP_NEG, OP_NOT, OP_BNOT, OP_BOOL,
+    OP_MUL, OP_DIV, OP_MOD, OP_POW, OP_ADD, OP_SUB, OP_SHL, OP_SHR,
+    OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE, OP_BAND, OP_BXOR, OP_BOR,
+    OP_POP,
+    OP_JZ,              /* target: pop, and jump if it was zero */
+    OP_JNZ,
+    OP_JMP,
+};
+
+struct insn {
+    uint8_t op;
+    union {
+        long long imm;
+        struct shell_var *var;
+        uint32_t target;
+    };
+};
+
+struct arith_prog {
+    const char *src;
+    const char *err;        /* syntax error, or NULL */
+    const char *errtok;     /* where in src it was found */
+    uint32_t depth;         /* stack slots the code needs */
+    uint32_t n;
+    struct insn code[];
+};
+
+/* ---------------- lexer ---------------- */
+
+enum {
+    T_END = 0,
+    T_NUM = 256, T_NAME, T_STATUS,
+    T_POW, T_SHL, T_SHR, T_LE, T_GE, T_EQ, T_NE, T_ANDAND, T_OROR,
+    T_INC, T_DEC,
+    T_MULEQ, T_DIVEQ, T_MODEQ, T_ADDEQ, T_SUBEQ, T_SHLEQ, T_SHREQ,
+    T_ANDEQ, T_XOREQ, T_OREQ,
+};
+
+struct compiler {
+    struct arena *a;
+    const char *p, *end;
+    const char *err, *errtok;
+
+    int tok;
+    const char *tokstart;
+    long long num;              /* T_NUM */
+    const char *name;           /* T_NAME */
+    size_t namelen;
+
+    struct insn *code;
+    uint32_t n, cap;
+    int depth, maxdepth;
+};
+
+static void
+fail(struct compiler *c, const char *msg)
+{
+    if (!c->err) {
+        c->err = msg;
+        c->errtok = c->tokstart;
+    }
+    c->tok = T_END;
+    c->p = c->end;
+}
+
+static bool
+is_name_char(char ch, bool first)
+{
+    return ch == '_' || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+           (!first && ch >= '0' && ch <= '9');
+}
+
+/* Value of a digit in base, or -1: bash orders them 0-9 a-z A-Z @ _,
+   and letters of either case mean the same up to base 36. */
+static int
+digit_value(char ch, int base)
+{
+    int d;
+    if (ch >= '0' && ch <= '9')      d = ch - '0';
+    else if (ch >= 'a' && ch <= 'z') d = ch - 'a' + 10;
+    else if (ch >= 'A' && ch <= 'Z') d = ch - 'A' + (base <= 36 ? 10 : 36);
+    else if (ch == '@')              d = 62;
+    else if (ch == '_')              d = 63;
+    else                             return -1;
+    return d;
+}
+
+/* Parse an integer literal at s[0..len): decimal, 0x hex, 0 octal or
+   base#digits.  Returns an error message or NULL. */
+static const char *
+parse_number(const char *s, size_t len, long long *out)
+{
+    unsigned long long v = 0;
+    int base = 10;
+    size_t i = 0;
+
+    const char *hash = memchr(s, '#', len);
+    if (hash) {
+        long long b;
+        if (parse_number(s, (size_t)(hash - s), &b) != NULL || b < 2 || b > 64)
+            return "invalid arithmetic base";
+        base = (int)b;
+        i = (size_t)(hash - s) + 1;
+        if (i == len)
+            return "invalid integer constant";
+    } else if (len > 1 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        base = 16;
+        i = 2;
+    } else if (len > 1 && s[0] == '0') {
+        base = 8;
+        i = 1;
+    }
+
+    for (; i < len; i++) {
+        int d = digit_value(s[i], base);
+        if (d < 0)
+            return "invalid number";
+        if (d >= base)
+            return "value too great for base";
+        v = v * (unsigned)base + (unsigned)d;
+    }
+    *out = (long long)v;
+    return NULL;
+}
+
+static void
+lex(struct compiler *c)
+{
+    static const struct { const char *s; int tok; } ops[] = {
+        { "<<=", T_SHLEQ }, { ">>=", T_SHREQ },
+        { "**", T_POW },    { "<<", T_SHL },    { ">>", T_SHR },
+        { "<=", T_LE },     { ">=", T_GE },     { "==", T_EQ },
+        { "!=", T_NE },     { "&&", T_ANDAND }, { "||", T_OROR },
+        { "++", T_INC },    { "--", T_DEC },
+        { "*=", T_MULEQ },  { "/=", T_DIVEQ },  { "%=", T_MODEQ },
+        { "+=", T_ADDEQ },  { "-=", T_SUBEQ },  { "&=", T_ANDEQ },
+        { "^=", T_XOREQ },  { "|=", T_OREQ },
+    };
+    const char *p = c->p, *end = c->end;
+
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n'))
+        p++;
+    c->tokstart = p;
+    if (p == end) {
+        c->tok = T_END;
+        c->p = p;
+        return;
+    }
+
+    if (*p >= '0' && *p <= '9') {
+        const char *s = p;
+        while (p < end && (digit_value(*p, 64) >= 0 || *p == '#'))
+            p++;
+        c->p = p;
+        const char *msg = parse_number(s, (size_t)(p - s), &c->num);
+        c->tok = T_NUM;
+        if (msg)
+            fail(c, msg);
+        return;
+    }
+
+    if (*p == '$' && p + 1 < end && p[1] == '?') {
+        c->tok = T_STATUS;
+        c->p = p + 2;
+        return;
+    }
+    if (*p == '$' && p + 1 < end && p[1] == '{') {
+        /* ${name} reads the variable, like $name and name */
+        const char *s = p + 2, *e = s;
+        while (e < end && is_name_char(*e, e == s))
+            e++;
+        if (e == s || e == end || *e != '}') {
+            fail(c, "parameter expansion not supported in arithmetic");
+            return;
+        }
+        c->tok = T_NAME;
+        c->name = s;
+        c->namelen = (size_t)(e - s);
+        c->p = e + 1;
+        return;
+    }
+    if (*p == '$') {
+        if (p + 1 < end && is_name_char(p[1], true)) {
+            p++;
+        } else {
+            fail(c, "expansion not supported in arithmetic");
+            return;
+        }
+    }
+    if (is_name_char(*p, true)) {
+        const char *s = p;
+        while (p < end && is_name_char(*p, false))
+            p++;
+        c->tok = T_NAME;
+        c->name = s;
+        c->namelen = (size_t)(p - s);
+        c->p = p;
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof ops / sizeof ops[0]; i++) {
+        size_t n = strlen(ops[i].s);
+        if ((size_t)(end - p) >= n && memcmp(p, ops[i].s, n) == 0) {
+            c->tok = ops[i].tok;
+            c->p = p + n;
+            return;
+        }
+    }
+    if (strchr("+-*/%<>&|^!~?:,()=", *p)) {
+        c->tok = (unsigned char)*p;
+        c->p = p + 1;
+        return;
+    }
+    fail(c, "syntax error: invalid arithmetic operator");
+}
+
+/* ---------------- code generation ---------------- */
+
+/* Stack effect of each opcode. */
+static int
+stack_effect(int op)
+{
+    switch (op) {
+    case OP_PUSH: case OP_LOAD: case OP_POSTINC: case OP_POSTDEC: case OP_STATUS:
+        return 1;
+    case OP_STORE: case OP_NEG: case OP_NOT: case OP_BNOT: case OP_BOOL: case OP_JMP:
+        return 0;
+    default:
+        return -1;      /* binary operators, pops and conditional jumps */
+    }
+}
+
+static struct insn *
+emit(struct compiler *c, int op)
+{
+    if (c->n == c->cap) {
+        c->cap = c->cap ? 2 * c->cap : 16;
+        c->code = realloc(c->code, c->cap * sizeof *c->code);
+        if (!c->code)
+            utils_fatal_error("arith: out of memory");
+    }
+    c->depth += stack_effect(op);
+    if (c->depth > c->maxdepth)
+        c->maxdepth = c->depth;
+    struct insn *in = &c->code[c->n++];
+    in->op = op;
+    in->imm = 0;
+    return in;
+}
+
+static void
+emit_var(struct compiler *c, int op, const char *name, size_t len)
+{
+    char *s = arena_strndup(c->a, name, len);
+    emit(c, op)->var = vars_intern(s);
+}
+
+/* Point the jump at index at the next instruction. */
+static void
+patch(struct compiler *c, uint32_t at)
+{
+    c->code[at].target = c->n;
+}
+
+/* ---------------- parser ----------------
+ *
+ *   comma   := assign { , assign }
+ *   assign  := name assign-op assign | cond
+ *   cond    := binary [ ? comma : cond ]
+ *   binary  := unary { binary-op unary }     by precedence, ** to the right
+ *   unary   := - unary | + unary | ! unary | ~ unary | ++name | --name | postfix
+ *   postfix := number | $? | name [++ | --] | ( comma )
+ */
+
+static void comma(struct compiler *c);
+
+static int
+binary_prec(int tok, int *op)
+{
+    switch (tok) {
+    case T_OROR:    *op = -1;      return 1;
+    case T_ANDAND:  *op = -1;      return 2;
+    case '|':       *op = OP_BOR;  return 3;
+    case '^':       *op = OP_BXOR; return 4;
+    case '&':       *op = OP_BAND; return 5;
+    case T_EQ:      *op = OP_EQ;   return 6;
+    case T_NE:      *op = OP_NE;   return 6;
+    case '<':       *op = OP_LT;   return 7;
+    case '>':       *op = OP_GT;   return 7;
+    case T_LE:      *op = OP_LE;   return 7;
+    case T_GE:      *op = OP_GE;   return 7;
+    case T_SHL:     *op = OP_SHL;  return 8;
+    case T_SHR:     *op = OP_SHR;  return 8;
+    case '+':       *op = OP_ADD;  return 9;
+    case '-':       *op = OP_SUB;  return 9;
+    case '*':       *op = OP_MUL;  return 10;
+    case '/':       *op = OP_DIV;  return 10;
+    case '%':       *op = OP_MOD;  return 10;
+    case T_POW:     *op = OP_POW;  return 11;
+    }
+    return 0;
+}
+
+/* The operator of an assignment token (OP_PUSH for plain =), or -1. */
+static int
+assign_op(int tok)
+{
+    switch (tok) {
+    case '=':       return OP_PUSH;
+    case T_MULEQ:   return OP_MUL;
+    case T_DIVEQ:   return OP_DIV;
+    case T_MODEQ:   return OP_MOD;
+    case T_ADDEQ:   return OP_ADD;
+    case T_SUBEQ:   return OP_SUB;
+    case T_SHLEQ:   return OP_SHL;
+    case T_SHREQ:   return OP_SHR;
+    case T_ANDEQ:   return OP_BAND;
+    case T_XOREQ:   return OP_BXOR;
+    case T_OREQ:    return OP_BOR;
+    }
+    return -1;
+}
+
+static void
+postfix(struct compiler *c)
+{
+    switch (c->tok) {
+    case T_NUM:
+        emit(c, OP_PUSH)->imm = c->num;
+        lex(c);
+        return;
+    case T_STATUS:
+        emit(c, OP_STATUS);
+        lex(c);
+        return;
+    case T_NAME: {
+        const char *name = c->name;
+        size_t len = c->namelen;
+        lex(c);
+        if (c->tok == T_INC || c->tok == T_DEC) {
+            emit_var(c, c->tok == T_INC ? OP_POSTINC : OP_POSTDEC, name, len);
+            lex(c);
+        } else {
+            emit_var(c, OP_LOAD, name, len);
+        }
+        return;
+    }
+    case '(':
+        lex(c);
+        comma(c);
+        if (c->tok != ')') {
+            fail(c, "missing `)'");
+            return;
+        }
+        lex(c);
+        return;
+    }
+    fail(c, "syntax error: operand expected");
+}
+
+static void
+unary(struct compiler *c)
+{
+    int tok = c->tok;
+    switch (tok) {
+    case '-':
+    case '+':
+    case '!':
+    case '~':
+        lex(c);
+        unary(c);
+        if (tok != '+')
+            emit(c, tok == '-' ? OP_NEG : tok == '!' ? OP_NOT : OP_BNOT);
+        return;
+    case T_INC:
+    case T_DEC:
+        lex(c);
+        if (c->tok != T_NAME) {
+            fail(c, "syntax error: identifier expected after pre-increment or pre-decrement");
+            return;
+        }
+        emit_var(c, OP_LOAD, c->name, c->namelen);
+        emit(c, OP_PUSH)->imm = 1;
+        emit(c, tok == T_INC ? OP_ADD : OP_SUB);
+        emit_var(c, OP_STORE, c->name, c->namelen);
+        lex(c);
+        return;
+    }
+    postfix(c);
+}
+
+static void
+binary(struct compiler *c, int minprec)
+{
+    unary(c);
+    for (;;) {
+        int tok = c->tok, op;
+        int prec = binary_prec(tok, &op);
+        if (prec == 0 || prec < minprec)
+            return;
+        lex(c);
+
+        if (tok == T_ANDAND || tok == T_OROR) {
+            /* a && b: a JZ(false) b BOOL JMP(end) false: PUSH 0 end: */
+            uint32_t skip = c->n;
+            emit(c, tok == T_ANDAND ? OP_JZ : OP_JNZ);
+            binary(c, prec + 1);
+            emit(c, OP_BOOL);
+            uint32_t done = c->n;
+            emit(c, OP_JMP);
+            c->depth--;         /* the two branches push one value between them */
+            patch(c, skip);
+            emit(c, OP_PUSH)->imm = tok == T_OROR;
+            patch(c, done);
+            continue;
+        }
+        binary(c, op == OP_POW ? prec : prec + 1);
+        emit(c, op);
+    }
+}
+
+static void
+cond(struct compiler *c)
+{
+    binary(c, 1);
+    if (c->tok != '?')
+        return;
+    lex(c);
+    uint32_t skip = c->n;
+    emit(c, OP_JZ);
+    comma(c);
+    if (c->tok != ':') {
+        fail(c, "`:' expected for conditional expression");
+        return;
+    }
+    lex(c);
+    uint32_t done = c->n;
+    emit(c, OP_JMP);
+    c->depth--;
+    patch(c, skip);
+    cond(c);
+    patch(c, done);
+}
+
+static void
+assign(struct compiler *c)
+{
+    if (c->tok == T_NAME) {
+        /* look one token ahead for an assignment operator */
+        struct compiler save = *c;
+        const char *name = c->name;
+        size_t len = c->namelen;
+        lex(c);
+        int op = assign_op(c->tok);
+        if (op >= 0) {
+            lex(c);
+            if (op != OP_PUSH)
+                emit_var(c, OP_LOAD, name, len);
+            assign(c);
+            if (op != OP_PUSH)
+                emit(c, op);
+            emit_var(c, OP_STORE, name, len);
+            return;
+        }
+        *c = save;          /* lex() emits nothing, so this is all of it */
+    }
+    cond(c);
+}
+
+static void
+comma(struct compiler *c)
+{
+    assign(c);
+    while (c->tok == ',') {
+        lex(c);
+        emit(c, OP_POP);
+        assign(c);
+    }
+}
+
+const struct arith_prog *
+arith_compile(struct arena *a, const char *src, size_t len)
+{
+    char *text = arena_strndup(a, src, len);
+    struct compiler c = { .a = a, .p = text, .end = text + len };
+
+    lex(&c);
+    if (c.tok == T_END && !c.err) {
+        emit(&c, OP_PUSH);          /* $(( )) is 0 */
+    } else {
+        comma(&c);
+        if (c.tok != T_END)
+            fail(&c, "syntax error in expression");
+    }
+
+    struct arith_prog *p = arena_alloc(a, sizeof *p + c.n * sizeof *c.code);
+    p->src = text;
+    p->err = c.err;
+    p->errtok = c.errtok;
+    p->depth = (uint32_t)c.maxdepth;
+    p->n = c.n;
+    if (c.n)
+        memcpy(p->code, c.code, c.n * sizeof *c.code);
+    free(c.code);
+    return p;
+}
+
+/* ---------------- evaluation ---------------- */
+
+static int run(const struct arith_prog *p, int last_status, long long *out, int level);
+
+static void
+arith_error(const struct arith_prog *p, const char *msg, const char *tok)
+{
+    io_flush();
+    if (tok)
+        fprintf(stderr, "minibash: %s: %s (error token is \"%s\")\n", p->src, msg, tok);
+    else
+        fprintf(stderr, "minibash: %s: %s\n", p->src, msg);
+}
+
+/* The numeric value of a variable: 0 if unset or empty, else its text
+   as a literal or, failing that, as an expression. */
+static int
+load(const struct shell_var *v, int last_status, long long *out, int level)
+{
+    const char *s = var_value(v);
+    if (!s) {
+        *out = 0;
+        return 0;
+    }
+
+    const char *b = s, *e = s + strlen(s);
+    while (b < e && (*b == ' ' || *b == '\t' || *b == '\n'))
+        b++;
+    while (e > b && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\n'))
+        e--;
+    if (b == e) {
+        *out = 0;
+        return 0;
+    }
+    bool neg = *b == '-';
+    const char *digits = (*b == '-' || *b == '+') ? b + 1 : b;
+    if (digits < e && *digits >= '0' && *digits <= '9' &&
+        parse_number(digits, (size_t)(e - digits), out) == NULL) {
+        if (neg)
+            *out = (long long)(0ULL - (unsigned long long)*out);
+        return 0;
+    }
+
+    if (level >= ARITH_MAX_LEVEL) {
+        io_flush();
+        fprintf(stderr, "minibash: %s: expression recursion level exceeded\n", s);
+        return -1;
+    }
+    struct arena a;
+    arena_init(&a);
+    int rc = run(arith_compile(&a, s, strlen(s)), last_status, out, level + 1);
+    arena_free(&a);
+    return rc;
+}
+
+static void
+store(struct shell_var *v, long long val)
+{
+    char buf[24];
+    int n = snprintf(buf, sizeof buf, "%lld", val);
+    var_assign(v, buf, (size_t)n);
+}
+
+static long long
+power(long long base, long long exp)
+{
+    unsigned long long r = 1, b = (unsigned long long)base;
+    while (exp > 0) {
+        if (exp & 1)
+            r *= b;
+        b *= b;
+        exp >>= 1;
+    }
+    return (long long)r;
+}
+
+static int
+run(const struct arith_prog *p, int last_status, long long *out, int level)
+{
+    if (p->err) {
+        arith_error(p, p->err, p->errtok);
+        return -1;
+    }
+
+    long long stack[p->depth + 1];
+    uint32_t sp = 0;
+    typedef unsigned long long u64;
+
+    for (uint32_t pc = 0; pc < p->n; pc++) {
+        const struct insn *in = &p->code[pc];
+        long long a, b, v;
+
+        if (in->op >= OP_MUL && in->op <= OP_BOR) {
+            b = stack[--sp];
+            a = stack[sp - 1];
+            switch (in->op) {
+            case OP_MUL:  v = (long long)((u64)a * (u64)b); break;
+            case OP_ADD:  v = (long long)((u64)a + (u64)b); break;
+            case OP_SUB:  v = (long long)((u64)a - (u64)b); break;
+            case OP_DIV:
+            case OP_MOD:
+                if (b == 0) {
+                    arith_error(p, "division by 0", NULL);
+                    return -1;
+                }
+                if (a == LLONG_MIN && b == -1)
+                    v = in->op == OP_DIV ? LLONG_MIN : 0;
+                else
+                    v = in->op == OP_DIV ? a / b : a % b;
+                break;
+            case OP_POW:
+                if (b < 0) {
+                    arith_error(p, "exponent less than 0", NULL);
+                    return -1;
+                }
+                v = power(a, b);
+                break;
+            case OP_SHL:  v = (long long)((u64)a << (b & 63)); break;
+            case OP_SHR:  v = a >> (b & 63); break;
+            case OP_LT:   v = a < b; break;
+            case OP_LE:   v = a <= b; break;
+            case OP_GT:   v = a > b; break;
+            case OP_GE:   v = a >= b; break;
+            case OP_EQ:   v = a == b; break;
+            case OP_NE:   v = a != b; break;
+            case OP_BAND: v = a & b; break;
+            case OP_BXOR: v = a ^ b; break;
+            default:      v = a | b; break;
+            }
+            stack[sp - 1] = v;
+            continue;
+        }
+
+        switch (in->op) {
+        case OP_PUSH:
+            stack[sp++] = in->imm;
+            break;
+        case OP_STATUS:
+            stack[sp++] = last_status;
+            break;
+        case OP_LOAD:
+            if (load(in->var, last_status, &stack[sp], level) != 0)
+                return -1;
+            sp++;
+            break;
+        case OP_STORE:
+            store(in->var, stack[sp - 1]);
+            break;
+        case OP_POSTINC:
+        case OP_POSTDEC:
+            if (load(in->var, last_status, &v, level) != 0)
+                return -1;
+            stack[sp++] = v;
+            store(in->var, (long long)((u64)v + (in->op == OP_POSTINC ? 1 : (u64)-1)));
+            break;
+        case OP_NEG:
+            stack[sp - 1] = (long long)(0ULL - (u64)stack[sp - 1]);
+            break;
+        case OP_NOT:
+            stack[sp - 1] = !stack[sp - 1];
+            break;
+        case OP_BNOT:
+            stack[sp - 1] = ~stack[sp - 1];
+            break;
+        case OP_BOOL:
+            stack[sp - 1] = stack[sp - 1] != 0;
+            break;
+        case OP_POP:
+            sp--;
+            break;
+        case OP_JZ:
+            if (stack[--sp] == 0)
+                pc = in->target - 1;
+            break;
+        case OP_JNZ:
+            if (stack[--sp] != 0)
+                pc = in->target - 1;
+            break;
+        case OP_JMP:
+            pc = in->target - 1;
+            break;
+        }
+    }
+    *out = stack[sp - 1];
+    return 0;
+}
+
+int
+arith_eval(const struct arith_prog *p, int last_status, long long *out)
+{
+    return run(p, last_status, out, 0);
+}
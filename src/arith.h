@@ -0,0 +1,27 @@
+#pragma once
+#include <stddef.h>
+
+#include "arena.h"
+
+/*
+ * Shell arithmetic: $(( )) and (( )).
+ *
+ * An expression is compiled once, when the script is lowered, into a
+ * postfix program for a small stack machine that the IR keeps next to
+ * the word part or command it came from.  Running it involves no
+ * parsing: `i=$((i + 1))` is a load, an add and a store.
+ *
+ * Values are 64-bit signed integers that wrap on overflow.  The
+ * operators and their precedence are C's plus bash's **, and literals
+ * may be written 0x1f, 017 or base#digits.  A variable that holds
+ * something other than a number is evaluated as an expression itself.
+ */
+
+struct arith_prog;
+
+/* Compile src[0..len) in a.  A syntax error is not reported here but
+   each time the program is run, as bash does. */
+const struct arith_prog *arith_compile(struct arena *a, const char *src, size_t len);
+
+/* Run p.  Returns 0 and sets *out, or -1 after printing a message. */
+int arith_eval(const struct arith_prog *p, int last_status, long long *out);
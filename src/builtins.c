@@ -0,0 +1,935 @@
+// builtins.c
+// Builtin registry and the builtins that do not need interpreter state.
+//
+// Lookup is a perfect hash computed at compile time: a name's slot is a
+// function of its length and its first and last characters, so finding a
+// builtin (or learning that a word is not one) costs one table probe and
+// one strcmp.  Slots are given as designated initializers built from
+// character constants; two names landing in the same slot would override
+// each other, which the pragma below turns into a compile error.  If a new
+// name collides, pick new multipliers for BUILTIN_SLOT.
+
+#define _GNU_SOURCE
+#include "builtins.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "cond.h"
+#include "pathcache.h"
+#include "redir.h"
+#include "vars.h"
+
+/* =========================
+ * Output helpers
+ * ========================= */
+
+char *
+io_capture_reserve(struct io_capture *cap, size_t n)
+{
+    if (cap->cap - cap->len < n) {
+        size_t ncap = cap->cap ? 2 * cap->cap : 1024;
+        while (ncap - cap->len < n)
+            ncap *= 2;
+        cap->buf = arena_grow(cap->arena, cap->buf, cap->len, ncap);
+        cap->cap = ncap;
+    }
+    return cap->buf + cap->len;
+}
+
+/*
+ * Output of builtins to the shell's own stdout.  A loop that runs echo
+ * a million times would otherwise make a million write()s, so it is
+ * collected here and written when the buffer fills, and by io_flush()
+ * before anything else can write to the same file.  On a terminal it is
+ * written out at every newline instead, like stdio's line buffering.
+ */
+#define SHELL_OUT_SIZE (64 * 1024)
+
+static struct {
+    char buf[SHELL_OUT_SIZE];
+    size_t len;
+    int line;           /* fd 1 is a terminal; -1 until looked up */
+    bool nl;            /* a newline went in since the last flush */
+} shell_out = { .line = -1 };
+
+static int
+write_all(int fd, const char *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int
+shell_out_flush(void)
+{
+    int rc = write_all(STDOUT_FILENO, shell_out.buf, shell_out.len);
+    shell_out.len = 0;
+    shell_out.nl = false;
+    return rc;
+}
+
+static int
+shell_out_put(const void *buf, size_t len)
+{
+    if (len > sizeof shell_out.buf - shell_out.len) {
+        if (shell_out_flush() != 0)
+            return -1;
+        if (len >= sizeof shell_out.buf)
+            return write_all(STDOUT_FILENO, buf, len);
+    }
+    memcpy(shell_out.buf + shell_out.len, buf, len);
+    shell_out.len += len;
+    if (shell_out.line && memchr(buf, '\n', len))
+        shell_out.nl = true;
+    return 0;
+}
+
+/* End of one builtin write: a terminal gets whole lines as they come. */
+static int
+shell_out_done(void)
+{
+    if (shell_out.line < 0)
+        shell_out.line = isatty(STDOUT_FILENO);
+    if (shell_out.line && shell_out.nl)
+        return shell_out_flush();
+    return 0;
+}
+
+void
+io_flush(void)
+{
+    if (shell_out.len)
+        (void)shell_out_flush();
+    fflush(NULL);
+}
+
+int
+io_write(io_ctx *io, const void *buf, size_t len)
+{
+    if (io->capture) {
+        memcpy(io_capture_reserve(io->capture, len), buf, len);
+        io->capture->len += len;
+        return 0;
+    }
+    if (io->out_fd == STDOUT_FILENO)
+        return shell_out_put(buf, len) == 0 ? shell_out_done() : -1;
+    return write_all(io->out_fd, buf, len);
+}
+
+int
+io_writev(io_ctx *io, struct iovec *iov, int iovcnt)
+{
+    if (io->capture) {
+        for (int i = 0; i < iovcnt; i++) {
+            memcpy(io_capture_reserve(io->capture, iov[i].iov_len), iov[i].iov_base, iov[i].iov_len);
+            io->capture->len += iov[i].iov_len;
+        }
+        return 0;
+    }
+    if (io->out_fd == STDOUT_FILENO) {
+        for (int i = 0; i < iovcnt; i++)
+            if (shell_out_put(iov[i].iov_base, iov[i].iov_len) != 0)
+                return -1;
+        return shell_out_done();
+    }
+
+    while (iovcnt > 0) {
+        ssize_t n = writev(io->out_fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        /* skip what was written; a short write may end mid-buffer */
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+int
+io_printf(io_ctx *io, const char *fmt, ...)
+{
+    va_list ap;
+    char *s = NULL;
+    va_start(ap, fmt);
+    int n = vasprintf(&s, fmt, ap);
+    va_end(ap);
+    if (n < 0) return -1;
+    int rc = io_write(io, s, (size_t)n);
+    free(s);
+    return rc;
+}
+
+int
+io_errorf(io_ctx *io, const char *fmt, ...)
+{
+    va_list ap;
+    io_flush();     /* keep the message after the output before it */
+    va_start(ap, fmt);
+    dprintf(io->err_fd, "minibash: ");
+    vdprintf(io->err_fd, fmt, ap);
+    va_end(ap);
+    return 0;
+}
+
+/* Growable output buffer, so a builtin can emit its output in one write. */
+struct outbuf {
+    char *s;
+    size_t len, cap;
+};
+
+static int
+outbuf_put(struct outbuf *b, const char *src, size_t n)
+{
+    if (b->len + n + 1 > b->cap) {
+        size_t newcap = b->cap ? b->cap : 64;
+        while (b->len + n + 1 > newcap) newcap *= 2;
+        char *tmp = realloc(b->s, newcap);
+        if (!tmp) return -1;
+        b->s = tmp;
+        b->cap = newcap;
+    }
+    memcpy(b->s + b->len, src, n);
+    b->len += n;
+    b->s[b->len] = '\0';
+    return 0;
+}
+
+static int
+outbuf_putc(struct outbuf *b, char c)
+{
+    return outbuf_put(b, &c, 1);
+}
+
+/* Flush the buffer through io and release it. */
+static int
+outbuf_flush(struct outbuf *b, io_ctx *io)
+{
+    int rc = b->len ? io_write(io, b->s, b->len) : 0;
+    free(b->s);
+    b->s = NULL;
+    b->len = b->cap = 0;
+    return rc;
+}
+
+/* Decode one backslash escape starting after the backslash at *pp.
+   Appends the result to b and advances *pp.  in_b selects the %b/echo -e
+   dialect, where octal escapes are written \0NNN.  Returns false if the
+   escape was \c (stop producing output). */
+static bool
+put_escape(struct outbuf *b, const char **pp, bool in_b)
+{
+    const char *p = *pp;
+    char c = *p;
+    int val, digits;
+
+    switch (c) {
+    case 'a': outbuf_putc(b, '\a'); p++; break;
+    case 'b': outbuf_putc(b, '\b'); p++; break;
+    case 'e': case 'E': outbuf_putc(b, 033); p++; break;
+    case 'f': outbuf_putc(b, '\f'); p++; break;
+    case 'n': outbuf_putc(b, '\n'); p++; break;
+    case 'r': outbuf_putc(b, '\r'); p++; break;
+    case 't': outbuf_putc(b, '\t'); p++; break;
+    case 'v': outbuf_putc(b, '\v'); p++; break;
+    case '\\': outbuf_putc(b, '\\'); p++; break;
+    case 'c':
+        if (in_b) { *pp = p + 1; return false; }
+        outbuf_put(b, "\\c", 2); p++;
+        break;
+    case 'x':
+        p++;
+        for (val = 0, digits = 0; digits < 2 && isxdigit((unsigned char)*p); digits++, p++)
+            val = val * 16 + (isdigit((unsigned char)*p) ? *p - '0' : (tolower((unsigned char)*p) - 'a' + 10));
+        if (digits == 0) outbuf_put(b, "\\x", 2);
+        else outbuf_putc(b, (char)val);
+        break;
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7':
+        if (in_b && c == '0') p++;          /* \0NNN */
+        else if (in_b) { outbuf_putc(b, '\\'); break; }
+        for (val = 0, digits = 0; digits < 3 && *p >= '0' && *p <= '7'; digits++, p++)
+            val = val * 8 + (*p - '0');
+        outbuf_putc(b, (char)val);
+        break;
+    case '\0':
+        outbuf_putc(b, '\\');
+        break;
+    default:
+        if (!in_b && (c == '"' || c == '\'' || c == '?')) {
+            outbuf_putc(b, c);
+        } else {
+            outbuf_putc(b, '\\');
+            outbuf_putc(b, c);
+        }
+        p++;
+        break;
+    }
+    *pp = p;
+    return true;
+}
+
+/* =========================
+ * Trivial builtins
+ * ========================= */
+
+static int
+builtin_colon(int argc, char **argv, io_ctx *io)
+{
+    return 0;
+}
+
+static int
+builtin_false(int argc, char **argv, io_ctx *io)
+{
+    return 1;
+}
+
+/* Most iovecs echo puts on the stack; longer argument lists are buffered. */
+#define ECHO_IOV_MAX 256
+
+static int
+builtin_echo(int argc, char **argv, io_ctx *io)
+{
+    bool newline = true, escapes = false;
+    int i = 1;
+
+    /* Options are only recognized if every char is one of n, e, E. */
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strspn(argv[i] + 1, "neE") != strlen(argv[i] + 1))
+            break;
+        for (const char *o = argv[i] + 1; *o; o++) {
+            if (*o == 'n') newline = false;
+            else if (*o == 'e') escapes = true;
+            else escapes = false;
+        }
+    }
+
+    /* The common case, no escapes: write the arguments where they are,
+       separators and newline in between, with one writev(). */
+    int nargs = argc - i;
+    if (!escapes && 2 * nargs <= ECHO_IOV_MAX) {
+        struct iovec iov[ECHO_IOV_MAX];
+        int n = 0;
+        for (int k = i; k < argc; k++) {
+            if (k > i)
+                iov[n++] = (struct iovec){ " ", 1 };
+            iov[n++] = (struct iovec){ argv[k], strlen(argv[k]) };
+        }
+        if (newline)
+            iov[n++] = (struct iovec){ "\n", 1 };
+        return n == 0 || io_writev(io, iov, n) == 0 ? 0 : 1;
+    }
+
+    /* Escapes, or too many arguments for the stack: copy into a buffer. */
+    struct outbuf b = { 0 };
+    for (int first = i; i < argc; i++) {
+        if (i > first) outbuf_putc(&b, ' ');
+        if (!escapes) {
+            outbuf_put(&b, argv[i], strlen(argv[i]));
+            continue;
+        }
+        for (const char *p = argv[i]; *p; ) {
+            if (*p != '\\') { outbuf_putc(&b, *p++); continue; }
+            p++;
+            if (!put_escape(&b, &p, true))
+                return outbuf_flush(&b, io) == 0 ? 0 : 1;
+        }
+    }
+    if (newline) outbuf_putc(&b, '\n');
+    return outbuf_flush(&b, io) == 0 ? 0 : 1;
+}
+
+static int
+builtin_hash(int argc, char **argv, io_ctx *io)
+{
+    return pathcache_hash_builtin(argc, argv, io);
+}
+
+/* =========================
+ * test / [
+ * ========================= */
+
+struct test_parser {
+    char **argv;
+    int pos, end;
+    int err;            /* set to 2 on a syntax or integer error */
+    io_ctx *io;
+    struct cond_stats stats;
+};
+
+static bool
+test_is_binary_op(const char *s)
+{
+    return cond_binary_op(s) != IR_TOP_NONE && strcmp(s, "&&") != 0 && strcmp(s, "||") != 0;
+}
+
+static bool
+test_unary(struct test_parser *tp, const char *op, const char *arg)
+{
+    return cond_unary(&tp->stats, op[1], arg);
+}
+
+static bool
+test_binary(struct test_parser *tp, const char *l, const char *op, const char *r)
+{
+    const char *bad;
+    int v = cond_binary(&tp->stats, cond_binary_op(op), l, r, &bad);
+    if (v >= 0)
+        return v;
+    if (bad)
+        io_errorf(tp->io, "test: %s: integer expression expected\n", bad);
+    tp->err = 2;
+    return false;
+}
+
+static bool test_or(struct test_parser *tp);
+
+/* primary := '(' or ')' | unary-op arg | arg binary-op arg | arg */
+static bool
+test_primary(struct test_parser *tp)
+{
+    char **a = tp->argv;
+    if (tp->pos >= tp->end) {
+        io_errorf(tp->io, "test: argument expected\n");
+        tp->err = 2;
+        return false;
+    }
+    if (strcmp(a[tp->pos], "(") == 0 && tp->pos + 1 < tp->end) {
+        tp->pos++;
+        bool v = test_or(tp);
+        if (tp->pos >= tp->end || strcmp(a[tp->pos], ")") != 0) {
+            io_errorf(tp->io, "test: `)' expected\n");
+            tp->err = 2;
+            return false;
+        }
+        tp->pos++;
+        return v;
+    }
+    if (tp->pos + 1 < tp->end && test_is_binary_op(a[tp->pos + 1]) &&
+        strcmp(a[tp->pos + 1], "-a") != 0 && strcmp(a[tp->pos + 1], "-o") != 0) {
+        if (tp->pos + 2 >= tp->end) {
+            io_errorf(tp->io, "test: %s: argument expected\n", a[tp->pos + 1]);
+            tp->err = 2;
+            return false;
+        }
+        bool v = test_binary(tp, a[tp->pos], a[tp->pos + 1], a[tp->pos + 2]);
+        tp->pos += 3;
+        return v;
+    }
+    if (cond_unary_op(a[tp->pos]) && tp->pos + 1 < tp->end) {
+        bool v = test_unary(tp, a[tp->pos], a[tp->pos + 1]);
+        tp->pos += 2;
+        return v;
+    }
+    return a[tp->pos++][0] != '\0';
+}
+
+static bool
+test_not(struct test_parser *tp)
+{
+    if (tp->pos < tp->end && strcmp(tp->argv[tp->pos], "!") == 0 && tp->pos + 1 < tp->end) {
+        tp->pos++;
+        return !test_not(tp);
+    }
+    return test_primary(tp);
+}
+
+static bool
+test_and(struct test_parser *tp)
+{
+    bool v = test_not(tp);
+    while (tp->pos < tp->end && strcmp(tp->argv[tp->pos], "-a") == 0) {
+        tp->pos++;
+        bool r = test_not(tp);
+        v = v && r;
+    }
+    return v;
+}
+
+static bool
+test_or(struct test_parser *tp)
+{
+    bool v = test_and(tp);
+    while (tp->pos < tp->end && strcmp(tp->argv[tp->pos], "-o") == 0) {
+        tp->pos++;
+        bool r = test_and(tp);
+        v = v || r;
+    }
+    return v;
+}
+
+/* Evaluate argv[0..n) following the POSIX rules that decide by the
+   number of arguments, falling back to the precedence parser. */
+static bool
+test_eval(struct test_parser *tp, char **a, int n)
+{
+    switch (n) {
+    case 0:
+        return false;
+    case 1:
+        return a[0][0] != '\0';
+    case 2:
+        if (strcmp(a[0], "!") == 0)
+            return a[1][0] == '\0';
+        if (cond_unary_op(a[0]))
+            return test_unary(tp, a[0], a[1]);
+        io_errorf(tp->io, "test: %s: unary operator expected\n", a[0]);
+        tp->err = 2;
+        return false;
+    case 3:
+        if (test_is_binary_op(a[1]))
+            return test_binary(tp, a[0], a[1], a[2]);
+        if (strcmp(a[0], "!") == 0)
+            return !test_eval(tp, a + 1, 2);
+        if (strcmp(a[0], "(") == 0 && strcmp(a[2], ")") == 0)
+            return a[1][0] != '\0';
+        break;
+    case 4:
+        if (strcmp(a[0], "!") == 0)
+            return !test_eval(tp, a + 1, 3);
+        if (strcmp(a[0], "(") == 0 && strcmp(a[3], ")") == 0)
+            return test_eval(tp, a + 1, 2);
+        break;
+    }
+
+    tp->argv = a;
+    tp->pos = 0;
+    tp->end = n;
+    bool v = test_or(tp);
+    if (!tp->err && tp->pos < tp->end) {
+        io_errorf(tp->io, "test: too many arguments\n");
+        tp->err = 2;
+    }
+    return v;
+}
+
+static int
+builtin_test(int argc, char **argv, io_ctx *io)
+{
+    int n = argc - 1;
+    if (strcmp(argv[0], "[") == 0) {
+        if (n == 0 || strcmp(argv[argc - 1], "]") != 0) {
+            io_errorf(io, "[: missing `]'\n");
+            return 2;
+        }
+        n--;
+    }
+
+    struct test_parser tp = { .io = io };
+    bool v = test_eval(&tp, argv + 1, n);
+    return tp.err ? tp.err : (v ? 0 : 1);
+}
+
+/* =========================
+ * printf
+ * ========================= */
+
+/* Numeric argument: decimal, 0x hex, 0 octal, or 'c for a character code. */
+static long long
+printf_number(const char *s, io_ctx *io, int *status)
+{
+    if (s[0] == '\'' || s[0] == '"')
+        return (unsigned char)s[1];
+    if (s[0] == '\0')
+        return 0;
+
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 0);
+    if (*end != '\0' || errno == ERANGE) {
+        io_errorf(io, "printf: %s: invalid number\n", s);
+        *status = 1;
+    }
+    return v;
+}
+
+static double
+printf_double(const char *s, io_ctx *io, int *status)
+{
+    if (s[0] == '\'' || s[0] == '"')
+        return (unsigned char)s[1];
+    if (s[0] == '\0')
+        return 0;
+
+    char *end;
+    double v = strtod(s, &end);
+    if (*end != '\0') {
+        io_errorf(io, "printf: %s: invalid number\n", s);
+        *status = 1;
+    }
+    return v;
+}
+
+/* Append s quoted so that the shell would read it back as one word. */
+static void
+printf_quoted(struct outbuf *b, const char *s)
+{
+    if (*s == '\0') { outbuf_put(b, "''", 2); return; }
+    for (; *s; s++) {
+        if (!isalnum((unsigned char)*s) && !strchr("_-./,:=+@%", *s))
+            outbuf_putc(b, '\\');
+        outbuf_putc(b, *s);
+    }
+}
+
+static int
+builtin_printf(int argc, char **argv, io_ctx *io)
+{
+    int ai = 1;
+    if (ai < argc && strcmp(argv[ai], "--") == 0) ai++;
+    if (ai >= argc) {
+        io_errorf(io, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    const char *fmt = argv[ai++];
+    int status = 0;
+    struct outbuf b = { 0 };
+
+    /* The format is reused as long as it consumes arguments. */
+    for (;;) {
+        int first_arg = ai;
+        for (const char *p = fmt; *p; ) {
+            if (*p == '\\') {
+                p++;
+                put_escape(&b, &p, false);
+                continue;
+            }
+            if (*p != '%') {
+                outbuf_putc(&b, *p++);
+                continue;
+            }
+            if (p[1] == '%') {
+                outbuf_putc(&b, '%');
+                p += 2;
+                continue;
+            }
+
+            /* Collect "%[flags][width][.prec]" into spec, expanding '*'. */
+            char spec[64];
+            size_t sl = 0;
+            spec[sl++] = *p++;
+            while (*p && strchr("-+ #0", *p) && sl < 40) spec[sl++] = *p++;
+            for (int part = 0; part < 2; part++) {
+                if (part == 1) {
+                    if (*p != '.') break;
+                    spec[sl++] = *p++;
+                }
+                if (*p == '*') {
+                    p++;
+                    long long w = ai < argc ? printf_number(argv[ai++], io, &status) : 0;
+                    sl += (size_t)snprintf(spec + sl, sizeof spec - sl - 8, "%d", (int)w);
+                } else {
+                    while (isdigit((unsigned char)*p) && sl < 50) spec[sl++] = *p++;
+                }
+            }
+
+            char conv = *p;
+            if (conv == '\0') {
+                io_errorf(io, "printf: `%s': missing format character\n", spec);
+                status = 1;
+                break;
+            }
+            p++;
+
+            const char *arg = ai < argc ? argv[ai++] : NULL;
+            char *piece = NULL;
+            int n = -1;
+            switch (conv) {
+            case 'd': case 'i':
+                spec[sl++] = 'l'; spec[sl++] = 'l'; spec[sl++] = conv; spec[sl] = '\0';
+                n = asprintf(&piece, spec, arg ? printf_number(arg, io, &status) : 0LL);
+                break;
+            case 'o': case 'u': case 'x': case 'X':
+                spec[sl++] = 'l'; spec[sl++] = 'l'; spec[sl++] = conv; spec[sl] = '\0';
+                n = asprintf(&piece, spec,
+                             (unsigned long long)(arg ? printf_number(arg, io, &status) : 0LL));
+                break;
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                spec[sl++] = conv; spec[sl] = '\0';
+                n = asprintf(&piece, spec, arg ? printf_double(arg, io, &status) : 0.0);
+                break;
+            case 'c':
+                if (arg && arg[0]) {
+                    spec[sl++] = 'c'; spec[sl] = '\0';
+                    n = asprintf(&piece, spec, arg[0]);
+                } else {
+                    spec[sl++] = 's'; spec[sl] = '\0';
+                    n = asprintf(&piece, spec, "");
+                }
+                break;
+            case 's':
+                spec[sl++] = 's'; spec[sl] = '\0';
+                n = asprintf(&piece, spec, arg ? arg : "");
+                break;
+            case 'b':
+            case 'q': {
+                struct outbuf tmp = { 0 };
+                bool keep_going = true;
+                if (conv == 'q') {
+                    printf_quoted(&tmp, arg ? arg : "");
+                } else {
+                    for (const char *q = arg ? arg : ""; *q && keep_going; ) {
+                        if (*q != '\\') { outbuf_putc(&tmp, *q++); continue; }
+                        q++;
+                        keep_going = put_escape(&tmp, &q, true);
+                    }
+                }
+                spec[sl++] = 's'; spec[sl] = '\0';
+                n = asprintf(&piece, spec, tmp.s ? tmp.s : "");
+                free(tmp.s);
+                if (!keep_going) {
+                    if (n > 0) outbuf_put(&b, piece, (size_t)n);
+                    free(piece);
+                    outbuf_flush(&b, io);
+                    return status;
+                }
+                break;
+            }
+            default:
+                io_errorf(io, "printf: `%c': invalid format character\n", conv);
+                free(b.s);
+                return 1;
+            }
+            if (n > 0) outbuf_put(&b, piece, (size_t)n);
+            free(piece);
+        }
+        if (ai >= argc || ai == first_arg)
+            break;
+    }
+
+    if (outbuf_flush(&b, io) != 0)
+        return 1;
+    return status;
+}
+
+/* =========================
+ * Directory and environment builtins
+ * ========================= */
+
+static int
+builtin_cd(int argc, char **argv, io_ctx *io)
+{
+    if (argc > 2) {
+        io_errorf(io, "cd: too many arguments\n");
+        return 1;
+    }
+
+    const char *dir = argc > 1 ? argv[1] : vars_get("HOME");
+    bool print = false;
+    if (!dir) {
+        io_errorf(io, "cd: HOME not set\n");
+        return 1;
+    }
+    if (strcmp(dir, "-") == 0) {
+        dir = vars_get("OLDPWD");
+        if (!dir) {
+            io_errorf(io, "cd: OLDPWD not set\n");
+            return 1;
+        }
+        print = true;
+    }
+
+    char *old = getcwd(NULL, 0);
+    if (chdir(dir) != 0) {
+        io_errorf(io, "cd: %s: %s\n", dir, strerror(errno));
+        free(old);
+        return 1;
+    }
+
+    redir_cache_drop();     /* relative targets now name other files */
+    char *now = getcwd(NULL, 0);
+    if (old) vars_set("OLDPWD", old);
+    if (now) vars_set("PWD", now);
+    if (print && now) io_printf(io, "%s\n", now);
+    free(old);
+    free(now);
+    return 0;
+}
+
+static int
+builtin_pwd(int argc, char **argv, io_ctx *io)
+{
+    char *cwd = getcwd(NULL, 0);
+    if (!cwd) {
+        io_errorf(io, "pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    int rc = io_printf(io, "%s\n", cwd);
+    free(cwd);
+    return rc == 0 ? 0 : 1;
+}
+
+static bool
+valid_identifier(const char *s, size_t len)
+{
+    if (len == 0 || !(isalpha((unsigned char)s[0]) || s[0] == '_'))
+        return false;
+    for (size_t i = 1; i < len; i++)
+        if (!(isalnum((unsigned char)s[i]) || s[i] == '_'))
+            return false;
+    return true;
+}
+
+static int
+cmp_env_entries(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int
+builtin_export(int argc, char **argv, io_ctx *io)
+{
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) { i++; break; }
+        if (strcmp(argv[i], "-p") != 0) {
+            io_errorf(io, "export: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (i == argc) {
+        /* export -p: the exported variables are exactly the environment
+           of the next command. */
+        char **env = vars_environ();
+        size_t n = 0;
+        while (env[n]) n++;
+        char **sorted = malloc((n ? n : 1) * sizeof *sorted);
+        if (!sorted) return 1;
+        memcpy(sorted, env, n * sizeof *sorted);
+        qsort(sorted, n, sizeof *sorted, cmp_env_entries);
+        struct outbuf b = { 0 };
+        for (size_t k = 0; k < n; k++) {
+            const char *eq = strchr(sorted[k], '=');
+            if (!eq) continue;
+            outbuf_put(&b, "declare -x ", 11);
+            outbuf_put(&b, sorted[k], (size_t)(eq - sorted[k]));
+            outbuf_put(&b, "=\"", 2);
+            for (const char *v = eq + 1; *v; v++) {
+                if (strchr("\"\\$`", *v)) outbuf_putc(&b, '\\');
+                outbuf_putc(&b, *v);
+            }
+            outbuf_put(&b, "\"\n", 2);
+        }
+        free(sorted);
+        return outbuf_flush(&b, io) == 0 ? 0 : 1;
+    }
+
+    int status = 0;
+    for (; i < argc; i++) {
+        const char *eq = strchr(argv[i], '=');
+        size_t nlen = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (!valid_identifier(argv[i], nlen)) {
+            io_errorf(io, "export: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        char *name = strndup(argv[i], nlen);
+        if (!name) return 1;
+        struct shell_var *v = vars_intern(name);
+        free(name);
+        if (eq)
+            var_assign(v, eq + 1, strlen(eq + 1));
+        var_export(v);
+    }
+    return status;
+}
+
+static int
+builtin_unset(int argc, char **argv, io_ctx *io)
+{
+    int i = 1;
+    bool functions = false;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) { i++; break; }
+        if (strcmp(argv[i], "-f") == 0) {
+            functions = true;
+        } else if (strcmp(argv[i], "-v") != 0) {
+            io_errorf(io, "unset: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
+    /* there are no functions to unset, and -f must not touch variables */
+    if (functions)
+        return 0;
+
+    int status = 0;
+    for (; i < argc; i++) {
+        if (!valid_identifier(argv[i], strlen(argv[i]))) {
+            io_errorf(io, "unset: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        vars_unset(argv[i]);
+    }
+    return status;
+}
+
+/* =========================
+ * Registry
+ * ========================= */
+
+#define BUILTIN_SLOTS 32
+#define BUILTIN_SLOT(len, first, last) \
+    (((unsigned)(len) + 17u * (unsigned char)(first) + (unsigned char)(last)) & (BUILTIN_SLOTS - 1))
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic error "-Woverride-init"
+static const struct builtin builtin_table[BUILTIN_SLOTS] = {
+    [BUILTIN_SLOT(1, ':', ':')] = { ":",      builtin_colon,   true },
+    [BUILTIN_SLOT(1, '[', '[')] = { "[",      builtin_test,    true },
+    [BUILTIN_SLOT(5, 'b', 'k')] = { "break",  builtin_break,   false },
+    [BUILTIN_SLOT(2, 'c', 'd')] = { "cd",     builtin_cd,      false },
+    [BUILTIN_SLOT(8, 'c', 'e')] = { "continue", builtin_continue, false },
+    [BUILTIN_SLOT(4, 'e', 'o')] = { "echo",   builtin_echo,    true },
+    [BUILTIN_SLOT(4, 'e', 't')] = { "exit",   builtin_exit,    false },
+    [BUILTIN_SLOT(6, 'e', 't')] = { "export", builtin_export,  false },
+    [BUILTIN_SLOT(5, 'f', 'e')] = { "false",  builtin_false,   true },
+    [BUILTIN_SLOT(4, 'h', 'h')] = { "hash",   builtin_hash,    false },
+    [BUILTIN_SLOT(4, 'j', 's')] = { "jobs",   builtin_jobs,    true },
+    [BUILTIN_SLOT(12, 'p', 'r')] = { "parallel_for", builtin_parallel_for, false },
+    [BUILTIN_SLOT(6, 'p', 'f')] = { "printf", builtin_printf,  true },
+    [BUILTIN_SLOT(3, 'p', 'd')] = { "pwd",    builtin_pwd,     true },
+    [BUILTIN_SLOT(4, 't', 't')] = { "test",   builtin_test,    true },
+    [BUILTIN_SLOT(4, 't', 'e')] = { "true",   builtin_colon,   true },
+    [BUILTIN_SLOT(5, 'u', 't')] = { "unset",  builtin_unset,   false },
+    [BUILTIN_SLOT(4, 'w', 't')] = { "wait",   builtin_wait,    false },
+};
+#pragma GCC diagnostic pop
+
+const struct builtin *
+builtin_lookup(const char *name)
+{
+    size_t len = strlen(name);
+    if (len == 0)
+        return NULL;
+    const struct builtin *b = &builtin_table[BUILTIN_SLOT(len, name[0], name[len - 1])];
+    if (b->name && strcmp(b->name, name) == 0)
+        return b;
+    return NULL;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "arena.h"
+
+/*
+ * Builtin commands.
+ *
+ * Every builtin has the signature
+ *     int builtin(int argc, char **argv, io_ctx *io)
+ * and writes through the descriptors in its io_ctx instead of fds 0/1/2,
+ * so the shell can run it in-process with redirected I/O without dup2'ing
+ * (or forking) anything.  The return value is the exit status.
+ */
+
+/* Output collected in memory, for $(...).  The buffer doubles in
+   arena; see arena_grow() for why large captures are not copied. */
+struct io_capture {
+    struct arena *arena;
+    char *buf;
+    size_t len, cap;
+};
+
+typedef struct io_ctx {
+    int in_fd;
+    int out_fd;
+    int err_fd;
+    struct io_capture *capture;     /* if set, output goes here, not to out_fd */
+} io_ctx;
+
+/* The shell's own standard streams. */
+#define IO_CTX_STDIO ((io_ctx){ .in_fd = 0, .out_fd = 1, .err_fd = 2 })
+
+typedef int (*builtin_fn)(int argc, char **argv, io_ctx *io);
+
+struct builtin {
+    const char *name;
+    builtin_fn fn;
+    bool pure;      /* only writes output; no effect on shell state */
+};
+
+/* Return the builtin called name, or NULL. */
+const struct builtin *builtin_lookup(const char *name);
+
+/* Make room for at least n more bytes in cap and return where they go. */
+char *io_capture_reserve(struct io_capture *cap, size_t n);
+
+/* Output helpers for builtins.  Return 0 on success, -1 on write error.
+   Output is appended to the capture if there is one, else written to
+   out_fd; output to fd 1 is buffered in the shell, see io_flush(). */
+int io_write(io_ctx *io, const void *buf, size_t len);
+/* Gathered write; iov is modified. */
+int io_writev(io_ctx *io, struct iovec *iov, int iovcnt);
+int io_printf(io_ctx *io, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int io_errorf(io_ctx *io, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/* Write out what builtins left in the shell's stdout buffer, and stdio's
+   buffers.  Call it before anything else may write to the same file or
+   terminal: before a fork (or the child would write it again), a spawn,
+   opening redirections, prompting, and exiting. */
+void io_flush(void);
+
+/* Builtins that need interpreter state; implemented in minibash.c. */
+int builtin_exit(int argc, char **argv, io_ctx *io);
+int builtin_break(int argc, char **argv, io_ctx *io);
+int builtin_continue(int argc, char **argv, io_ctx *io);
+int builtin_jobs(int argc, char **argv, io_ctx *io);
+int builtin_wait(int argc, char **argv, io_ctx *io);
+int builtin_parallel_for(int argc, char **argv, io_ctx *io);
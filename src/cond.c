@@ -0,0 +1,264 @@
+// cond.c
+// Conditional expressions: the operators of test, [ and [[, and the
+// evaluator for the expression trees of [ ] and [[ ]].
+
+#include "cond.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "expand.h"
+#include "vars.h"
+
+/* ---------------- operators ---------------- */
+
+int
+cond_binary_op(const char *s)
+{
+    static const struct { const char *name; int op; } ops[] = {
+        { "=",   IR_TOP_STR_EQ },   { "==",  IR_TOP_STR_EQ },
+        { "!=",  IR_TOP_STR_NE },   { "<",   IR_TOP_STR_LT },
+        { ">",   IR_TOP_STR_GT },   { "=~",  IR_TOP_REGEX },
+        { "-eq", IR_TOP_EQ },       { "-ne", IR_TOP_NE },
+        { "-lt", IR_TOP_LT },       { "-le", IR_TOP_LE },
+        { "-gt", IR_TOP_GT },       { "-ge", IR_TOP_GE },
+        { "-nt", IR_TOP_NT },       { "-ot", IR_TOP_OT },
+        { "-ef", IR_TOP_EF },
+        { "-a",  IR_TOP_AND },      { "&&",  IR_TOP_AND },
+        { "-o",  IR_TOP_OR },       { "||",  IR_TOP_OR },
+    };
+    for (size_t i = 0; i < sizeof ops / sizeof ops[0]; i++)
+        if (strcmp(s, ops[i].name) == 0)
+            return ops[i].op;
+    return IR_TOP_NONE;
+}
+
+bool
+cond_unary_op(const char *s)
+{
+    return s[0] == '-' && s[1] != '\0' && s[2] == '\0' &&
+           strchr("abcdefghknprstuvwxzGLNOS", s[1]) != NULL;
+}
+
+/* stat(path), or the result of an earlier call for the same path.
+   NULL if it failed. */
+static const struct stat *
+cond_stat(struct cond_stats *cs, const char *path)
+{
+    for (int i = 0; i < cs->n; i++)
+        if (strcmp(cs->e[i].path, path) == 0)
+            return cs->e[i].ok ? &cs->e[i].st : NULL;
+
+    int i = cs->n < COND_STATS ? cs->n++ : COND_STATS - 1;
+    cs->e[i].path = path;
+    cs->e[i].ok = stat(path, &cs->e[i].st) == 0;
+    return cs->e[i].ok ? &cs->e[i].st : NULL;
+}
+
+bool
+cond_unary(struct cond_stats *cs, int op, const char *arg)
+{
+    switch (op) {
+    case 'n': return arg[0] != '\0';
+    case 'z': return arg[0] == '\0';
+    case 'v': return vars_get(arg) != NULL;
+    case 't': return isatty(atoi(arg));
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    case 'h':
+    case 'L': {
+        struct stat st;
+        return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    }
+
+    const struct stat *st = cond_stat(cs, arg);
+    if (!st)
+        return false;
+    switch (op) {
+    case 'a':
+    case 'e': return true;
+    case 'f': return S_ISREG(st->st_mode);
+    case 'd': return S_ISDIR(st->st_mode);
+    case 'b': return S_ISBLK(st->st_mode);
+    case 'c': return S_ISCHR(st->st_mode);
+    case 'p': return S_ISFIFO(st->st_mode);
+    case 'S': return S_ISSOCK(st->st_mode);
+    case 's': return st->st_size > 0;
+    case 'g': return (st->st_mode & S_ISGID) != 0;
+    case 'u': return (st->st_mode & S_ISUID) != 0;
+    case 'k': return (st->st_mode & S_ISVTX) != 0;
+    case 'O': return st->st_uid == geteuid();
+    case 'G': return st->st_gid == getegid();
+    case 'N': return st->st_mtime >= st->st_atime;
+    }
+    return false;
+}
+
+static bool
+cond_integer(const char *s, long long *out)
+{
+    char *end;
+    errno = 0;
+    while (isspace((unsigned char)*s)) s++;
+    long long v = strtoll(s, &end, 10);
+    while (isspace((unsigned char)*end)) end++;
+    if (end == s || *end != '\0' || errno == ERANGE)
+        return false;
+    *out = v;
+    return true;
+}
+
+/* Compare modification times: <0, 0 or >0. */
+static int
+mtime_cmp(const struct stat *a, const struct stat *b)
+{
+    if (a->st_mtim.tv_sec != b->st_mtim.tv_sec)
+        return a->st_mtim.tv_sec < b->st_mtim.tv_sec ? -1 : 1;
+    if (a->st_mtim.tv_nsec != b->st_mtim.tv_nsec)
+        return a->st_mtim.tv_nsec < b->st_mtim.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+static int
+regex_match(const char *s, const char *re)
+{
+    regex_t rx;
+    if (regcomp(&rx, re, REG_EXTENDED | REG_NOSUB) != 0)
+        return -1;
+    int v = regexec(&rx, s, 0, NULL, 0) == 0;
+    regfree(&rx);
+    return v;
+}
+
+int
+cond_binary(struct cond_stats *cs, int op, const char *l, const char *r,
+            const char **bad)
+{
+    const struct stat *ls, *rs;
+
+    switch (op) {
+    case IR_TOP_STR_EQ: return strcmp(l, r) == 0;
+    case IR_TOP_STR_NE: return strcmp(l, r) != 0;
+    case IR_TOP_STR_LT: return strcmp(l, r) < 0;
+    case IR_TOP_STR_GT: return strcmp(l, r) > 0;
+    case IR_TOP_PAT_EQ: return fnmatch(r, l, 0) == 0;
+    case IR_TOP_PAT_NE: return fnmatch(r, l, 0) != 0;
+    case IR_TOP_AND:    return l[0] != '\0' && r[0] != '\0';
+    case IR_TOP_OR:     return l[0] != '\0' || r[0] != '\0';
+    case IR_TOP_REGEX: {
+        int v = regex_match(l, r);
+        if (v < 0)
+            *bad = NULL;
+        return v;
+    }
+    case IR_TOP_NT:
+    case IR_TOP_OT:
+    case IR_TOP_EF:
+        ls = cond_stat(cs, l);
+        rs = cond_stat(cs, r);
+        if (op == IR_TOP_EF)
+            return ls && rs && ls->st_dev == rs->st_dev && ls->st_ino == rs->st_ino;
+        if (op == IR_TOP_NT)
+            return ls && (!rs || mtime_cmp(ls, rs) > 0);
+        return rs && (!ls || mtime_cmp(ls, rs) < 0);
+    }
+
+    long long a, b;
+    if (!cond_integer(l, &a)) {
+        *bad = l;
+        return -1;
+    }
+    if (!cond_integer(r, &b)) {
+        *bad = r;
+        return -1;
+    }
+    switch (op) {
+    case IR_TOP_EQ: return a == b;
+    case IR_TOP_NE: return a != b;
+    case IR_TOP_LT: return a < b;
+    case IR_TOP_LE: return a <= b;
+    case IR_TOP_GT: return a > b;
+    case IR_TOP_GE: return a >= b;
+    }
+    return 0;
+}
+
+/* ---------------- [ ] and [[ ]] ---------------- */
+
+struct cond_ctx {
+    struct cond_stats stats;
+    struct arena *a;
+    int last_status;
+    const char *name;       /* "[" or "[[", for messages */
+    int err;
+};
+
+static const char *
+operand(struct cond_ctx *c, const struct ir_texpr *e)
+{
+    int err = EXPAND_OK;
+    return expand_word(c->a, &e->word, c->last_status, &err);
+}
+
+static bool
+truth(struct cond_ctx *c, const struct ir_texpr *e)
+{
+    switch (e->kind) {
+    case IR_TEXPR_WORD:
+        return operand(c, e)[0] != '\0';
+
+    case IR_TEXPR_UNARY:
+        if (e->top == IR_TOP_NOT)
+            return !truth(c, e->left);
+        return cond_unary(&c->stats, e->op[1], operand(c, e->left));
+
+    case IR_TEXPR_BINARY: {
+        if (e->top == IR_TOP_AND)
+            return truth(c, e->left) && truth(c, e->right);
+        if (e->top == IR_TOP_OR)
+            return truth(c, e->left) || truth(c, e->right);
+
+        const char *l = operand(c, e->left), *r = operand(c, e->right), *bad;
+        int v = cond_binary(&c->stats, e->top, l, r, &bad);
+        if (v >= 0)
+            return v;
+        io_flush();
+        if (bad)
+            fprintf(stderr, "minibash: %s: %s: integer expression expected\n", c->name, bad);
+        c->err = 2;
+        return false;
+    }
+
+    default:
+        io_flush();
+        fprintf(stderr, "minibash: %s: %s\n", c->name, e->op);
+        c->err = 2;
+        return false;
+    }
+}
+
+int
+cond_eval(const struct ir_texpr *e, bool double_bracket, struct arena *a,
+          int last_status)
+{
+    if (!e)
+        return 1;
+
+    struct cond_ctx c = {
+        .a = a,
+        .last_status = last_status,
+        .name = double_bracket ? "[[" : "[",
+    };
+    struct arena_mark mark = arena_mark(a);
+    bool v = truth(&c, e);
+    arena_reset(a, mark);
+    return c.err ? c.err : !v;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "ir.h"
+
+/*
+ * Conditional expressions.
+ *
+ * The operators themselves are shared by the test and [ builtins, which
+ * parse their arguments at run time, and by [ ] and [[ ]] written out in
+ * a script, whose expression the lowering has already turned into an
+ * ir_texpr tree with its operators resolved to enum ir_test_op.
+ *
+ * File operators look their operand up through a cond_stats, which keeps
+ * the stat() of every path for the rest of one expression:
+ * `[ -f "$f" -a -s "$f" ]` calls stat() once.
+ */
+
+/* Paths one expression keeps stat() results for; later ones replace
+   the last entry. */
+#define COND_STATS 4
+
+struct cond_stats {
+    int n;
+    struct {
+        const char *path;   /* not copied: must outlive the cond_stats */
+        bool ok;            /* stat() succeeded */
+        struct stat st;
+    } e[COND_STATS];
+};
+
+/* The binary operator s names (=, -eq, -nt, -a, &&, ...), or IR_TOP_NONE. */
+int cond_binary_op(const char *s);
+
+/* True if s is a unary operator: -e, -f, -n, ... */
+bool cond_unary_op(const char *s);
+
+/* Apply the unary operator -op to arg. */
+bool cond_unary(struct cond_stats *cs, int op, const char *arg);
+
+/* Apply a binary operator.  Returns 1 or 0, or -1 if an operand of an
+   integer comparison is not an integer (*bad is set to it) or the
+   regular expression of =~ does not compile (*bad is set to NULL). */
+int cond_binary(struct cond_stats *cs, int op, const char *l, const char *r,
+                const char **bad);
+
+/* Evaluate the expression of a [ ] or [[ ]] command, expanding its
+   operands in a (reset afterwards).  Returns the exit status: 0 if
+   true, 1 if false or empty, 2 on an error. */
+int cond_eval(const struct ir_texpr *e, bool double_bracket, struct arena *a,
+              int last_status);
@@ -0,0 +1,158 @@
+// events.c
+// epoll loop with SIGCHLD delivered through a signalfd.
+
+#define _GNU_SOURCE
+#include "events.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+
+#include "utils.h"
+
+#define EVENTS_BATCH 64
+
+struct source {
+    event_fn fn;
+    void *arg;
+};
+
+static int epfd = -1;
+static int sigfd = -1;
+static pid_t owner;                 /* process the loop was set up in */
+static void (*sigchld_cb)(void);
+
+static struct source *sources;      /* indexed by fd; fn == NULL if unused */
+static int nsources;
+
+static void
+on_signalfd(int fd, uint32_t events, void *arg)
+{
+    /* drain: one pending SIGCHLD may stand for many children */
+    struct signalfd_siginfo si[8];
+    while (read(fd, si, sizeof si) > 0)
+        continue;
+    if (sigchld_cb)
+        sigchld_cb();
+}
+
+static void
+loop_open(void)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (epfd < 0 || sigfd < 0)
+        utils_fatal_error("minibash: cannot set up event loop: ");
+    owner = getpid();
+
+    for (int fd = 0; fd < nsources; fd++)
+        sources[fd].fn = NULL;
+    if (events_add(sigfd, EPOLLIN, on_signalfd, NULL) != 0)
+        utils_fatal_error("minibash: cannot set up event loop: ");
+}
+
+static void
+loop_close(void)
+{
+    if (epfd >= 0) close(epfd);
+    if (sigfd >= 0) close(sigfd);
+    epfd = sigfd = -1;
+}
+
+/* The epoll set is shared with any process forked from us; a child
+   that waits must not steal its parent's events. */
+static void
+loop_check_owner(void)
+{
+    if (owner != getpid()) {
+        loop_close();
+        loop_open();
+    }
+}
+
+void
+events_init(void (*on_sigchld)(void))
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    sigchld_cb = on_sigchld;
+    loop_open();
+}
+
+void
+events_done(void)
+{
+    loop_close();
+    free(sources);
+    sources = NULL;
+    nsources = 0;
+}
+
+int
+events_add(int fd, uint32_t events, event_fn fn, void *arg)
+{
+    loop_check_owner();
+    if (fd >= nsources) {
+        int n = nsources ? nsources : 16;
+        while (n <= fd)
+            n *= 2;
+        struct source *s = realloc(sources, (size_t)n * sizeof *s);
+        if (!s)
+            return -1;
+        memset(s + nsources, 0, (size_t)(n - nsources) * sizeof *s);
+        sources = s;
+        nsources = n;
+    }
+
+    struct epoll_event ev = { .events = events, .data.fd = fd };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        return -1;
+    sources[fd] = (struct source){ fn, arg };
+    return 0;
+}
+
+void
+events_del(int fd)
+{
+    if (fd < 0 || fd >= nsources || sources[fd].fn == NULL)
+        return;
+    sources[fd].fn = NULL;
+    if (owner == getpid())
+        (void)epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int
+events_wait(int timeout)
+{
+    loop_check_owner();
+
+    struct epoll_event evs[EVENTS_BATCH];
+    int n = epoll_wait(epfd, evs, EVENTS_BATCH, timeout);
+    if (n < 0) {
+        if (errno != EINTR)
+            utils_error("minibash: epoll_wait: ");
+        return 0;
+    }
+
+    int dispatched = 0;
+    for (int i = 0; i < n; i++) {
+        int fd = evs[i].data.fd;
+        /* an earlier callback in this batch may have removed it */
+        if (fd >= nsources || sources[fd].fn == NULL)
+            continue;
+        sources[fd].fn(fd, evs[i].events, sources[fd].arg);
+        dispatched++;
+    }
+    return dispatched;
+}
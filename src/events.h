@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/*
+ * The shell's event loop.
+ *
+ * SIGCHLD stays blocked for the life of the shell and is received
+ * through a signalfd instead of a handler, so children are only ever
+ * reaped from ordinary code, never from async-signal context.  That
+ * signalfd and any other descriptors the shell is waiting on (the
+ * terminal, $(...) pipes) sit in one epoll set, and events_wait() is
+ * the single place where the shell sleeps.
+ *
+ * A forked child that keeps running shell code gets a fresh loop the
+ * first time it uses one; sources registered by the parent are dropped.
+ */
+
+/* Called with the ready descriptor and its epoll event bits. */
+typedef void (*event_fn)(int fd, uint32_t events, void *arg);
+
+/* Block SIGCHLD and set up the loop.  on_sigchld runs from
+   events_wait() whenever children may have changed state. */
+void events_init(void (*on_sigchld)(void));
+void events_done(void);
+
+/* Watch fd for events (EPOLLIN, ...).  Returns 0 or -1 with errno set. */
+int events_add(int fd, uint32_t events, event_fn fn, void *arg);
+
+/* Stop watching fd.  Safe to call from a callback, for any fd. */
+void events_del(int fd);
+
+/* Wait up to timeout milliseconds (-1: no limit) and run the callbacks
+   of whatever is ready.  Returns the number of sources dispatched, or
+   0 on timeout or EINTR. */
+int events_wait(int timeout);
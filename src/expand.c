@@ -1,471 +1,386 @@
+#define _GNU_SOURCE
 #include "expand.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
 
-/* Grammar symbol ids (sym_word, sym_string, etc.) */
-#include "ts_symbols.h"
+#include "arith.h"
+#include "events.h"
+#include "param.h"
+#include "redir.h"
+#include "vars.h"
 
-/* For the tester main() only */
-#include "tree_sitter/tree-sitter-bash.h"
-#include <tree_sitter/api.h>   
+/* ========== Command substitution $( ... ) ========== */
 
+/* Pipe capacity asked for with F_SETPIPE_SZ, so that a child producing
+   a lot of output blocks less often and each read() returns more. */
+#define CAPTURE_PIPE_SIZE (1024 * 1024)
 
-/* =========================
- * Local helpers
- * ========================= */
+static struct expand_hooks hooks;
 
-static char *slice_text(const char *input, TSNode node) {
-    uint32_t start = ts_node_start_byte(node);
-    uint32_t end   = ts_node_end_byte(node);
-    if (end < start) end = start;
-    size_t n = (size_t)(end - start);
-    char *s = (char *)malloc(n + 1);
-    if (!s) return NULL;
-    memcpy(s, input + start, n);
-    s[n] = '\0';
-    return s;
+void expand_set_hooks(const struct expand_hooks *h) {
+    hooks = *h;
 }
 
-/* Always return a heap-allocated empty string if possible. */
-static char *empty_heap_string(void) {
-    char *s = (char *)malloc(1);
-    if (s) s[0] = '\0';
-    return s ? s : NULL;
+void expand_param_error(void) {
+    if (hooks.param_error)
+        hooks.param_error();
 }
 
-/* Append bytes onto a growable buffer; returns 0 on success, -1 on OOM. */
-static int append_bytes(char **out, size_t *len, size_t *cap, const char *src, size_t n) {
-    if (!src || n == 0) return 0;
-    /* Guard against overflow: new_len = *len + n + 1 */
-    if (n > (size_t)-1 - *len - 1) return -1;
-    if (*len + n + 1 > *cap) {
-        size_t newcap = (*cap ? *cap : 64);
-        while (*len + n + 1 > newcap) {
-            if (newcap > (size_t)-1 / 2) { newcap = (size_t)-1; break; }
-            newcap *= 2;
+/* One $( ... ) being evaluated.  A body that only runs output builtins
+   is evaluated in the shell itself; anything else gets a forked child
+   (no exec) that runs the already lowered body with its stdout on a
+   pipe.  Several children can be running at once; see subst_drain(). */
+struct subst {
+    struct io_capture cap;
+    pid_t pid;          /* -1 if evaluated in the shell */
+    int fd;             /* read end of the capture pipe, -1 once drained */
+    size_t chunk;       /* most room made for one read(): a full pipe */
+    const char *out;    /* result, once finished */
+    size_t len;
+    int status;         /* exit status, once finished */
+    bool reaped;        /* waited for by expand_subst_reaped() */
+    struct subst *next_running;
+};
+
+/* Forked substitutions not yet finished, so the SIGCHLD handler can
+   tell them apart from jobs. */
+static struct subst *running;
+
+/* $? of the last substitution to finish, or -1; see expand_subst_status(). */
+static int subst_status = -1;
+
+bool expand_subst_reaped(pid_t pid, int status) {
+    for (struct subst *s = running; s; s = s->next_running) {
+        if (s->pid == pid && !s->reaped) {
+            s->status = status;
+            s->reaped = true;
+            return true;
         }
-        char *tmp = (char *)realloc(*out, newcap);
-        if (!tmp) return -1;
-        *out = tmp;
-        *cap = newcap;
     }
-    memcpy(*out + *len, src, n);
-    *len += n;
-    (*out)[*len] = '\0';
-    return 0;
+    return false;
 }
 
-static char *strip_outer_quotes_dup(const char *raw, char quote_ch) {
-    size_t L = strlen(raw);
-    if (L >= 2 && raw[0] == quote_ch && raw[L - 1] == quote_ch) {
-        size_t inner = L - 2;
-        char *out = (char *)malloc(inner + 1);
-        if (!out) return NULL;
-        memcpy(out, raw + 1, inner);
-        out[inner] = '\0';
-        return out;
-    } else {
-        char *dup = (char *)malloc(L + 1);
-        if (!dup) return NULL;
-        memcpy(dup, raw, L + 1);
-        return dup;
-    }
+int expand_subst_status(void) {
+    int st = subst_status;
+    subst_status = -1;
+    return st;
 }
 
-/* ========== Simple/brace expansions ========== */
-
-static char *expand_simple(TSNode simple_expansion, const char *input, int last_status, int *out_err) {
-    if (out_err) *out_err = EXPAND_OK;
-    /* Simple forms: "$$", "$?", "$VAR" */
-    char *txt = slice_text(input, simple_expansion);
-    if (!txt) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-
-    /* Short-circuit $$ and $? by text */
-    if (strcmp(txt, "$$") == 0) {
-        free(txt);
-        char buf[32];
-        snprintf(buf, sizeof buf, "%d", (int)getpid());
-        char *out = strdup(buf);
-        if (!out) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-        return out;
-    }
-    if (strcmp(txt, "$?") == 0) {
-        free(txt);
-        char buf[32];
-        snprintf(buf, sizeof buf, "%d", last_status);
-        char *out = strdup(buf);
-        if (!out) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-        return out;
-    }
-
-    /* Otherwise expect a variable_name child */
-    TSNode v = ts_node_named_child(simple_expansion, 0);
-    free(txt);
-    if (!ts_node_is_null(v) && ts_node_symbol(v) == sym_variable_name) {
-        char *vname = slice_text(input, v);
-        if (!vname) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-        const char *val = getenv(vname);
-        free(vname);
-        char *out = strdup(val ? val : "");
-        if (!out) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-        return out;
-    }
-
-    /* Fallback: return raw text */
-    char *raw = slice_text(input, simple_expansion);
-    if (!raw) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-    return raw;
-}
-
-static char *expand_brace(TSNode expansion, const char *input, int *out_err) {
-    if (out_err) *out_err = EXPAND_OK;
-    /* ${VAR} → first named child should be variable_name */
-    TSNode v = ts_node_named_child(expansion, 0);
-    if (!ts_node_is_null(v) && ts_node_symbol(v) == sym_variable_name) {
-        char *vname = slice_text(input, v);
-        if (!vname) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-        const char *val = getenv(vname);
-        free(vname);
-        char *out = strdup(val ? val : "");
-        if (!out) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-        return out;
-    }
-    /* Fallback: raw text */
-    char *raw = slice_text(input, expansion);
-    if (!raw) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-    return raw;
-}
-
-/* ========== Command substitution $( ... ) ========== */
-/* We execute the *text inside* $( ... ) via /bin/sh -c "<inner>" and capture stdout. */
-
-/* ========== Command substitution $( ... ) ========== */
-/* We execute the *text inside* $( ... ) via /bin/sh -c "<inner>" and capture stdout. */
-static char *capture_command_subst(TSNode sub, const char *input, int *out_err) {
-    if (out_err) *out_err = EXPAND_OK;
-
-    /* Extract raw node text and strip outer "$(" ... ")" */
-    char *raw = slice_text(input, sub);
-    if (!raw) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-
-    size_t L = strlen(raw);
-    char *inner = NULL;
-    if (L >= 3 && raw[0] == '$' && raw[1] == '(' && raw[L - 1] == ')') {
-        size_t in_len = L - 3;
-        inner = (char *)malloc(in_len + 1);
-        if (!inner) { free(raw); if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-        memcpy(inner, raw + 2, in_len); /* skip "$(" */
-        inner[in_len] = '\0';
-    } else {
-        /* Fallback: use raw as-is (probably still works) */
-        inner = raw; raw = NULL;
+static void subst_start(struct arena *a, const struct ir_node *body, struct subst *s, int *out_err) {
+    *s = (struct subst){ .cap = { .arena = a }, .pid = -1, .fd = -1 };
+
+    if (hooks.eval_inline) {
+        /* The body's commands take and reset marks in a while the
+           builtins write, so collect their output elsewhere first. */
+        struct arena scratch;
+        arena_init(&scratch);
+        struct io_capture tmp = { .arena = &scratch };
+        bool done = hooks.eval_inline(body, &tmp, &s->status);
+        if (done && tmp.len) {
+            memcpy(io_capture_reserve(&s->cap, tmp.len), tmp.buf, tmp.len);
+            s->cap.len = tmp.len;
+        }
+        arena_free(&scratch);
+        if (done) {
+            subst_status = s->status;
+            return;
+        }
     }
-    free(raw);
 
     int fds[2];
-    if (pipe(fds) != 0) {
+    if (pipe2(fds, O_CLOEXEC) != 0) {
         if (out_err) *out_err = EXPAND_SUBST_FAIL;
-        free(inner);
-        return empty_heap_string();
+        return;
     }
 
+    /* Unprivileged processes are limited by /proc/sys/fs/pipe-max-size;
+       if the request fails the pipe just keeps its size. */
+    int psz = fcntl(fds[0], F_SETPIPE_SZ, CAPTURE_PIPE_SIZE);
+    if (psz < 0)
+        psz = fcntl(fds[0], F_GETPIPE_SZ);
+    s->chunk = psz < 4096 ? 4096 : (size_t)psz;
+
+    io_flush();         /* or the child would write our buffered output again */
     pid_t pid = fork();
     if (pid < 0) {
         if (out_err) *out_err = EXPAND_SUBST_FAIL;
         close(fds[0]); close(fds[1]);
-        free(inner);
-        return empty_heap_string();
+        return;
     }
     if (pid == 0) {
         /* child: write to fds[1] */
-        close(fds[0]);
         dup2(fds[1], STDOUT_FILENO);
-        /* Optionally redirect stderr too? We'll leave it as-is. */
-        close(fds[1]);
-
-        /* exec /bin/sh -c "<inner>" */
-        execl("/bin/sh", "sh", "-c", inner, (char *)NULL);
-        _exit(127);
+        _exit(hooks.eval_subshell(body));
     }
 
     close(fds[1]);
-    free(inner);
-
-    /* parent: read all stdout */
-    char *buf = NULL;
-    size_t len = 0, cap = 0;
-    char tmp[4096];
-    ssize_t n;
-    while ((n = read(fds[0], tmp, sizeof tmp)) > 0) {
-        if (append_bytes(&buf, &len, &cap, tmp, (size_t)n) != 0) {
-            close(fds[0]);
-            (void)waitpid(pid, NULL, 0);
-            if (out_err) *out_err = EXPAND_OOM;
-            return empty_heap_string();
-        }
-    }
-    close(fds[0]);
-    (void)waitpid(pid, NULL, 0);
-
-    if (!buf) {
-        /* No output */
-        return empty_heap_string();
-    }
+    s->pid = pid;
+    s->fd = fds[0];
+    s->next_running = running;
+    running = s;
+    redir_cache_drop();     /* the child may remove or rename a cached file */
+}
 
-    /* Trim trailing newlines (bash behavior) */
-    while (len > 0 && buf[len - 1] == '\n') {
-        buf[--len] = '\0';
-    }
-    return buf;
+/* Read what the child has written, straight into the capture buffer.
+   Returns false at end of output. */
+static bool subst_read(struct subst *s) {
+    /* Start small, most substitutions print a line or two */
+    size_t want = s->cap.len < 4096 ? 4096 : s->cap.len;
+    char *dst = io_capture_reserve(&s->cap, want < s->chunk ? want : s->chunk);
+    ssize_t n = read(s->fd, dst, s->cap.cap - s->cap.len);
+    if (n < 0 && errno == EINTR)
+        return true;
+    if (n <= 0)
+        return false;
+    s->cap.len += (size_t)n;
+    return true;
 }
 
-/* ========== Render parts inside double quotes ========== */
+static void subst_close(struct subst *s) {
+    events_del(s->fd);
+    close(s->fd);
+    s->fd = -1;
+}
 
-static char *render_dq_string(TSNode s, const char *input, int last_status, int *out_err) {
-    if (out_err) *out_err = EXPAND_OK;
+static void subst_ready(int fd, uint32_t events, void *arg) {
+    struct subst *s = arg;
+    if (!subst_read(s))
+        subst_close(s);
+}
 
-    uint32_t m = ts_node_named_child_count(s);
+/* Drain the pipes of all running substitutions from the shell's event
+   loop, so that they take as long as the slowest of them. */
+static void subst_drain(struct subst *subs, size_t n) {
+    size_t active = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (subs[i].fd == -1)
+            continue;
+        if (events_add(subs[i].fd, EPOLLIN, subst_ready, &subs[i]) != 0) {
+            /* cannot wait for it next to the others: read it alone */
+            while (subst_read(&subs[i]))
+                continue;
+            close(subs[i].fd);
+            subs[i].fd = -1;
+            continue;
+        }
+        active++;
+    }
 
-    /* If no named children, strip outer quotes and preserve interior */
-    if (m == 0) {
-        char *raw = slice_text(input, s);
-        if (!raw) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-        char *out = strip_outer_quotes_dup(raw, '"');
-        free(raw);
-        if (!out) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-        return out;
+    while (active > 0) {
+        events_wait(-1);
+        active = 0;
+        for (size_t i = 0; i < n; i++)
+            active += subs[i].fd != -1;
     }
+}
 
-    char *out = NULL;
-    size_t len = 0, cap = 0;
-
-    for (uint32_t j = 0; j < m; j++) {
-        TSNode part = ts_node_named_child(s, j);
-        int sym = ts_node_symbol(part);
-        if (sym == sym_string_content) {
-            char *seg = slice_text(input, part);
-            if (!seg) { if (out_err) *out_err = EXPAND_OOM; free(out); return empty_heap_string(); }
-            if (append_bytes(&out, &len, &cap, seg, strlen(seg)) != 0) {
-                if (out_err) *out_err = EXPAND_OOM;
-                free(seg); free(out);
-                return empty_heap_string();
-            }
-            free(seg);
-        } else if (sym == sym_expansion) { /* ${VAR} */
-            int e = EXPAND_OK;
-            char *v = expand_brace(part, input, &e);
-            if (!v) { if (out_err) *out_err = EXPAND_OOM; free(out); return empty_heap_string(); }
-            if (append_bytes(&out, &len, &cap, v, strlen(v)) != 0) {
-                if (out_err) *out_err = EXPAND_OOM;
-                free(v); free(out);
-                return empty_heap_string();
-            }
-            free(v);
-        } else if (sym == sym_simple_expansion) { /* $VAR, $?, $$ */
-            int e = EXPAND_OK;
-            char *v = expand_simple(part, input, last_status, &e);
-            if (!v) { if (out_err) *out_err = EXPAND_OOM; free(out); return empty_heap_string(); }
-            if (append_bytes(&out, &len, &cap, v, strlen(v)) != 0) {
-                if (out_err) *out_err = EXPAND_OOM;
-                free(v); free(out);
-                return empty_heap_string();
-            }
-            free(v);
-        } else if (sym == sym_command_substitution) { /* $(...) */
-            int e = EXPAND_OK;
-            char *v = capture_command_subst(part, input, &e);
-            if (!v) { if (out_err) *out_err = EXPAND_OOM; free(out); return empty_heap_string(); }
-            if (append_bytes(&out, &len, &cap, v, strlen(v)) != 0) {
-                if (out_err) *out_err = EXPAND_OOM;
-                free(v); free(out);
-                return empty_heap_string();
-            }
-            free(v);
-            if (e != EXPAND_OK && out_err) *out_err = e; /* propagate non-fatal info */
-        } else {
-            /* Unknown part inside quotes → include raw text literally */
-            char *raw = slice_text(input, part);
-            if (!raw) { if (out_err) *out_err = EXPAND_OOM; free(out); return empty_heap_string(); }
-            if (append_bytes(&out, &len, &cap, raw, strlen(raw)) != 0) {
-                if (out_err) *out_err = EXPAND_OOM;
-                free(raw); free(out);
-                return empty_heap_string();
+/* Reap the child and set s->out/len and s->status. */
+static void subst_finish(struct subst *s) {
+    if (s->pid > 0) {
+        int st = 0;
+        if (s->reaped)
+            st = s->status;
+        else
+            while (waitpid(s->pid, &st, 0) < 0 && errno == EINTR)
+                continue;
+        for (struct subst **pp = &running; *pp; pp = &(*pp)->next_running) {
+            if (*pp == s) {
+                *pp = s->next_running;
+                break;
             }
-            free(raw);
         }
+        s->status = WIFEXITED(st) ? WEXITSTATUS(st) : WIFSIGNALED(st) ? 128 + WTERMSIG(st) : 1;
+        subst_status = s->status;
     }
 
-    if (!out) return empty_heap_string();
-    return out;
+    struct io_capture *cap = &s->cap;
+    if (!cap->buf) {
+        s->out = "";
+        s->len = 0;
+        return;
+    }
+    /* Trim trailing newlines (bash behavior) by shortening the length;
+       the buffer is NUL-terminated in place, never copied */
+    while (cap->len > 0 && cap->buf[cap->len - 1] == '\n')
+        cap->len--;
+    *io_capture_reserve(cap, 1) = '\0';
+    s->out = cap->buf;
+    s->len = cap->len;
 }
 
-/* ========== Top-level single-arg expansion ========== */
+/* ========== Words ========== */
 
-char *expand_one_arg(TSNode node, const char *input, int last_status, int *out_err) {
-    if (out_err) *out_err = EXPAND_OK;
-
-    int sym = ts_node_symbol(node);
-    switch (sym) {
-        case sym_word: {
-            char *raw = slice_text(input, node);
-            if (!raw) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-            return raw;
-        }
-        case sym_raw_string: {
-            char *raw = slice_text(input, node);
-            if (!raw) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-            char *stripped = strip_outer_quotes_dup(raw, '\'');
-            free(raw);
-            if (!stripped) { if (out_err) *out_err = EXPAND_OOM; return empty_heap_string(); }
-            return stripped;
-        }
-        case sym_string:
-            return render_dq_string(node, input, last_status, out_err);
-        case sym_simple_expansion:
-            return expand_simple(node, input, last_status, out_err);
-        case sym_expansion:
-            return expand_brace(node, input, out_err);
-        case sym_command_substitution:
-            return capture_command_subst(node, input, out_err);
-        default: {
-            /* Unsupported → empty */
-            char *s = empty_heap_string();
-            if (!s && out_err) *out_err = EXPAND_OOM;
-            return s ? s : strdup(""); /* last-ditch */
-        }
-    }
+static bool part_has_effects(const struct ir_part *part) {
+    if (part->kind == IR_PART_ARITH)
+        return true;
+    return part->kind == IR_PART_PARAM_OP &&
+           (part->param->op == IR_PARAM_ASSIGN || part->param->op == IR_PARAM_ERROR ||
+            part->param->offset ||
+            expand_has_effects(&part->param->word) || expand_has_effects(&part->param->repl));
 }
 
-/* =========================
- * ARGV builder
- * ========================= */
-static int node_is_argumenty(TSNode n) {
-    int sym = ts_node_symbol(n);
-    return (sym == sym_word ||
-            sym == sym_raw_string ||
-            sym == sym_string ||
-            sym == sym_simple_expansion ||
-            sym == sym_expansion ||
-            sym == sym_command_substitution);
+bool expand_has_effects(const struct ir_word *w) {
+    for (uint32_t i = 0; !w->lit && i < w->nparts; i++)
+        if (part_has_effects(&w->parts[i]))
+            return true;
+    return false;
 }
 
-static int node_is_skip(TSNode n) {
-    int sym = ts_node_symbol(n);
-    return (sym == sym_file_redirect ||
-            sym == sym_variable_assignment);
+/* The $( ... ) parts of the words being expanded, in order.  Those in
+   [next, end) were run together by expand_words(); any after them run
+   one at a time when expand_one() gets to them. */
+struct substs {
+    struct subst *next, *end;
+};
+
+static const struct subst *subst_take(struct arena *a, struct substs *ss,
+                                      const struct ir_node *body, int *out_err) {
+    if (ss->next < ss->end)
+        return ss->next++;
+    struct subst *s = arena_alloc(a, sizeof *s);
+    subst_start(a, body, s, out_err);
+    subst_drain(s, 1);
+    subst_finish(s);
+    return s;
 }
 
-/* Prefer explicit command_name child if present; otherwise find first "argumenty" child. */
-/* Prefer explicit command_name child if present; otherwise find first "argumenty" child. */
-static TSNode find_program_name_node(TSNode command_node) {
-    uint32_t n = ts_node_named_child_count(command_node);
-
-    /* 1) Look inside 'command_name' for an argument-like token (word/string/expansion/etc.) */
-    for (uint32_t i = 0; i < n; i++) {
-        TSNode ch = ts_node_named_child(command_node, i);
-        if (ts_node_symbol(ch) == sym_command_name) {
-            uint32_t m = ts_node_named_child_count(ch);
-            for (uint32_t j = 0; j < m; j++) {
-                TSNode inner = ts_node_named_child(ch, j);
-                if (node_is_argumenty(inner))
-                    return inner;  /* good: actual token node */
+/* Expand one word, taking the results of its $( ... ) parts from ss. */
+static char *expand_one(struct arena *a, const struct ir_word *w, int last_status,
+                        struct substs *ss, int *out_err) {
+    /* Nothing to expand: hand out the IR's own text. */
+    if (w->lit)
+        return (char *)w->lit;
+
+    /* A lone $(...) is its own result. */
+    if (w->nparts == 1 && w->parts[0].kind == IR_PART_CMDSUB)
+        return (char *)subst_take(a, ss, w->parts[0].body, out_err)->out;
+
+    /* First resolve every part to a byte range, then concatenate once. */
+    struct piece { const char *s; size_t len; } *pieces =
+        arena_alloc(a, w->nparts * sizeof *pieces);
+    size_t total = 0;
+
+    for (uint32_t i = 0; i < w->nparts; i++) {
+        const struct ir_part *part = &w->parts[i];
+        struct piece *pc = &pieces[i];
+        char num[32];
+        long long val;
+
+        switch (part->kind) {
+            case IR_PART_LIT:
+                pc->s = part->text;
+                pc->len = part->len;
+                break;
+            case IR_PART_PARAM:
+                pc->s = vars_get(part->text);
+                if (!pc->s) pc->s = "";
+                pc->len = strlen(pc->s);
+                break;
+            case IR_PART_PARAM_OP:
+                pc->s = param_expand(a, part->text, part->param, last_status, &pc->len, out_err);
+                break;
+            case IR_PART_STATUS:
+            case IR_PART_PID:
+                pc->len = (size_t)snprintf(num, sizeof num, "%d",
+                              part->kind == IR_PART_STATUS ? last_status : (int)getpid());
+                pc->s = arena_strndup(a, num, pc->len);
+                break;
+            case IR_PART_ARITH:
+                if (arith_eval(part->arith, last_status, &val) != 0) {
+                    if (out_err) *out_err = EXPAND_ARITH_FAIL;
+                    val = 0;
+                }
+                pc->len = (size_t)snprintf(num, sizeof num, "%lld", val);
+                pc->s = arena_strndup(a, num, pc->len);
+                break;
+            case IR_PART_CMDSUB: {
+                const struct subst *sub = subst_take(a, ss, part->body, out_err);
+                pc->s = sub->out;
+                pc->len = sub->len;
+                break;
             }
-            /* No usable token inside command_name → fall through to step 2. */
-            break;
+            default:
+                pc->s = "";
+                pc->len = 0;
+                break;
         }
+        total += pc->len;
     }
 
-    /* 2) Fallback: first argument-like child at the command level (skip redirects/assignments/command_name) */
-    for (uint32_t i = 0; i < n; i++) {
-        TSNode ch = ts_node_named_child(command_node, i);
-        if (ts_node_symbol(ch) == sym_command_name) continue;
-        if (!node_is_skip(ch) && node_is_argumenty(ch))
-            return ch;
+    char *out = arena_alloc(a, total + 1);
+    char *p = out;
+    for (uint32_t i = 0; i < w->nparts; i++) {
+        memcpy(p, pieces[i].s, pieces[i].len);
+        p += pieces[i].len;
     }
-
-    /* 3) Nothing suitable */
-    TSNode null_node = (TSNode){0};
-    return null_node;
+    *p = '\0';
+    return out;
 }
 
-
-char **expand_to_argv(TSNode command_node,
-                      const char *input,
-                      int last_status,
-                      int *out_argc,
-                      int *out_err) {
-    if (out_err) *out_err = EXPAND_OK;
-    if (out_argc) *out_argc = 0;
-
-    if (ts_node_symbol(command_node) != sym_command) {
-        /* Not a command node: signal failure (choose your policy; keeping OOM here is fine for now). */
-        if (out_err) *out_err = EXPAND_OOM;
-        return NULL;
+/* Expand words into out[].  The $( ... ) in them are started first and
+   drained together, then the words are assembled in order; but only those
+   that come before anything that may assign a variable ($((i++)),
+   ${v:=x}), since a later one may depend on it. */
+static void expand_words(struct arena *a, const struct ir_word *words, uint32_t nwords,
+                         int last_status, char **out, int *out_err) {
+    size_t nsubs = 0;
+    bool effects = false;
+    for (uint32_t i = 0; i < nwords && !effects; i++) {
+        for (uint32_t j = 0; !words[i].lit && j < words[i].nparts && !effects; j++) {
+            const struct ir_part *part = &words[i].parts[j];
+            if (part->kind == IR_PART_CMDSUB)
+                nsubs++;
+            else
+                effects = part_has_effects(part);
+        }
     }
 
-    TSNode prog_node = find_program_name_node(command_node);
-    if (ts_node_is_null(prog_node)) {
-        if (out_err) *out_err = EXPAND_OOM;
-        return NULL;
+    struct substs ss = { NULL, NULL };
+    if (nsubs > 0) {
+        struct subst *subs = arena_alloc(a, nsubs * sizeof *subs);
+        size_t k = 0;
+        for (uint32_t i = 0; i < nwords && k < nsubs; i++)
+            for (uint32_t j = 0; !words[i].lit && j < words[i].nparts && k < nsubs; j++)
+                if (words[i].parts[j].kind == IR_PART_CMDSUB)
+                    subst_start(a, words[i].parts[j].body, &subs[k++], out_err);
+        subst_drain(subs, nsubs);
+        for (k = 0; k < nsubs; k++)
+            subst_finish(&subs[k]);
+        ss = (struct substs){ subs, subs + nsubs };
     }
 
-    /* Count argv entries: argv[0] for program + each argument-like child (excluding command_name container). */
-    uint32_t n = ts_node_named_child_count(command_node);
-    int argc = 1; /* program */
-    for (uint32_t i = 0; i < n; i++) {
-        TSNode ch = ts_node_named_child(command_node, i);
-        if (ts_node_symbol(ch) == sym_command_name) continue; /* skip container entirely */
-        if (node_is_skip(ch)) continue;
-        if (node_is_argumenty(ch)) argc++;
-    }
+    for (uint32_t i = 0; i < nwords; i++)
+        out[i] = expand_one(a, &words[i], last_status, &ss, out_err);
+}
 
-    char **argv = (char **)calloc((size_t)argc + 1, sizeof *argv);
-    if (!argv) { if (out_err) *out_err = EXPAND_OOM; return NULL; }
+char *expand_word(struct arena *a, const struct ir_word *w, int last_status, int *out_err) {
+    if (out_err) *out_err = EXPAND_OK;
+    char *out;
+    expand_words(a, w, 1, last_status, &out, out_err);
+    return out;
+}
 
-    int idx = 0;
+/* =========================
+ * ARGV builder
+ * ========================= */
 
-    /* argv[0] = expanded program name */
-    int e0 = EXPAND_OK;
-    argv[idx] = expand_one_arg(prog_node, input, last_status, &e0);
-    if (!argv[idx]) {
-        if (out_err) *out_err = EXPAND_OOM;
-        free(argv);
-        return NULL;
-    }
-    idx++;
-
-    /* remaining args (skip command_name container; do NOT try to compare node equality with prog_node’s parent) */
-    for (uint32_t i = 0; i < n; i++) {
-        TSNode ch = ts_node_named_child(command_node, i);
-        if (ts_node_symbol(ch) == sym_command_name) continue; /* skip container */
-        if (node_is_skip(ch)) continue;
-        if (!node_is_argumenty(ch)) continue;
-
-        int e = EXPAND_OK;
-        char *arg = expand_one_arg(ch, input, last_status, &e);
-        if (!arg) {
-            if (out_err) *out_err = EXPAND_OOM;
-            /* free partial argv */
-            for (int k = 0; k < idx; k++) free(argv[k]);
-            free(argv);
-            return NULL;
-        }
-        argv[idx++] = arg;
-        if (e != EXPAND_OK && out_err) *out_err = e; /* propagate non-fatal info */
-    }
+char **expand_argv(struct arena *a,
+                   const struct ir_word *words,
+                   uint32_t nwords,
+                   int last_status,
+                   int *out_argc,
+                   int *out_err) {
+    if (out_err) *out_err = EXPAND_OK;
 
-    argv[idx] = NULL;
-    if (out_argc) *out_argc = idx;
+    char **argv = arena_alloc(a, ((size_t)nwords + 1) * sizeof *argv);
+    expand_words(a, words, nwords, last_status, argv, out_err);
+    argv[nwords] = NULL;
+    if (out_argc) *out_argc = (int)nwords;
     return argv;
 }
-
-void free_argv(char **argv) {
-    if (!argv) return;
-    for (int i = 0; argv[i]; i++) free(argv[i]);
-    free(argv);
-}
-
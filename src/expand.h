@@ -1,34 +1,78 @@
 #pragma once
-#include <tree_sitter/api.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "arena.h"
+#include "builtins.h"
+#include "ir.h"
+
+/*
+ * Word expansion.
+ *
+ * Results are allocated from the arena the caller passes in, normally
+ * the arena of the command being evaluated, and are released with it by
+ * one arena_reset(); nothing here needs to be freed individually.  Words
+ * that need no expansion are returned as zero-copy views of the IR text,
+ * so callers must treat the strings as read-only.
+ */
+
+/* How $( ... ) bodies are evaluated; supplied by the interpreter. */
+struct expand_hooks {
+    /* Evaluate body in the shell itself with its stdout appended to cap
+       and its exit status in *status.  Returns false, without running
+       anything, if body needs a subshell. */
+    bool (*eval_inline)(const struct ir_node *body, struct io_capture *cap, int *status);
+    /* Evaluate body in a forked child whose stdout is the capture pipe.
+       Returns the status for the child to exit with. */
+    int (*eval_subshell)(const struct ir_node *body);
+    /* A ${name:?} error has been reported.  May leave the shell; if it
+       returns, the expansion fails with EXPAND_PARAM_FAIL. */
+    void (*param_error)(void);
+};
+
+void expand_set_hooks(const struct expand_hooks *hooks);
+
+/* For param_expand: run the param_error hook, if any. */
+void expand_param_error(void);
+
+/* For the SIGCHLD handler: if pid is a forked $( ... ) still being
+   read, keep its wait status for it and return true. */
+bool expand_subst_reaped(pid_t pid, int status);
+
+/* The exit status of the last $( ... ) finished since the previous
+   call, or -1 if there was none.  This is $? after a command that only
+   assigns variables. */
+int expand_subst_status(void);
 
 /* Non-fatal expansion diagnostics. */
 typedef enum {
   EXPAND_OK = 0,
-  EXPAND_OOM,
-  EXPAND_SUBST_FAIL
+  EXPAND_SUBST_FAIL,
+  EXPAND_ARITH_FAIL,
+  EXPAND_PARAM_FAIL
 } ExpandErr;
 
-/* Expand a single argument-like node to a malloc'ed C string.
-   Supports: word, raw_string ('...'), string ("..." with mixed parts),
-             simple_expansion ($VAR, $?, $$), expansion (${VAR}),
-             command_substitution ($( ... )).
-   - Never returns NULL in normal operation; on internal OOM, attempts to return an empty heap string ("").
-   - Caller must free the returned pointer.
-   - If out_err != NULL, sets it to EXPAND_OK, EXPAND_OOM, or EXPAND_SUBST_FAIL
-     (EXPAND_SUBST_FAIL is used only when spawning/pipe for $(...) fails). */
-char *expand_one_arg(TSNode node, const char *input, int last_status, int *out_err);
-
-/* Expand a full command node to a NULL-terminated argv array.
-   - On success, returns argv and sets *out_argc to argc (if provided).
-     Caller must free with free_argv().
-   - Includes empty-string arguments when expansions yield "".
-   - On hard failure (e.g., OOM while building argv), returns NULL and sets *out_err=EXPAND_OOM (if provided). */
-char **expand_to_argv(TSNode command_node,
-                      const char *input,
-                      int last_status,
-                      int *out_argc,
-                      int *out_err);
-
-/* Free a NULL-terminated argv previously returned by expand_to_argv().
-   Safe to call with NULL. */
-void free_argv(char **argv);
+/* Expand a single IR word to a C string.
+   Supports literal text (quotes already removed during lowering),
+   $VAR and ${VAR} with the operators of param.h, $?, $$, command
+   substitution $( ... ) and arithmetic $(( ... )).
+   - Never returns NULL.
+   - If out_err != NULL, sets it to EXPAND_OK, EXPAND_SUBST_FAIL (when
+     fork/pipe for $(...) fails) or EXPAND_ARITH_FAIL (an arithmetic
+     error was reported; the expansion is "0") or EXPAND_PARAM_FAIL
+     (${v:?} or a bad substring was reported). */
+char *expand_word(struct arena *a, const struct ir_word *word, int last_status, int *out_err);
+
+/* Could expanding w assign a variable or leave the shell?  True if it
+   has $(( )) or a ${name<op>...} with :=, :? or arithmetic in it. */
+bool expand_has_effects(const struct ir_word *w);
+
+/* Expand the words of a command to a NULL-terminated argv array.
+   - Returns argv and sets *out_argc to argc (if provided).
+   - Includes empty-string arguments when expansions yield "". */
+char **expand_argv(struct arena *a,
+                   const struct ir_word *words,
+                   uint32_t nwords,
+                   int last_status,
+                   int *out_argc,
+                   int *out_err);
@@ -14,6 +14,7 @@ typedef struct entry {
     tommy_node node;
     char *key;
     char *val;
+    unsigned hits;      /* lookups served since the value was last set */
 } entry;
 
 /* helpers ---------------------------------------------------------------- */
@@ -51,6 +52,7 @@ hash_put(tommy_hashdyn* ht, const char* k, const char* v)
         char* nv = strdup(v);
         free(old->val);
         old->val = nv;
+        old->hits = 0;
         return;
     }
 
@@ -58,6 +60,7 @@ hash_put(tommy_hashdyn* ht, const char* k, const char* v)
     entry* e = malloc(sizeof *e);
     e->key = strdup(k);
     e->val = strdup(v);
+    e->hits = 0;
     tommy_hashdyn_insert(ht, &e->node, e, h);
 }
 
@@ -75,6 +78,19 @@ hash_get(tommy_hashdyn *ht, const char *k)
     return e ? e->val : NULL;
 }
 
+/**
+ * @brief Retrieves the entry associated with a key.
+ * 
+ * @param ht The hash table.
+ * @param k The key.
+ * @return The entry for the key, or NULL if the key is not found.
+ */
+static entry *
+hash_find(tommy_hashdyn *ht, const char *k)
+{
+    return tommy_hashdyn_search(ht, str_cmp, k, str_hash(k));
+}
+
 /**
  * @brief Deletes a key-value pair from the hash table.
  * 
@@ -105,4 +121,17 @@ hash_free(void *_e)
     free(e->val);
     free(e);
 }
+
+/**
+ * @brief Removes and frees all entries, leaving an empty table.
+ * 
+ * @param ht The hash table.
+ */
+static void
+hash_clear(tommy_hashdyn *ht)
+{
+    tommy_hashdyn_foreach(ht, hash_free);
+    tommy_hashdyn_done(ht);
+    tommy_hashdyn_init(ht);
+}
 #endif /* TOMMY_HELPERS_H */
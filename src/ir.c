@@ -0,0 +1,1368 @@
+// ir.c
+// Lowering of the tree-sitter CST into the IR described in ir.h.
+//
+// The whole tree is walked once with a single TSTreeCursor, so each node
+// is visited in O(1) instead of being located with ts_node_named_child().
+// Children are first collected in a scratch vector and then copied into
+// the arena as one contiguous array.
+
+#include "ir.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arith.h"
+#include "cond.h"
+#include "tree_sitter/tree-sitter-bash.h"
+#include "ts_symbols.h"
+#include "utils.h"
+
+static TSFieldId nameId, valueId, variableId, bodyId;
+static TSFieldId descriptorId, destinationId, operatorId, rightId;
+
+struct lower {
+    struct arena *arena;
+    const char *src;
+    uint32_t line_base;     /* added to tree-sitter's 0-based rows */
+    TSTreeCursor cur;
+};
+
+/* ---------------- cursor helpers ---------------- */
+
+static TSNode
+here(struct lower *L)
+{
+    return ts_tree_cursor_current_node(&L->cur);
+}
+
+static TSFieldId
+here_field(struct lower *L)
+{
+    return ts_tree_cursor_current_field_id(&L->cur);
+}
+
+/* Move to the first child.  Use as: if (down(L)) do { ... } while (next(L)); */
+static bool
+down(struct lower *L)
+{
+    return ts_tree_cursor_goto_first_child(&L->cur);
+}
+
+/* Move to the next sibling, or back up to the parent after the last one. */
+static bool
+next(struct lower *L)
+{
+    if (ts_tree_cursor_goto_next_sibling(&L->cur))
+        return true;
+    ts_tree_cursor_goto_parent(&L->cur);
+    return false;
+}
+
+static const char *
+node_src(struct lower *L, TSNode n, uint32_t *len)
+{
+    *len = ts_node_end_byte(n) - ts_node_start_byte(n);
+    return L->src + ts_node_start_byte(n);
+}
+
+static const char *
+node_text(struct lower *L, TSNode n)
+{
+    uint32_t len;
+    const char *s = node_src(L, n, &len);
+    return arena_strndup(L->arena, s, len);
+}
+
+/* ---------------- scratch vectors ---------------- */
+
+struct vec {
+    char *data;
+    uint32_t n, cap;
+};
+
+/* Append a zeroed element of size elsz and return it.  The pointer is
+   only valid until the next push onto the same vector. */
+static void *
+vec_push(struct vec *v, size_t elsz)
+{
+    if (v->n == v->cap) {
+        v->cap = v->cap ? 2 * v->cap : 8;
+        v->data = realloc(v->data, v->cap * elsz);
+        if (!v->data)
+            utils_fatal_error("ir: out of memory");
+    }
+    void *el = v->data + v->n++ * elsz;
+    memset(el, 0, elsz);
+    return el;
+}
+
+static void *
+vec_last(struct vec *v, size_t elsz)
+{
+    return v->n ? v->data + (v->n - 1) * elsz : NULL;
+}
+
+/* Move the elements into the arena and release the scratch buffer. */
+static void *
+vec_finish(struct lower *L, struct vec *v, size_t elsz, uint32_t *count)
+{
+    *count = v->n;
+    void *out = v->n ? arena_memdup(L->arena, v->data, v->n * elsz) : NULL;
+    free(v->data);
+    *v = (struct vec){ 0 };
+    return out;
+}
+
+/* ---------------- words ---------------- */
+
+static void
+push_part(struct vec *parts, int kind, const char *text, uint32_t len)
+{
+    struct ir_part *p = vec_push(parts, sizeof *p);
+    p->kind = kind;
+    p->text = text;
+    p->len = len;
+}
+
+/* Append literal bytes, dropping backslashes as the quoting context says:
+   unquoted, a backslash escapes any character; inside "...", only $ ` " \
+   and newline. */
+static void
+push_literal(struct lower *L, struct vec *parts, const char *s, uint32_t len,
+             bool unquoted, bool dquoted)
+{
+    char *buf = arena_alloc(L->arena, len + 1);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (s[i] == '\\' && i + 1 < len) {
+            char c = s[i + 1];
+            if (unquoted || (dquoted && strchr("$`\"\\\n", c))) {
+                i++;
+                if (c != '\n')
+                    buf[n++] = c;
+                continue;
+            }
+        }
+        buf[n++] = s[i];
+    }
+    buf[n] = '\0';
+    push_part(parts, IR_PART_LIT, buf, n);
+}
+
+static void lower_word_parts(struct lower *L, struct vec *parts);
+static void lower_expansion(struct lower *L, struct vec *parts);
+static void finish_word(struct lower *L, struct vec *parts, struct ir_word *w);
+static void literal_word(struct lower *L, struct ir_word *w, const char *text);
+static void lower_sequence(struct lower *L, struct ir_node *out);
+
+/* $name, $?, $$, $! */
+static void
+lower_simple_expansion(struct lower *L, struct vec *parts)
+{
+    uint32_t len;
+    const char *s = node_src(L, here(L), &len);
+    if (len == 2 && s[1] == '?') { push_part(parts, IR_PART_STATUS, "?", 1); return; }
+    if (len == 2 && s[1] == '$') { push_part(parts, IR_PART_PID, "$", 1); return; }
+    if (len == 2 && s[1] == '!') { push_part(parts, IR_PART_PARAM, "!", 1); return; }
+
+    TSNode var = ts_node_named_child(here(L), 0);
+    if (!ts_node_is_null(var) && ts_node_symbol(var) == sym_variable_name) {
+        uint32_t vlen;
+        const char *v = node_src(L, var, &vlen);
+        push_part(parts, IR_PART_PARAM, arena_strndup(L->arena, v, vlen), vlen);
+        return;
+    }
+    push_part(parts, IR_PART_LIT, arena_strndup(L->arena, s, len), len);
+}
+
+static int
+param_op(const char *tok, bool *colon)
+{
+    static const struct { const char *tok; int op; } ops[] = {
+        { "-",  IR_PARAM_DEFAULT },         { "=",  IR_PARAM_ASSIGN },
+        { "?",  IR_PARAM_ERROR },           { "+",  IR_PARAM_ALTERNATE },
+        { ":",  IR_PARAM_SUBSTR },
+        { "#",  IR_PARAM_TRIM_PREFIX },     { "##", IR_PARAM_TRIM_PREFIX_LONG },
+        { "%",  IR_PARAM_TRIM_SUFFIX },     { "%%", IR_PARAM_TRIM_SUFFIX_LONG },
+        { "/",  IR_PARAM_REPLACE },         { "//", IR_PARAM_REPLACE_ALL },
+        { "/#", IR_PARAM_REPLACE_PREFIX },  { "/%", IR_PARAM_REPLACE_SUFFIX },
+        { "^^", IR_PARAM_UPPER },           { "^",  IR_PARAM_UPPER_FIRST },
+        { ",,", IR_PARAM_LOWER },           { ",",  IR_PARAM_LOWER_FIRST },
+    };
+    *colon = tok[0] == ':' && tok[1] != '\0';
+    if (*colon)
+        tok++;
+    for (size_t i = 0; i < sizeof ops / sizeof ops[0]; i++)
+        if (strcmp(tok, ops[i].tok) == 0)
+            return ops[i].op;
+    return -1;
+}
+
+/* Index of the first sep in s[0..len) that is not quoted, escaped or
+   inside a nested ${...}, or len. */
+static uint32_t
+param_split(const char *s, uint32_t len, char sep)
+{
+    bool sq = false, dq = false;
+    int depth = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (c == '\\' && !sq)
+            i++;
+        else if (c == '\'' && !dq)
+            sq = !sq;
+        else if (c == '"' && !sq)
+            dq = !dq;
+        else if (!sq && c == '$' && i + 1 < len && s[i + 1] == '{')
+            depth++, i++;
+        else if (!sq && depth > 0 && c == '}')
+            depth--;
+        else if (!sq && !dq && depth == 0 && c == sep)
+            return i;
+    }
+    return len;
+}
+
+/* What a quoted character in lower_pattern_text() must be escaped for. */
+enum quote_as {
+    QUOTE_TEXT,         /* nothing: not a pattern */
+    QUOTE_GLOB,         /* fnmatch() */
+    QUOTE_REGEX,        /* regcomp(), extended */
+};
+
+static const char *const quote_chars[] = {
+    [QUOTE_TEXT]  = "",
+    [QUOTE_GLOB]  = "*?[]\\",
+    [QUOTE_REGEX] = ".[]()*+?{}|^$\\",
+};
+
+static const struct ir_param quote_param[] = {
+    [QUOTE_GLOB]  = { .op = IR_PARAM_QUOTE },
+    [QUOTE_REGEX] = { .op = IR_PARAM_QUOTE_REGEX },
+};
+
+/* The expansion or substitution node under the cursor's node that starts
+   at byte b (or at the blanks the scanner puts before it), or a null
+   node. */
+static TSNode
+expansion_at(struct lower *L, uint32_t b)
+{
+    uint32_t lo = b;
+    while (lo > 0 && (L->src[lo - 1] == ' ' || L->src[lo - 1] == '\t'))
+        lo--;
+    TSNode x = ts_node_descendant_for_byte_range(here(L), b, b + 1);
+    while (!ts_node_is_null(x) && ts_node_start_byte(x) >= lo) {
+        switch (ts_node_symbol(x)) {
+        case sym_simple_expansion:
+        case sym_expansion:
+        case sym_command_substitution:
+        case sym_arithmetic_expansion:
+            return x;
+        }
+        x = ts_node_parent(x);
+    }
+    return (TSNode){ 0 };
+}
+
+/* A pattern, a replacement of ${name op ...} or an operand of [[ ]] that
+   is matched against, from its source text: the grammar does not split
+   these reliably (${v//\//_}), and the nodes it makes do not say what was
+   quoted.  Quotes and backslashes are removed and $name and ${name}
+   expanded; other expansions are lowered from their nodes.  With quote
+   set, a character that was quoted, or that comes from a quoted "$name",
+   keeps a backslash so it matches itself. */
+static void
+lower_pattern_text(struct lower *L, const char *s, uint32_t len, enum quote_as quote,
+                   struct ir_word *w)
+{
+    struct vec parts = { 0 };
+    char *buf = arena_alloc(L->arena, 2 * len + 1);
+    uint32_t n = 0, run = 0, from = (uint32_t)(s - L->src);
+    bool dq = false;
+
+#define PUT(ch, quoted) do {                                        \
+        if ((quoted) && strchr(quote_chars[quote], (ch)))           \
+            buf[n++] = '\\';                                        \
+        buf[n++] = (ch);                                            \
+    } while (0)
+#define FLUSH() do {                                                \
+        if (n > run)                                                \
+            push_part(&parts, IR_PART_LIT,                          \
+                      arena_strndup(L->arena, buf + run, n - run), n - run); \
+        run = n;                                                    \
+    } while (0)
+
+    for (uint32_t i = 0; i < len; ) {
+        char c = s[i];
+        if (c == '"') {
+            dq = !dq;
+            i++;
+        } else if (c == '\'' && !dq) {
+            for (i++; i < len && s[i] != '\''; i++)
+                PUT(s[i], true);
+            i++;
+        } else if (c == '\\' && i + 1 < len && (!dq || strchr("$`\"\\", s[i + 1]))) {
+            PUT(s[i + 1], true);
+            i += 2;
+        } else if (c == '$' || c == '`') {
+            /* $name and ${name} */
+            uint32_t start = i + 1, end = start;
+            bool braced = start < len && s[start] == '{';
+            start += braced;
+            end = start;
+            while (c == '$' && end < len && (s[end] == '_' || isalnum((unsigned char)s[end])))
+                end++;
+            if (end > start && !isdigit((unsigned char)s[start]) &&
+                (!braced || (end < len && s[end] == '}'))) {
+                FLUSH();
+                bool q = quote != QUOTE_TEXT && dq;
+                push_part(&parts, q ? IR_PART_PARAM_OP : IR_PART_PARAM,
+                          arena_strndup(L->arena, s + start, end - start), end - start);
+                if (q)
+                    ((struct ir_part *)vec_last(&parts, sizeof(struct ir_part)))->param =
+                        &quote_param[quote];
+                i = end + braced;
+                continue;
+            }
+            /* anything else: lower the grammar's node for it */
+            TSNode sub = expansion_at(L, from + i);
+            if (ts_node_is_null(sub) || ts_node_end_byte(sub) > from + len) {
+                PUT(c, dq);
+                i++;
+                continue;
+            }
+            FLUSH();
+            TSTreeCursor outer = L->cur;
+            L->cur = ts_tree_cursor_new(sub);
+            lower_word_parts(L, &parts);
+            ts_tree_cursor_delete(&L->cur);
+            L->cur = outer;
+            i = ts_node_end_byte(sub) - from;
+        } else {
+            PUT(c, dq);
+            i++;
+        }
+    }
+    FLUSH();
+#undef FLUSH
+#undef PUT
+    finish_word(L, &parts, w);
+}
+
+/* ${name} and ${name<op>...}.  Special parameters in braces are kept as
+   literal text. */
+static void
+lower_expansion(struct lower *L, struct vec *parts)
+{
+    TSNode n = here(L);
+    uint32_t len;
+    const char *s = node_src(L, n, &len);
+    uint32_t start = ts_node_start_byte(n), arg = 0;
+    while (len > 0 && (*s == ' ' || *s == '\t'))
+        s++, len--, start++;
+    const char *name = NULL;
+    bool length = false;
+    int op = -1;
+    struct ir_param *p = arena_zalloc(L->arena, sizeof *p);
+    struct vec word = { 0 };
+
+    if (down(L)) {
+        do {
+            TSNode ch = here(L);
+            if (ts_node_symbol(ch) == sym_variable_name && !name) {
+                name = node_text(L, ch);
+            } else if (!ts_node_is_named(ch) && !name) {
+                length |= strcmp(ts_node_type(ch), "#") == 0;
+            } else if (!ts_node_is_named(ch) && op < 0) {
+                op = param_op(ts_node_type(ch), &p->colon);
+                arg = ts_node_end_byte(ch) - start;
+            } else if (ts_node_is_named(ch) && op <= IR_PARAM_ALTERNATE) {
+                lower_word_parts(L, &word);
+            }
+        } while (next(L));
+    }
+
+    if (!name || (length && op >= 0)) {
+        free(word.data);
+        push_part(parts, IR_PART_LIT, arena_strndup(L->arena, s, len), len);
+        return;
+    }
+    if (op < 0 && !length) {
+        push_part(parts, IR_PART_PARAM, name, strlen(name));
+        return;
+    }
+
+    const char *rest = s + arg;
+    uint32_t restlen = len - 1 - arg;       /* up to the closing brace */
+    p->op = length ? IR_PARAM_LENGTH : op;
+    switch (p->op) {
+    case IR_PARAM_LENGTH:
+    case IR_PARAM_UPPER: case IR_PARAM_UPPER_FIRST:
+    case IR_PARAM_LOWER: case IR_PARAM_LOWER_FIRST:
+        break;
+    case IR_PARAM_DEFAULT: case IR_PARAM_ASSIGN:
+    case IR_PARAM_ERROR: case IR_PARAM_ALTERNATE:
+        finish_word(L, &word, &p->word);
+        break;
+    case IR_PARAM_SUBSTR: {
+        uint32_t colon = param_split(rest, restlen, ':');
+        p->offset = arith_compile(L->arena, rest, colon);
+        if (colon < restlen)
+            p->length = arith_compile(L->arena, rest + colon + 1, restlen - colon - 1);
+        break;
+    }
+    case IR_PARAM_REPLACE: case IR_PARAM_REPLACE_ALL:
+    case IR_PARAM_REPLACE_PREFIX: case IR_PARAM_REPLACE_SUFFIX: {
+        uint32_t slash = param_split(rest, restlen, '/');
+        lower_pattern_text(L, rest, slash, QUOTE_GLOB, &p->word);
+        if (slash < restlen)
+            lower_pattern_text(L, rest + slash + 1, restlen - slash - 1, QUOTE_TEXT, &p->repl);
+        else
+            literal_word(L, &p->repl, "");
+        break;
+    }
+    default:
+        lower_pattern_text(L, rest, restlen, QUOTE_GLOB, &p->word);
+        break;
+    }
+    free(word.data);
+
+    push_part(parts, IR_PART_PARAM_OP, name, strlen(name));
+    ((struct ir_part *)vec_last(parts, sizeof(struct ir_part)))->param = p;
+}
+
+/* $( ... ) or ` ... `: the statements inside are lowered like any
+   other sequence; the source between the delimiters is kept as well */
+static void
+lower_command_substitution(struct lower *L, struct vec *parts)
+{
+    uint32_t len;
+    const char *s = node_src(L, here(L), &len);
+    uint32_t open = (len >= 2 && s[0] == '$') ? 2 : 1;
+    uint32_t inner = len >= open + 1 ? len - open - 1 : 0;
+
+    struct ir_node *body = arena_zalloc(L->arena, sizeof *body);
+    lower_sequence(L, body);
+    push_part(parts, IR_PART_CMDSUB, arena_strndup(L->arena, s + open, inner), inner);
+    ((struct ir_part *)vec_last(parts, sizeof(struct ir_part)))->body = body;
+}
+
+/* $(( ... )) or $[ ... ]: compiled here, once */
+static void
+lower_arithmetic(struct lower *L, struct vec *parts)
+{
+    uint32_t len;
+    const char *s = node_src(L, here(L), &len);
+    uint32_t open = (len >= 2 && s[1] == '[') ? 2 : 3;
+    uint32_t close = open - 1;
+    uint32_t inner = len >= open + close ? len - open - close : 0;
+
+    const char *text = arena_strndup(L->arena, s + open, inner);
+    push_part(parts, IR_PART_ARITH, text, inner);
+    ((struct ir_part *)vec_last(parts, sizeof(struct ir_part)))->arith =
+        arith_compile(L->arena, text, inner);
+}
+
+/* "...".  Everything between the quotes that is not an expansion is
+   literal; it is taken from the source rather than from the child tokens,
+   which do not always cover it (the scanner folds leading blanks into the
+   closing quote, for instance). */
+static void
+lower_dquoted(struct lower *L, struct vec *parts)
+{
+    TSNode n = here(L);
+    uint32_t pos = ts_node_start_byte(n) + 1;
+    uint32_t end = ts_node_end_byte(n) - 1;
+
+    if (down(L)) {
+        do {
+            TSNode ch = here(L);
+            if (!ts_node_is_named(ch) || ts_node_symbol(ch) == sym_string_content)
+                continue;
+            uint32_t start = ts_node_start_byte(ch);
+            /* an expansion node may start with the blanks before its $ */
+            while (start < ts_node_end_byte(ch) && (L->src[start] == ' ' || L->src[start] == '\t'))
+                start++;
+            if (start > pos)
+                push_literal(L, parts, L->src + pos, start - pos, false, true);
+            lower_word_parts(L, parts);
+            pos = ts_node_end_byte(ch);
+        } while (next(L));
+    }
+    if (end > pos)
+        push_literal(L, parts, L->src + pos, end - pos, false, true);
+}
+
+/* Lower the argument-like node under the cursor into parts. */
+static void
+lower_word_parts(struct lower *L, struct vec *parts)
+{
+    TSNode n = here(L);
+    uint32_t len;
+    const char *s = node_src(L, n, &len);
+
+    switch (ts_node_symbol(n)) {
+    case sym_word:
+        push_literal(L, parts, s, len, true, false);
+        break;
+    case sym_raw_string:
+        push_part(parts, IR_PART_LIT, arena_strndup(L->arena, s + 1, len - 2), len - 2);
+        break;
+    case sym_string:
+        lower_dquoted(L, parts);
+        break;
+    case sym_simple_expansion:
+        lower_simple_expansion(L, parts);
+        break;
+    case sym_expansion:
+        lower_expansion(L, parts);
+        break;
+    case sym_command_substitution:
+        lower_command_substitution(L, parts);
+        break;
+    case sym_arithmetic_expansion:
+        lower_arithmetic(L, parts);
+        break;
+    case sym_concatenation:
+        if (down(L)) {
+            do {
+                lower_word_parts(L, parts);
+            } while (next(L));
+        }
+        break;
+    default:
+        /* numbers, patterns and whatever we do not expand: verbatim */
+        push_part(parts, IR_PART_LIT, arena_strndup(L->arena, s, len), len);
+        break;
+    }
+}
+
+/* Merge adjacent literal parts and, if nothing is left to expand, record
+   the final text in w->lit. */
+static void
+finish_word(struct lower *L, struct vec *parts, struct ir_word *w)
+{
+    struct ir_part *p = (struct ir_part *)parts->data;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < parts->n; i++) {
+        if (n > 0 && p[n - 1].kind == IR_PART_LIT && p[i].kind == IR_PART_LIT) {
+            uint32_t len = p[n - 1].len + p[i].len;
+            char *t = arena_alloc(L->arena, len + 1);
+            memcpy(t, p[n - 1].text, p[n - 1].len);
+            memcpy(t + p[n - 1].len, p[i].text, p[i].len + 1);
+            p[n - 1].text = t;
+            p[n - 1].len = len;
+        } else {
+            p[n++] = p[i];
+        }
+    }
+    parts->n = n;
+    if (n == 0)
+        push_part(parts, IR_PART_LIT, "", 0);
+
+    w->parts = vec_finish(L, parts, sizeof *w->parts, &w->nparts);
+    if (w->nparts == 1 && w->parts[0].kind == IR_PART_LIT) {
+        w->lit = w->parts[0].text;
+        w->litlen = w->parts[0].len;
+    }
+}
+
+/* A word consisting of the given text, which must outlive the IR. */
+static void
+literal_word(struct lower *L, struct ir_word *w, const char *text)
+{
+    struct vec parts = { 0 };
+    push_part(&parts, IR_PART_LIT, text, strlen(text));
+    finish_word(L, &parts, w);
+}
+
+static void
+lower_word(struct lower *L, struct ir_word *w)
+{
+    struct vec parts = { 0 };
+    lower_word_parts(L, &parts);
+    finish_word(L, &parts, w);
+}
+
+/* ---------------- commands ---------------- */
+
+static void
+lower_assign(struct lower *L, struct ir_assign *a)
+{
+    struct vec value = { 0 };
+    a->name = "";
+    if (down(L)) {
+        do {
+            TSFieldId f = here_field(L);
+            if (f == nameId)
+                a->name = node_text(L, here(L));
+            else if (f == valueId)
+                lower_word_parts(L, &value);
+        } while (next(L));
+    }
+    finish_word(L, &value, &a->value);
+}
+
+static int
+redir_op(const char *tok)
+{
+    static const struct { const char *tok; int op; } ops[] = {
+        { "<",   IR_REDIR_IN },         { ">",   IR_REDIR_OUT },
+        { ">>",  IR_REDIR_APPEND },     { ">|",  IR_REDIR_CLOBBER },
+        { "<>",  IR_REDIR_RDWR },       { "<&",  IR_REDIR_DUP_IN },
+        { ">&",  IR_REDIR_DUP_OUT },    { "&>",  IR_REDIR_OUT_ERR },
+        { "&>>", IR_REDIR_APPEND_ERR },
+        /* n<&- and n>&- are tokens of their own; they are lowered as
+           duplications of "-" */
+        { "<&-", IR_REDIR_DUP_IN },     { ">&-", IR_REDIR_DUP_OUT },
+    };
+    for (size_t i = 0; i < sizeof ops / sizeof ops[0]; i++)
+        if (strcmp(tok, ops[i].tok) == 0)
+            return ops[i].op;
+    return IR_REDIR_UNSUPPORTED;
+}
+
+/* A file_redirect.  The grammar attaches words that follow the target
+   (cmd >out arg) to the redirect as further destinations; those are
+   really arguments and go to words, when the caller has any. */
+static void
+lower_redirect(struct lower *L, struct vec *redirs, struct vec *words)
+{
+    struct ir_redir r = { .fd = -1, .op = IR_REDIR_UNSUPPORTED };
+    bool have_target = false;
+    bool closing = false;
+
+    if (ts_node_symbol(here(L)) == sym_file_redirect && down(L)) {
+        do {
+            TSNode ch = here(L);
+            TSFieldId f = here_field(L);
+            if (f == descriptorId) {
+                r.fd = atoi(L->src + ts_node_start_byte(ch));
+            } else if (f == destinationId && !have_target && !closing) {
+                lower_word(L, &r.target);
+                have_target = true;
+            } else if (f == destinationId) {
+                if (words)
+                    lower_word(L, vec_push(words, sizeof(struct ir_word)));
+            } else if (!ts_node_is_named(ch)) {
+                const char *tok = ts_node_type(ch);
+                r.op = redir_op(tok);
+                closing = tok[strlen(tok) - 1] == '-';
+            }
+        } while (next(L));
+    }
+    if (r.fd == -1)
+        r.fd = (r.op == IR_REDIR_IN || r.op == IR_REDIR_RDWR || r.op == IR_REDIR_DUP_IN) ? 0 : 1;
+    if (!have_target)
+        literal_word(L, &r.target, closing ? "-" : "");
+
+    *(struct ir_redir *)vec_push(redirs, sizeof r) = r;
+}
+
+static bool
+is_redirect(int sym)
+{
+    return sym == sym_file_redirect || sym == sym_heredoc_redirect
+        || sym == sym_herestring_redirect;
+}
+
+/* The argument of a declaration being put together, see lower_command(). */
+static void
+finish_decl_arg(struct lower *L, struct vec *parts, struct vec *words)
+{
+    if (parts->n)
+        finish_word(L, parts, vec_push(words, sizeof(struct ir_word)));
+}
+
+/* command, declaration_command and unset_command.  For the latter two the
+   keyword becomes argv[0] so that they run like any other builtin.
+   The grammar cuts a declaration's argument after a leading name, as
+   in export V$i=x (variable_name "V", then "$i=x"); pieces with nothing
+   between them are joined again into one argument. */
+static void
+lower_command(struct lower *L, struct ir_node *out)
+{
+    struct vec words = { 0 }, assigns = { 0 }, redirs = { 0 };
+    struct vec parts = { 0 };       /* the declaration argument so far */
+    uint32_t parts_end = 0;
+    int sym = ts_node_symbol(here(L));
+    bool decl = sym != sym_command;
+
+    out->kind = IR_COMMAND;
+    if (down(L)) {
+        do {
+            TSNode ch = here(L);
+            int csym = ts_node_symbol(ch);
+            if (decl && (ts_node_start_byte(ch) != parts_end || is_redirect(csym)))
+                finish_decl_arg(L, &parts, &words);
+            if (!ts_node_is_named(ch)) {
+                if (decl && words.n == 0)   /* the keyword */
+                    literal_word(L, vec_push(&words, sizeof(struct ir_word)), ts_node_type(ch));
+            } else if (csym == sym_command_name) {
+                if (down(L)) {
+                    do {
+                        if (ts_node_is_named(here(L)))
+                            lower_word(L, vec_push(&words, sizeof(struct ir_word)));
+                    } while (next(L));
+                }
+            } else if (is_redirect(csym)) {
+                lower_redirect(L, &redirs, &words);
+            } else if (csym == sym_variable_assignment && !decl) {
+                lower_assign(L, vec_push(&assigns, sizeof(struct ir_assign)));
+            } else if (csym == sym_variable_assignment) {
+                /* export NAME=value: one argument "NAME=value" */
+                struct ir_assign a;
+                lower_assign(L, &a);
+                size_t nlen = strlen(a.name);
+                char *eq = arena_alloc(L->arena, nlen + 2);
+                memcpy(eq, a.name, nlen);
+                memcpy(eq + nlen, "=", 2);
+                push_part(&parts, IR_PART_LIT, eq, nlen + 1);
+                for (uint32_t i = 0; i < a.value.nparts; i++)
+                    *(struct ir_part *)vec_push(&parts, sizeof(struct ir_part)) = a.value.parts[i];
+                parts_end = ts_node_end_byte(ch);
+            } else if (decl && csym != sym_comment) {
+                lower_word_parts(L, &parts);
+                parts_end = ts_node_end_byte(ch);
+            } else if (csym != sym_comment) {
+                lower_word(L, vec_push(&words, sizeof(struct ir_word)));
+            }
+        } while (next(L));
+    }
+    finish_decl_arg(L, &parts, &words);
+    out->words = vec_finish(L, &words, sizeof *out->words, &out->nwords);
+    out->assigns = vec_finish(L, &assigns, sizeof *out->assigns, &out->nassigns);
+    out->redirs = vec_finish(L, &redirs, sizeof *out->redirs, &out->nredirs);
+}
+
+/* NAME=value on its own, or several of them */
+static void
+lower_assignments(struct lower *L, struct ir_node *out)
+{
+    struct vec assigns = { 0 };
+    out->kind = IR_COMMAND;
+    if (ts_node_symbol(here(L)) == sym_variable_assignment) {
+        lower_assign(L, vec_push(&assigns, sizeof(struct ir_assign)));
+    } else if (down(L)) {
+        do {
+            if (ts_node_symbol(here(L)) == sym_variable_assignment)
+                lower_assign(L, vec_push(&assigns, sizeof(struct ir_assign)));
+        } while (next(L));
+    }
+    out->assigns = vec_finish(L, &assigns, sizeof *out->assigns, &out->nassigns);
+}
+
+/* ---------------- test expressions ---------------- */
+
+/*
+ * The grammar's trees for test expressions do not follow test's
+ * precedence: `[ -f x -a -r x ]` comes out as -f applied to "x -a -r x",
+ * and `[[ ! a =~ b ]]` negates only a.  So the operators and operands are
+ * collected in source order and parsed again, as the test builtin parses
+ * its arguments:
+ *
+ *   or      := and { -o and }            (|| in [[ ]])
+ *   and     := not { -a not }            (&& in [[ ]])
+ *   not     := ! not | primary
+ *   primary := ( or ) | word binary-op word | unary-op word | word
+ */
+
+struct ttok {
+    const char *op;         /* text of an operator token, NULL for operands */
+    TSNode node;            /* an operand's node */
+    struct ir_word word;
+};
+
+struct tparse {
+    struct lower *L;
+    struct ttok *toks;
+    uint32_t pos, n;
+    bool dbl;               /* [[ ]] */
+    const char *err;
+};
+
+static void
+collect_test_tokens(struct lower *L, struct vec *toks)
+{
+    TSNode n = here(L);
+    int sym = ts_node_symbol(n);
+    if (sym == sym_binary_expression || sym == sym_unary_expression ||
+        sym == sym_parenthesized_expression) {
+        if (down(L)) {
+            do {
+                collect_test_tokens(L, toks);
+            } while (next(L));
+        }
+        return;
+    }
+    if (sym == sym_comment)
+        return;
+
+    struct ttok *t = vec_push(toks, sizeof *t);
+    if (!ts_node_is_named(n) || sym == sym_test_operator) {
+        t->op = node_text(L, n);
+        literal_word(L, &t->word, t->op);
+    } else {
+        t->node = n;
+        lower_word(L, &t->word);
+    }
+}
+
+static bool
+tp_at(struct tparse *p, const char *op)
+{
+    return p->pos < p->n && p->toks[p->pos].op && strcmp(p->toks[p->pos].op, op) == 0;
+}
+
+static struct ir_texpr *
+tp_node(struct tparse *p, int kind, int top, const char *op)
+{
+    struct ir_texpr *e = arena_zalloc(p->L->arena, sizeof *e);
+    e->kind = kind;
+    e->top = top;
+    e->op = op;
+    return e;
+}
+
+/* The next token as an operand, whatever it looks like. */
+static struct ir_texpr *
+tp_word(struct tparse *p)
+{
+    struct ir_texpr *e = tp_node(p, IR_TEXPR_WORD, IR_TOP_NONE, NULL);
+    e->word = p->toks[p->pos++].word;
+    return e;
+}
+
+/* The next token as a pattern: what was quoted in it matches itself. */
+static struct ir_texpr *
+tp_pattern(struct tparse *p, enum quote_as quote)
+{
+    struct lower *L = p->L;
+    TSNode n = p->toks[p->pos++].node;
+    struct ir_texpr *e = tp_node(p, IR_TEXPR_WORD, IR_TOP_NONE, NULL);
+    uint32_t len;
+    const char *s = node_src(L, n, &len);
+
+    TSTreeCursor outer = L->cur;
+    L->cur = ts_tree_cursor_new(n);
+    lower_pattern_text(L, s, len, quote, &e->word);
+    ts_tree_cursor_delete(&L->cur);
+    L->cur = outer;
+    return e;
+}
+
+static struct ir_texpr *tp_or(struct tparse *p);
+
+static struct ir_texpr *
+tp_primary(struct tparse *p)
+{
+    if (p->pos >= p->n) {
+        p->err = "argument expected";
+        return NULL;
+    }
+
+    if (tp_at(p, "(")) {
+        p->pos++;
+        struct ir_texpr *e = tp_or(p);
+        if (e && !tp_at(p, ")")) {
+            p->err = "`)' expected";
+            return NULL;
+        }
+        p->pos++;
+        return e;
+    }
+
+    const struct ttok *t = &p->toks[p->pos];
+    if (p->pos + 1 < p->n && t[1].op) {
+        int top = cond_binary_op(t[1].op);
+        if (top != IR_TOP_NONE && top != IR_TOP_AND && top != IR_TOP_OR) {
+            if (p->pos + 2 >= p->n) {
+                p->err = "argument expected";
+                return NULL;
+            }
+            /* in [[ ]], the right side of == != =~ is a pattern */
+            bool match = p->dbl && !t[2].op &&
+                         (top == IR_TOP_STR_EQ || top == IR_TOP_STR_NE || top == IR_TOP_REGEX);
+            if (match && top != IR_TOP_REGEX)
+                top = top == IR_TOP_STR_EQ ? IR_TOP_PAT_EQ : IR_TOP_PAT_NE;
+            struct ir_texpr *e = tp_node(p, IR_TEXPR_BINARY, top, t[1].op);
+            e->left = tp_word(p);
+            p->pos++;
+            if (!match)
+                e->right = tp_word(p);
+            else
+                e->right = tp_pattern(p, top == IR_TOP_REGEX ? QUOTE_REGEX : QUOTE_GLOB);
+            return e;
+        }
+    }
+
+    if (t->op && cond_unary_op(t->op) && p->pos + 1 < p->n) {
+        struct ir_texpr *e = tp_node(p, IR_TEXPR_UNARY, IR_TOP_UNARY, t->op);
+        p->pos++;
+        e->left = tp_word(p);
+        return e;
+    }
+    return tp_word(p);
+}
+
+static struct ir_texpr *
+tp_not(struct tparse *p)
+{
+    if (tp_at(p, "!") && p->pos + 1 < p->n) {
+        p->pos++;
+        struct ir_texpr *inner = tp_not(p);
+        if (!inner)
+            return NULL;
+        struct ir_texpr *e = tp_node(p, IR_TEXPR_UNARY, IR_TOP_NOT, "!");
+        e->left = inner;
+        return e;
+    }
+    return tp_primary(p);
+}
+
+/* Left-associative chain of sub joined by op. */
+static struct ir_texpr *
+tp_chain(struct tparse *p, struct ir_texpr *(*sub)(struct tparse *),
+         const char *op, int top)
+{
+    struct ir_texpr *e = sub(p);
+    while (e && tp_at(p, op)) {
+        p->pos++;
+        struct ir_texpr *r = sub(p);
+        if (!r)
+            return NULL;
+        struct ir_texpr *both = tp_node(p, IR_TEXPR_BINARY, top, op);
+        both->left = e;
+        both->right = r;
+        e = both;
+    }
+    return e;
+}
+
+static struct ir_texpr *
+tp_and(struct tparse *p)
+{
+    return tp_chain(p, tp_not, p->dbl ? "&&" : "-a", IR_TOP_AND);
+}
+
+static struct ir_texpr *
+tp_or(struct tparse *p)
+{
+    return tp_chain(p, tp_and, p->dbl ? "||" : "-o", IR_TOP_OR);
+}
+
+static void
+lower_test(struct lower *L, struct ir_node *out)
+{
+    struct vec toks = { 0 };
+    out->kind = IR_TEST;
+    if (down(L)) {
+        do {
+            TSNode ch = here(L);
+            if (ts_node_is_named(ch))
+                collect_test_tokens(L, &toks);
+            else if (strcmp(ts_node_type(ch), "[[") == 0)
+                out->flags |= IR_F_DOUBLE_BRACKET;
+        } while (next(L));
+    }
+
+    /* [ ] is false */
+    if (toks.n > 0) {
+        struct tparse p = {
+            .L = L, .toks = (struct ttok *)toks.data, .n = toks.n,
+            .dbl = (out->flags & IR_F_DOUBLE_BRACKET) != 0,
+        };
+        out->test = tp_or(&p);
+        if (!p.err && p.pos < p.n)
+            p.err = "too many arguments";
+        if (p.err)
+            out->test = tp_node(&p, IR_TEXPR_ERROR, IR_TOP_NONE, p.err);
+    }
+    free(toks.data);
+}
+
+/* ---------------- arithmetic commands ---------------- */
+
+/* (( expr )) has no node of its own in the grammar: it comes out as a
+   command named by an arithmetic expansion, or as a test_command. */
+static bool
+is_arith_command(struct lower *L)
+{
+    uint32_t len;
+    const char *s = node_src(L, here(L), &len);
+    return len >= 4 && s[0] == '(' && s[1] == '(' && s[len - 2] == ')' && s[len - 1] == ')';
+}
+
+static void
+lower_arith_command(struct lower *L, struct ir_node *out)
+{
+    uint32_t len;
+    const char *s = node_src(L, here(L), &len);
+    out->kind = IR_ARITH;
+    out->arith = arith_compile(L->arena, s + 2, len - 4);
+}
+
+/* ---------------- compound statements ---------------- */
+
+static bool lower_stmt(struct lower *L, struct ir_node *out);
+
+/* State for building a list: the element vector and the connector the
+   next element gets. */
+struct list_builder {
+    struct vec items;
+    int conn;
+};
+
+/* Feed the child under the cursor to a list: statements become elements,
+   operators set the connector or mark the previous element async. */
+static void
+list_add(struct lower *L, struct list_builder *b)
+{
+    TSNode ch = here(L);
+    if (ts_node_is_named(ch)) {
+        struct ir_node tmp = { 0 };
+        if (lower_stmt(L, &tmp)) {
+            tmp.conn = b->conn;
+            *(struct ir_node *)vec_push(&b->items, sizeof tmp) = tmp;
+            b->conn = IR_CONN_SEQ;
+        }
+        return;
+    }
+
+    const char *tok = ts_node_type(ch);
+    if (strcmp(tok, "&&") == 0) {
+        b->conn = IR_CONN_AND;
+    } else if (strcmp(tok, "||") == 0) {
+        b->conn = IR_CONN_OR;
+    } else if (strcmp(tok, "&") == 0) {
+        struct ir_node *prev = vec_last(&b->items, sizeof *prev);
+        TSNode stmt = ts_node_prev_named_sibling(ch);
+        if (prev) {
+            prev->flags |= IR_F_ASYNC;
+            if (!ts_node_is_null(stmt)) {
+                uint32_t len;
+                const char *s = node_src(L, stmt, &len);
+                prev->text = arena_strndup(L->arena, s, len);
+            }
+        }
+    }
+}
+
+static void
+list_finish(struct lower *L, struct list_builder *b, struct ir_node *out)
+{
+    out->kind = IR_LIST;
+    out->kids = vec_finish(L, &b->items, sizeof *out->kids, &out->nkids);
+}
+
+/* A node whose children form a statement sequence: program, do_group,
+   compound_statement, else_clause, ... (keywords are skipped) */
+static void
+lower_sequence(struct lower *L, struct ir_node *out)
+{
+    struct list_builder b = { 0 };
+    if (down(L)) {
+        do {
+            list_add(L, &b);
+        } while (next(L));
+    }
+    list_finish(L, &b, out);
+}
+
+/* list: a && b || c.  Lists nest to the left; flatten them so that the
+   chain is one IR_LIST evaluated left to right. */
+static void
+lower_andor(struct lower *L, struct list_builder *b)
+{
+    if (down(L)) {
+        do {
+            if (ts_node_symbol(here(L)) == sym_list) {
+                int conn = b->conn;
+                uint32_t first = b->items.n;
+                lower_andor(L, b);
+                if (first < b->items.n)
+                    ((struct ir_node *)b->items.data)[first].conn = conn;
+            } else {
+                list_add(L, b);
+            }
+        } while (next(L));
+    }
+}
+
+static void
+lower_pipeline(struct lower *L, struct ir_node *out)
+{
+    struct vec stages = { 0 };
+    out->kind = IR_PIPELINE;
+    if (down(L)) {
+        do {
+            TSNode ch = here(L);
+            if (ts_node_is_named(ch)) {
+                struct ir_node tmp = { 0 };
+                if (lower_stmt(L, &tmp))
+                    *(struct ir_node *)vec_push(&stages, sizeof tmp) = tmp;
+            } else if (strcmp(ts_node_type(ch), "|&") == 0) {
+                struct ir_node *prev = vec_last(&stages, sizeof *prev);
+                if (prev)
+                    prev->flags |= IR_F_PIPE_STDERR;
+            }
+        } while (next(L));
+    }
+    out->kids = vec_finish(L, &stages, sizeof *out->kids, &out->nkids);
+}
+
+/* redirected_statement.  Redirections on a simple command are folded into
+   the command itself; other bodies keep an IR_REDIRECTED wrapper. */
+static void
+lower_redirected(struct lower *L, struct ir_node *out)
+{
+    struct ir_node body = { 0 };
+    bool have_body = false;
+    struct vec redirs = { 0 }, extra = { 0 };
+
+    if (down(L)) {
+        do {
+            TSNode ch = here(L);
+            if (here_field(L) == bodyId)
+                have_body = lower_stmt(L, &body);
+            else if (ts_node_is_named(ch) && is_redirect(ts_node_symbol(ch)))
+                lower_redirect(L, &redirs, &extra);
+        } while (next(L));
+    }
+
+    if (have_body && body.kind == IR_COMMAND && body.nwords > 0) {
+        /* append to the command's own words and redirections */
+        struct vec w = { 0 }, r = { 0 };
+        for (uint32_t i = 0; i < body.nwords; i++)
+            *(struct ir_word *)vec_push(&w, sizeof(struct ir_word)) = body.words[i];
+        for (uint32_t i = 0; i < extra.n; i++)
+            *(struct ir_word *)vec_push(&w, sizeof(struct ir_word)) = ((struct ir_word *)extra.data)[i];
+        for (uint32_t i = 0; i < body.nredirs; i++)
+            *(struct ir_redir *)vec_push(&r, sizeof(struct ir_redir)) = body.redirs[i];
+        for (uint32_t i = 0; i < redirs.n; i++)
+            *(struct ir_redir *)vec_push(&r, sizeof(struct ir_redir)) = ((struct ir_redir *)redirs.data)[i];
+        free(extra.data);
+        free(redirs.data);
+        *out = body;
+        out->words = vec_finish(L, &w, sizeof *out->words, &out->nwords);
+        out->redirs = vec_finish(L, &r, sizeof *out->redirs, &out->nredirs);
+        return;
+    }
+
+    free(extra.data);
+    out->kind = IR_REDIRECTED;
+    out->redirs = vec_finish(L, &redirs, sizeof *out->redirs, &out->nredirs);
+    if (have_body) {
+        out->nkids = 1;
+        out->kids = arena_memdup(L->arena, &body, sizeof body);
+    }
+}
+
+/* if_statement and elif_clause.  The condition and the then-part are not
+   wrapped in nodes of their own; they are told apart by the `then`
+   keyword.  Appends cond, body, then the arms of any nested elif/else. */
+static void
+lower_if_arm(struct lower *L, struct vec *kids)
+{
+    struct list_builder cond = { 0 }, body = { 0 };
+    struct list_builder *cur = &cond;
+    struct vec rest = { 0 };
+
+    if (down(L)) {
+        do {
+            TSNode ch = here(L);
+            int sym = ts_node_symbol(ch);
+            if (!ts_node_is_named(ch) && strcmp(ts_node_type(ch), "then") == 0)
+                cur = &body;
+            else if (sym == sym_elif_clause)
+                lower_if_arm(L, &rest);
+            else if (sym == sym_else_clause)
+                lower_sequence(L, vec_push(&rest, sizeof(struct ir_node)));
+            else
+                list_add(L, cur);
+        } while (next(L));
+    }
+
+    list_finish(L, &cond, vec_push(kids, sizeof(struct ir_node)));
+    list_finish(L, &body, vec_push(kids, sizeof(struct ir_node)));
+    for (uint32_t i = 0; i < rest.n; i++)
+        *(struct ir_node *)vec_push(kids, sizeof(struct ir_node)) = ((struct ir_node *)rest.data)[i];
+    free(rest.data);
+}
+
+static void
+lower_if(struct lower *L, struct ir_node *out)
+{
+    struct vec kids = { 0 };
+    lower_if_arm(L, &kids);
+    out->kind = IR_IF;
+    out->kids = vec_finish(L, &kids, sizeof *out->kids, &out->nkids);
+}
+
+static void
+lower_for(struct lower *L, struct ir_node *out)
+{
+    struct vec values = { 0 };
+    struct ir_node body = { .kind = IR_LIST };
+
+    out->kind = IR_FOR;
+    out->name = "";
+    if (down(L)) {
+        do {
+            TSFieldId f = here_field(L);
+            if (f == variableId)
+                out->name = node_text(L, here(L));
+            else if (f == valueId)
+                lower_word(L, vec_push(&values, sizeof(struct ir_word)));
+            else if (f == bodyId)
+                lower_stmt(L, &body);
+        } while (next(L));
+    }
+    out->words = vec_finish(L, &values, sizeof *out->words, &out->nwords);
+    out->nkids = 1;
+    out->kids = arena_memdup(L->arena, &body, sizeof body);
+}
+
+/* while_statement.  The condition is a statement list of its own; the
+   loop keyword says whether it is while or until. */
+static void
+lower_while(struct lower *L, struct ir_node *out)
+{
+    struct list_builder cond = { 0 };
+    struct ir_node kids[2] = { [1] = { .kind = IR_LIST } };
+
+    out->kind = IR_WHILE;
+    if (down(L)) {
+        do {
+            TSNode ch = here(L);
+            if (here_field(L) == bodyId)
+                lower_stmt(L, &kids[1]);
+            else if (!ts_node_is_named(ch) && strcmp(ts_node_type(ch), "until") == 0)
+                out->flags |= IR_F_UNTIL;
+            else
+                list_add(L, &cond);
+        } while (next(L));
+    }
+    list_finish(L, &cond, &kids[0]);
+    out->nkids = 2;
+    out->kids = arena_memdup(L->arena, kids, sizeof kids);
+}
+
+/* Lower the statement under the cursor into *out.  Returns false for
+   nodes that produce no IR (comments). */
+static bool
+lower_stmt(struct lower *L, struct ir_node *out)
+{
+    TSNode n = here(L);
+    *out = (struct ir_node){ .line = L->line_base + ts_node_start_point(n).row };
+
+    switch (ts_node_symbol(n)) {
+    case sym_comment:
+        return false;
+    case sym_command:
+    case sym_declaration_command:
+    case sym_unset_command:
+        if (is_arith_command(L))
+            lower_arith_command(L, out);
+        else
+            lower_command(L, out);
+        break;
+    case sym_variable_assignment:
+    case sym_variable_assignments:
+        lower_assignments(L, out);
+        break;
+    case sym_list: {
+        struct list_builder b = { 0 };
+        lower_andor(L, &b);
+        list_finish(L, &b, out);
+        break;
+    }
+    case sym_pipeline:
+        lower_pipeline(L, out);
+        break;
+    case sym_redirected_statement:
+        lower_redirected(L, out);
+        break;
+    case sym_test_command:
+        if (is_arith_command(L))
+            lower_arith_command(L, out);
+        else
+            lower_test(L, out);
+        break;
+    case sym_if_statement:
+        lower_if(L, out);
+        break;
+    case sym_for_statement:
+        lower_for(L, out);
+        break;
+    case sym_while_statement:
+        lower_while(L, out);
+        break;
+    case sym_do_group:
+    case sym_compound_statement:
+        lower_sequence(L, out);
+        break;
+    default:
+        out->kind = IR_UNSUPPORTED;
+        out->name = ts_node_type(n);
+        break;
+    }
+    return true;
+}
+
+/* ---------------- entry points ---------------- */
+
+static void
+init_field_ids(void)
+{
+    const TSLanguage *bash = tree_sitter_bash();
+#define FIELD(name) name##Id = ts_language_field_id_for_name(bash, #name, strlen(#name))
+    FIELD(name);
+    FIELD(value);
+    FIELD(variable);
+    FIELD(body);
+    FIELD(descriptor);
+    FIELD(destination);
+    FIELD(operator);
+    FIELD(right);
+#undef FIELD
+}
+
+void
+ir_lower(struct ir_program *prog, TSNode program, const char *src)
+{
+    ir_lower_until(prog, program, src, UINT32_MAX, 1);
+}
+
+void
+ir_lower_until(struct ir_program *prog, TSNode program, const char *src,
+               uint32_t end, uint32_t first_line)
+{
+    if (nameId == 0)
+        init_field_ids();
+
+    arena_init(&prog->arena);
+    struct lower L = {
+        .arena = &prog->arena,
+        .src = src,
+        .line_base = first_line,
+        .cur = ts_tree_cursor_new(program),
+    };
+
+    struct list_builder b = { 0 };
+    if (down(&L)) {
+        do {
+            if (ts_node_start_byte(here(&L)) < end)
+                list_add(&L, &b);
+        } while (next(&L));
+    }
+    list_finish(&L, &b, &prog->root);
+    ts_tree_cursor_delete(&L.cur);
+}
+
+void
+ir_free(struct ir_program *prog)
+{
+    arena_free(&prog->arena);
+}
@@ -0,0 +1,217 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <tree_sitter/api.h>
+
+#include "arena.h"
+
+/*
+ * The shell's intermediate representation.
+ *
+ * After parsing, the tree-sitter CST is lowered once into a compact tree
+ * of ir_nodes and the evaluators run on that instead.  Lowering resolves
+ * everything that does not depend on run-time state:
+ *
+ *   - the children of a node live in one contiguous array (no O(i)
+ *     ts_node_named_child() lookups, no re-walks of a loop body);
+ *   - &&, ||, ;, & and | are resolved to connector/flag values instead of
+ *     being rediscovered from the source text between two siblings;
+ *   - words are pre-sliced into literal text and expansion parts, with
+ *     quotes already removed, and fully literal words carry their final
+ *     argument text;
+ *   - redirections carry their fd, operator and target word.
+ *
+ * All IR memory, including strings, lives in an arena owned by ir_program,
+ * so the source text and the CST can be discarded once lowering is done.
+ */
+
+/* ---------------- words ---------------- */
+
+struct ir_node;
+struct arith_prog;
+
+enum ir_part_kind {
+    IR_PART_LIT,        /* literal bytes */
+    IR_PART_PARAM,      /* $name or ${name}; text is the name ("!" for $!) */
+    IR_PART_STATUS,     /* $? */
+    IR_PART_PID,        /* $$ */
+    IR_PART_CMDSUB,     /* $( ... ); text is the source between the parens,
+                           body the lowered statements */
+    IR_PART_ARITH,      /* $(( ... )); text is the expression, arith its code */
+    IR_PART_PARAM_OP,   /* ${name<op>...}; text is the name, param the rest */
+};
+
+struct ir_part {
+    uint8_t kind;
+    uint32_t len;
+    const char *text;   /* NUL-terminated; meaning depends on kind */
+    union {
+        const struct ir_node *body;         /* IR_PART_CMDSUB: an IR_LIST */
+        const struct arith_prog *arith;     /* IR_PART_ARITH */
+        const struct ir_param *param;       /* IR_PART_PARAM_OP */
+    };
+};
+
+struct ir_word {
+    const char *lit;            /* the whole word if it has no expansions, else NULL */
+    uint32_t litlen;
+    uint32_t nparts;
+    struct ir_part *parts;
+};
+
+/* Operators of ${name<op>...}. */
+enum ir_param_op {
+    IR_PARAM_LENGTH,            /* ${#name} */
+    IR_PARAM_DEFAULT,           /* ${name-word}, ${name:-word} */
+    IR_PARAM_ASSIGN,            /* =, := */
+    IR_PARAM_ERROR,             /* ?, :? */
+    IR_PARAM_ALTERNATE,         /* +, :+ */
+    IR_PARAM_SUBSTR,            /* ${name:offset[:length]} */
+    IR_PARAM_TRIM_PREFIX,       /* #pattern */
+    IR_PARAM_TRIM_PREFIX_LONG,  /* ##pattern */
+    IR_PARAM_TRIM_SUFFIX,       /* %pattern */
+    IR_PARAM_TRIM_SUFFIX_LONG,  /* %%pattern */
+    IR_PARAM_REPLACE,           /* /pattern/repl */
+    IR_PARAM_REPLACE_ALL,       /* //pattern/repl */
+    IR_PARAM_REPLACE_PREFIX,    /* /#pattern/repl */
+    IR_PARAM_REPLACE_SUFFIX,    /* /%pattern/repl */
+    IR_PARAM_UPPER,             /* ^^ */
+    IR_PARAM_UPPER_FIRST,       /* ^ */
+    IR_PARAM_LOWER,             /* ,, */
+    IR_PARAM_LOWER_FIRST,       /* , */
+    IR_PARAM_QUOTE,             /* "$name" in a pattern: glob characters escaped */
+    IR_PARAM_QUOTE_REGEX,       /* "$name" in a regex: ERE characters escaped */
+};
+
+struct ir_param {
+    uint8_t op;                 /* enum ir_param_op */
+    bool colon;                 /* :-, :=, :?, :+ also apply to an empty value */
+    struct ir_word word;        /* the word of - = ? +, or the pattern; quoted
+                                   pattern characters are backslash-escaped */
+    struct ir_word repl;        /* replacement */
+    const struct arith_prog *offset, *length;   /* IR_PARAM_SUBSTR; length may be NULL */
+};
+
+/* ---------------- redirections ---------------- */
+
+enum ir_redir_op {
+    IR_REDIR_IN,            /* <   */
+    IR_REDIR_OUT,           /* >   */
+    IR_REDIR_APPEND,        /* >>  */
+    IR_REDIR_CLOBBER,       /* >|  */
+    IR_REDIR_RDWR,          /* <>  */
+    IR_REDIR_DUP_IN,        /* <&  */
+    IR_REDIR_DUP_OUT,       /* >&  */
+    IR_REDIR_OUT_ERR,       /* &>  */
+    IR_REDIR_APPEND_ERR,    /* &>> */
+    IR_REDIR_UNSUPPORTED,   /* here-documents, process substitution, ... */
+};
+
+struct ir_redir {
+    int fd;                 /* descriptor being redirected */
+    uint8_t op;             /* enum ir_redir_op */
+    struct ir_word target;
+};
+
+/* ---------------- test expressions ([ ] and [[ ]]) ---------------- */
+
+enum ir_texpr_kind {
+    IR_TEXPR_WORD,          /* a bare operand: true if not empty */
+    IR_TEXPR_UNARY,         /* op word, or ! expr */
+    IR_TEXPR_BINARY,        /* left op right */
+    IR_TEXPR_ERROR,         /* malformed expression; op is the message */
+};
+
+/* Operators, resolved when lowering. */
+enum ir_test_op {
+    IR_TOP_NONE,
+    IR_TOP_NOT,             /* ! expr */
+    IR_TOP_AND,             /* -a in [ ], && in [[ ]] */
+    IR_TOP_OR,              /* -o in [ ], || in [[ ]] */
+    IR_TOP_UNARY,           /* -e, -f, -n, ...: op[1] says which */
+    IR_TOP_STR_EQ, IR_TOP_STR_NE, IR_TOP_STR_LT, IR_TOP_STR_GT,
+    IR_TOP_PAT_EQ, IR_TOP_PAT_NE,   /* == and != in [[ ]], unquoted right side */
+    IR_TOP_REGEX,           /* =~ */
+    IR_TOP_EQ, IR_TOP_NE, IR_TOP_LT, IR_TOP_LE, IR_TOP_GT, IR_TOP_GE,
+    IR_TOP_NT, IR_TOP_OT, IR_TOP_EF,
+};
+
+struct ir_texpr {
+    uint8_t kind;
+    uint8_t top;            /* enum ir_test_op */
+    const char *op;         /* "-f", "=", "-a", "!", ... */
+    struct ir_word word;    /* IR_TEXPR_WORD */
+    struct ir_texpr *left;  /* UNARY: the operand */
+    struct ir_texpr *right;
+};
+
+/* ---------------- statements ---------------- */
+
+enum ir_kind {
+    IR_LIST,            /* kids run in order, joined by their conn */
+    IR_PIPELINE,        /* kids are the stages */
+    IR_COMMAND,         /* simple command, or assignments only if nwords == 0 */
+    IR_TEST,            /* [ ... ] or [[ ... ]] */
+    IR_IF,              /* kids: cond, then, {cond, then}*, [else] */
+    IR_FOR,             /* for name in words; kids[0] is the body */
+    IR_WHILE,           /* kids: cond, body; IR_F_UNTIL negates cond */
+    IR_ARITH,           /* (( expr )) */
+    IR_REDIRECTED,      /* kids[0] with redirs applied */
+    IR_UNSUPPORTED,     /* construct the shell cannot run; name says which */
+};
+
+/* How a list element is joined to the element before it. */
+enum ir_conn {
+    IR_CONN_SEQ,        /* ; or newline */
+    IR_CONN_AND,        /* && */
+    IR_CONN_OR,         /* || */
+};
+
+/* ir_node.flags */
+#define IR_F_ASYNC          0x1     /* followed by & */
+#define IR_F_PIPE_STDERR    0x2     /* pipeline stage followed by |& */
+#define IR_F_DOUBLE_BRACKET 0x4     /* IR_TEST written as [[ ]] */
+#define IR_F_UNTIL          0x8     /* IR_WHILE written as until */
+
+struct ir_assign {
+    const char *name;
+    struct ir_word value;
+};
+
+struct ir_node {
+    uint8_t kind;       /* enum ir_kind */
+    uint8_t conn;       /* enum ir_conn */
+    uint16_t flags;
+    uint32_t line;      /* 1-based source line, for diagnostics */
+
+    uint32_t nkids;
+    struct ir_node *kids;
+
+    uint32_t nwords;            /* IR_COMMAND: argv words; IR_FOR: values */
+    struct ir_word *words;
+    uint32_t nassigns;          /* IR_COMMAND */
+    struct ir_assign *assigns;
+    uint32_t nredirs;           /* IR_COMMAND, IR_REDIRECTED */
+    struct ir_redir *redirs;
+
+    const char *name;           /* IR_FOR: variable; IR_UNSUPPORTED: node type */
+    const char *text;           /* IR_F_ASYNC: source text, for jobs */
+    struct ir_texpr *test;      /* IR_TEST */
+    const struct arith_prog *arith;     /* IR_ARITH */
+};
+
+struct ir_program {
+    struct arena arena;
+    struct ir_node root;        /* an IR_LIST */
+};
+
+/* Lower the CST rooted at program (parsed from src) into prog. */
+void ir_lower(struct ir_program *prog, TSNode program, const char *src);
+
+/* Like ir_lower, but only the top-level statements that start before byte
+   end; src begins at line first_line of the script. */
+void ir_lower_until(struct ir_program *prog, TSNode program, const char *src,
+                    uint32_t end, uint32_t first_line);
+
+/* Release everything ir_lower() allocated. */
+void ir_free(struct ir_program *prog);
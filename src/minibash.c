@@ -19,20 +19,32 @@
 #include <termios.h>
 #include <sys/wait.h>
 #include <assert.h>
+#include <errno.h>
 
 #include <tree_sitter/api.h>
 
 #include "expand.h"
+#include "ir.h"
 #include "tree_sitter/tree-sitter-bash.h"
 #include "ts_symbols.h"
 /* Since the handed out code contains a number of unused functions. */
 #pragma GCC diagnostic ignored "-Wunused-function"
 
 #include "hashtable.h"
+#include "tommyds/tommyhashlin.h"
 #include "signal_support.h"
 #include "utils.h"
 #include "list.h"
 #include "ts_helpers.h"
+#include "spawn.h"
+#include "piping.h"
+#include "pathcache.h"
+#include "arith.h"
+#include "builtins.h"
+#include "cond.h"
+#include "vars.h"
+#include "events.h"
+#include "redir.h"
 
 
 /* -------- debug helper -------- */
@@ -49,50 +61,45 @@
 #endif
 
 
-/* These are field ids suitable for use in ts_node_child_by_field_id for certain rules. 
-   e.g., to obtain the body of a while loop, you can use:
-    TSNode body = ts_node_child_by_field_id(child, bodyId);
-*/
-static TSFieldId bodyId, redirectId, destinationId, valueId, nameId, conditionId;
-static TSFieldId variableId;
-static TSFieldId leftId, operatorId, rightId;
-
 static char *input;         // to avoid passing the current input around
 static TSParser *parser;    // a singleton parser instance 
-static tommy_hashdyn shell_vars;        // a hash table containing the internal shell variables
+static struct arena cmd_arena;          // expansion results of the commands being evaluated
+static struct io_capture *stdout_capture;   // builtins' stdout during an in-shell $(...)
 
 static void handle_child_status(pid_t pid, int status);
-static char *read_script_from_fd(int readfd);
+static void execute_stream(int fd);
 static void execute_script(char *script);
 
-
-static void handle_command(TSNode command_node);
-static int run_command_with_io(TSNode cmd, int in_fd /*-1*/, int out_fd /*-1*/);
-
-
-static int  apply_command_redirections(TSNode command_node);
-static void exec_command_in_child(TSNode command_node);
-static int  run_pipeline_with_io(TSNode pipeline_node, int pipe_in_fd, int pipe_out_fd);
-
-static void handle_redirected_statement(TSNode rs);
-
-static int eval_node_status(TSNode n);
-static int eval_andor(TSNode andor_node);
-
-static int eval_if_statement(TSNode if_node);
-
-
-/* prototypes */
-static TSNode unwrap_else_body(TSNode n);   /* <-- add this line */
-
-static int   eval_test_command(TSNode test_cmd);
-static TSNode unwrap_else_body(TSNode n); 
-
-static int  eval_for_statement(TSNode for_node);
+/* Evaluators.  They all work on the IR (ir.h), never on the CST. */
+static int  eval_node(const struct ir_node *n);
+static int  eval_list(const struct ir_node *list);
+static int  run_command_with_io(const struct ir_node *cmd, int in_fd /*-1*/, int out_fd /*-1*/);
+static int  run_pipeline_with_io(const struct ir_node *pipeline, int pipe_in_fd, int pipe_out_fd);
+static int  eval_redirected(const struct ir_node *rs);
+static int  eval_test_command(const struct ir_node *test);
+static int  eval_if_statement(const struct ir_node *if_node);
+static int  eval_for_statement(const struct ir_node *for_node);
+static int  eval_while_statement(const struct ir_node *while_node);
+static int  eval_arith_command(const struct ir_node *n);
+
+static int  plan_command_redirections(const struct ir_node *cmd, int in_fd, int out_fd, int err_fd,
+                                      struct spawn_plan *plan, int *stderr_fd);
+static int  run_builtin(const struct builtin *b, const struct ir_node *cmd, int argc, char **argv,
+                        int in_fd, int out_fd);
+static void exec_argv_in_child(int argc, char **argv);
+static void exec_argv_redirected(const struct ir_node *cmd, int argc, char **argv);
+static bool words_have_effects(const struct ir_node *cmd);
 
 
 static int last_status = 0; // [020]
 
+/* break N and continue N do not jump: they set unwind to N, every list
+   being run returns early while it is set, and each loop on the way out
+   takes one off; see leave_loop(). */
+static int loop_depth;          /* loops currently running */
+static int unwind;              /* loops still to be left */
+static bool unwind_continue;    /* ... and the last one continues */
+
 static void
 usage(char *progname)
 {
@@ -132,50 +139,148 @@ struct job {
     enum job_status status;  /* Job status. */ 
     int  num_processes_alive;   /* The number of processes that we know to be alive */
 
-    /* Add additional fields here as needed. */
+    pid_t last_pid;          /* the last process of the pipeline, which sets $? */
+    int last_status;         /* its waitpid() status, once it has terminated */
+    char *cmdline;           /* background jobs: the command, for jobs */
 };
 
+/* A process we started, found by pid when it changes state.  Entries
+ * live in a tommy_hashlin, which grows incrementally, so a SIGCHLD costs
+ * O(1) per reaped child however many processes are around. */
+struct process {
+    tommy_node node;         /* Link element for pid2proc. */
+    pid_t pid;
+    struct job *job;
+};
+
+static tommy_hashlin pid2proc;
+
+static int bg_running;      /* background jobs with processes left */
+static bool interactive;    /* reading commands from a terminal */
+
 /* Utility functions for job list management.
  * We use 2 data structures: 
- * (a) an array jid2job to quickly find a job based on its id
+ * (a) a table jid2job to quickly find a job based on its id
  * (b) a linked list to support iteration
+ *
+ * The table grows with the highest jid in use.  Free jids are found
+ * with a two-level bitmap: bit j of jid_used[] is set when jid j is
+ * taken, and bit w of jid_full[] when word w of jid_used[] has no free
+ * bit left, so the lowest free jid is two count-trailing-zeros away.
  */
 #define MAXJOBS (1<<16)
 static struct list job_list;
 
-static struct job *jid2job[MAXJOBS];
+static struct job **jid2job;    /* jid2job[jid] for 0 < jid < jid_cap */
+static size_t jid_cap;          /* a multiple of 64 */
+static uint64_t *jid_used;      /* jid_cap / 64 words */
+static uint64_t *jid_full;      /* one bit per word of jid_used */
 
 /* Return job corresponding to jid */
 static struct job *
 get_job_from_jid(int jid)
 {
-    if (jid > 0 && jid < MAXJOBS && jid2job[jid] != NULL)
+    if (jid > 0 && (size_t)jid < jid_cap && jid2job[jid] != NULL)
         return jid2job[jid];
 
     return NULL;
 }
 
+static void
+jid_mark(size_t jid, bool used)
+{
+    size_t w = jid / 64;
+    uint64_t bit = 1ULL << (jid % 64);
+    uint64_t wbit = 1ULL << (w % 64);
+
+    if (used)
+        jid_used[w] |= bit;
+    else
+        jid_used[w] &= ~bit;
+    if (jid_used[w] == UINT64_MAX)
+        jid_full[w / 64] |= wbit;
+    else
+        jid_full[w / 64] &= ~wbit;
+}
+
+/* Double the table; the new jids are all free. */
+static void
+jid_grow(void)
+{
+    size_t ncap = jid_cap ? 2 * jid_cap : 64;
+    size_t owords = jid_cap / 64, nwords = ncap / 64;
+    size_t ofull = (owords + 63) / 64, nfull = (nwords + 63) / 64;
+
+    jid2job = realloc(jid2job, ncap * sizeof *jid2job);
+    jid_used = realloc(jid_used, nwords * sizeof *jid_used);
+    jid_full = realloc(jid_full, nfull * sizeof *jid_full);
+    if (!jid2job || !jid_used || !jid_full)
+        utils_fatal_error("minibash: out of memory");
+    memset(jid2job + jid_cap, 0, (ncap - jid_cap) * sizeof *jid2job);
+    memset(jid_used + owords, 0, (nwords - owords) * sizeof *jid_used);
+    memset(jid_full + ofull, 0, (nfull - ofull) * sizeof *jid_full);
+
+    bool first = jid_cap == 0;
+    jid_cap = ncap;
+    if (first)
+        jid_mark(0, true);      /* jid 0 is never handed out */
+}
+
+/* Return the lowest free jid and mark it used, or -1 if MAXJOBS are in use. */
+static int
+jid_alloc(void)
+{
+    size_t nwords = jid_cap / 64;
+    for (size_t k = 0; k * 64 < nwords; k++) {
+        if (jid_full[k] == UINT64_MAX)
+            continue;
+        size_t w = k * 64 + (size_t)__builtin_ctzll(~jid_full[k]);
+        if (w >= nwords)
+            break;
+        size_t jid = w * 64 + (size_t)__builtin_ctzll(~jid_used[w]);
+        jid_mark(jid, true);
+        return (int)jid;
+    }
+
+    /* every jid below jid_cap is taken */
+    if (jid_cap >= MAXJOBS)
+        return -1;
+    jid_grow();
+    return jid_alloc();
+}
+
+static void purge_finished_jobs(void);
+
 /* Allocate a new job, optionally adding it to the job list. */
 static struct job *
 allocate_job(bool includeinjoblist)
 {
     struct job * job = malloc(sizeof *job);
+    if (job == NULL)
+        utils_fatal_error("minibash: out of memory");
+    job->status = FOREGROUND;
     job->num_processes_alive = 0;
+    job->last_pid = -1;
+    job->last_status = 0;
     job->jid = -1;
+    job->cmdline = NULL;
     if (!includeinjoblist)
         return job;
 
-    list_push_back(&job_list, &job->elem);
-    for (int i = 1; i < MAXJOBS; i++) {
-        if (jid2job[i] == NULL) {
-            jid2job[i] = job;
-            job->jid = i;
-            return job;
-        }
+    int jid = jid_alloc();
+    if (jid < 0) {
+        /* make room by forgetting jobs nobody has waited for */
+        purge_finished_jobs();
+        jid = jid_alloc();
     }
-    fprintf(stderr, "Maximum number of jobs exceeded\n");
-    abort();
-    return NULL;
+    if (jid < 0) {
+        fprintf(stderr, "Maximum number of jobs exceeded\n");
+        abort();
+    }
+    list_push_back(&job_list, &job->elem);
+    jid2job[jid] = job;
+    job->jid = jid;
+    return job;
 }
 
 /* Delete a job.
@@ -191,56 +296,123 @@ delete_job(struct job *job, bool removeFromJobList)
         assert(jid2job[jid] == job);
         jid2job[jid]->jid = -1;
         jid2job[jid] = NULL;
+        jid_mark((size_t)jid, false);
+        list_remove(&job->elem);
     } else {
         assert(job->jid == -1);
     }
     /* add any other job cleanup here. */
+    free(job->cmdline);
     free(job);
 }
 
+/* In a forked child that goes on to run shell code: the jobs of the
+   parent are not its children. */
+static void
+forget_jobs(void)
+{
+    tommy_hashlin_foreach(&pid2proc, free);
+    tommy_hashlin_done(&pid2proc);
+    tommy_hashlin_init(&pid2proc);
+    while (!list_empty(&job_list))
+        delete_job(list_entry(list_front(&job_list), struct job, elem), true);
+    bg_running = 0;
+}
+
+/* Forget the background jobs whose processes have all terminated. */
+static void
+purge_finished_jobs(void)
+{
+    struct list_elem *e = list_begin(&job_list);
+    while (e != list_end(&job_list)) {
+        struct job *job = list_entry(e, struct job, elem);
+        e = list_next(e);
+        if (job->num_processes_alive == 0)
+            delete_job(job, true);
+    }
+}
+
+/* Convert a waitpid() status to a shell exit status. */
+static int
+exit_status(int st)
+{
+    if (WIFEXITED(st))   return WEXITSTATUS(st);
+    if (WIFSIGNALED(st)) return 128 + WTERMSIG(st);
+    return 1;
+}
+
+static int
+process_cmp(const void *arg, const void *obj)
+{
+    return *(const pid_t *)arg != ((const struct process *)obj)->pid;
+}
+
+static struct process *
+find_process(pid_t pid)
+{
+    return tommy_hashlin_search(&pid2proc, process_cmp, &pid, tommy_inthash_u32((uint32_t)pid));
+}
+
+/* Record that pid belongs to job.  Processes must be added in pipeline
+ * order; the last one added decides the job's exit status. */
+static void
+add_process(struct job *job, pid_t pid)
+{
+    struct process *p = malloc(sizeof *p);
+    if (p == NULL)
+        utils_fatal_error("minibash: out of memory");
+    p->pid = pid;
+    p->job = job;
+    tommy_hashlin_insert(&pid2proc, &p->node, p, tommy_inthash_u32((uint32_t)pid));
+    job->num_processes_alive++;
+    job->last_pid = pid;
+    redir_cache_drop();     /* it may remove or rename what we keep open */
+}
+
 
 /*
- * Suggested SIGCHLD handler.
- *
- * Call waitpid() to learn about any child processes that
- * have exited or changed status (been stopped, needed the
- * terminal, etc.)
- * Just record the information by updating the job list
- * data structures.  Since the call may be spurious (e.g.
- * an already pending SIGCHLD is delivered even though
- * a foreground process was already reaped), ignore when
- * waitpid returns -1.
- * Use a loop with WNOHANG since only a single SIGCHLD 
- * signal may be delivered for multiple children that have 
- * exited. All of them need to be reaped.
+ * Reap every child that has exited or stopped and record it in the
+ * job list.  This is the event loop's SIGCHLD callback and the first
+ * step of each round of wait_for_job.  SIGCHLD is never handled
+ * asynchronously (see events.h), so there are no races with other
+ * code that looks at the job list.
+ * Use a loop with WNOHANG since only a single SIGCHLD
+ * may be pending for multiple children that have exited.
  */
 static void
-sigchld_handler(int sig, siginfo_t *info, void *_ctxt)
+reap_children(void)
 {
     pid_t child;
     int status;
 
-    assert(sig == SIGCHLD);
-
-    while ((child = waitpid(-1, &status, WUNTRACED|WNOHANG)) > 0) {
+    while ((child = waitpid(-1, &status, WUNTRACED|WCONTINUED|WNOHANG)) > 0) {
         handle_child_status(child, status);
     }
 }
 
+/* Run the event loop until done(arg) holds. */
+static void
+wait_until(bool (*done)(void *arg), void *arg)
+{
+    for (;;) {
+        /* children that exited already are reaped without a trip
+           through epoll for their pending SIGCHLD */
+        reap_children();
+        if (done(arg))
+            break;
+        io_flush();     /* show what was printed before going to sleep */
+        events_wait(-1);
+    }
+}
+
 /* Wait for all processes in this job to complete, or for
  * the job no longer to be in the foreground.
  *
- * You should call this function from where you wait for
- * jobs started without the &; you would only use this function
- * if you were to implement the 'fg' command (job control only).
- * 
- * Implement handle_child_status such that it records the 
- * information obtained from waitpid() for pid 'child.'
+ * The shell sleeps in events_wait(), so input or pipes registered
+ * with the event loop keep being served while it waits; the job's
+ * children are reaped through its SIGCHLD callback.
  *
- * If a process exited, it must find the job to which it
- * belongs and decrement num_processes_alive.
- *
- * However, note that it is not safe to call delete_job
+ * Note that it is not safe to call delete_job
  * in handle_child_status because wait_for_job assumes that
  * even jobs with no more num_processes_alive haven't been
  * deallocated.  You should postpone deleting completed
@@ -251,1144 +423,1430 @@ sigchld_handler(int sig, siginfo_t *info, void *_ctxt)
  * and `job->num_processes_alive` having been set to the number of
  * processes successfully forked for this job.
  */
+static bool
+job_left_foreground(void *arg)
+{
+    struct job *job = arg;
+    return job->status != FOREGROUND || job->num_processes_alive == 0;
+}
+
 static void
 wait_for_job(struct job *job)
 {
-    assert(signal_is_blocked(SIGCHLD));
-
-    while (job->status == FOREGROUND && job->num_processes_alive > 0) {
-        int status;
-
-        pid_t child = waitpid(-1, &status, WUNTRACED);
-
-        // When called here, any error returned by waitpid indicates a logic
-        // bug in the shell.
-        // In particular, ECHILD "No child process" means that there has
-        // already been a successful waitpid() call that reaped the child, so
-        // there's likely a bug in handle_child_status where it failed to update
-        // the "job" status and/or num_processes_alive fields in the required
-        // fashion.
-        // Since SIGCHLD is blocked, there cannot be races where a child's exit
-        // was handled via the SIGCHLD signal handler.
-        if (child != -1)
-            handle_child_status(child, status);
-        else
-            utils_fatal_error("waitpid failed, see code for explanation");
-    }
+    wait_until(job_left_foreground, job);
 }
 
 
 static void
 handle_child_status(pid_t pid, int status)
 {
-    assert(signal_is_blocked(SIGCHLD));
-
-    /* To be implemented. 
-     * Step 1. Given the pid, determine which job this pid is a part of
-     *         (how to do this is not part of the provided code.)
-     * Step 2. Determine what status change occurred using the
-     *         WIF*() macros.
-     * Step 3. Update the job status accordingly, and adjust 
-     *         num_processes_alive if appropriate.
-     *         If a process was stopped, save the terminal state.
-     */
-
-}
-
-// NEW: handle a single NAME=VALUE statement (032 only: plain word value)
-static void handle_variable_assignment(TSNode assign_node) {            // [032]
-    // Prefer grammar fields; fall back to first/second named child.
-    TSNode varn = ts_node_child_by_field_id(assign_node, variableId);   // [032]
-    TSNode valn = ts_node_child_by_field_id(assign_node, valueId);      // [032]
-    if (ts_node_is_null(varn)) varn = ts_node_named_child(assign_node, 0); // [032]
-    if (ts_node_is_null(valn)) valn = ts_node_named_child(assign_node, 1); // [032]
-
-    char *vname = ts_extract_node_text(input, varn);                    // [032]
-    char *vval  = ts_node_is_null(valn) ? strdup("")                    // [032]
-                                        : ts_extract_node_text(input, valn); // [032]
-    if (vname && vval) {
-        /* Minimal for 032: set in process env so echo $VAR sees it.     */
-        /* (We can switch to shell_vars later if a test requires it.)    */
-        setenv(vname, vval, 1);                                         // [032]
-    }
-    free(vname);                                                         // [032]
-    free(vval);                                                          // [032]
-    last_status = 0;                                                     // [032]
-}
-  
-
-
-// NEW: grow-and-append helper to avoid macro pitfalls. Returns 0 on success, -1 on OOM.  // [fix]
-static int append_bytes(char **out, size_t *len, size_t *cap, const char *src, size_t nbytes) { // [fix]
-    if (!src || nbytes == 0) return 0;                                                   // [fix]
-    if (*len + nbytes + 1 > *cap) {                                                      // [fix]
-        size_t newcap = *cap ? *cap : 64;                                                // [fix]
-        while (*len + nbytes + 1 > newcap) newcap *= 2;                                   // [fix]
-        char *tmp = realloc(*out, newcap);                                               // [fix]
-        if (!tmp) return -1;                                                             // [fix]
-        *out = tmp;                                                                       // [fix]
-        *cap = newcap;                                                                    // [fix]
-    }                                                                                    // [fix]
-    memcpy(*out + *len, src, nbytes);                                                    // [fix]
-    *len += nbytes;                                                                       // [fix]
-    (*out)[*len] = '\0';                                                                  // [fix]
-    return 0;                                                                             // [fix]
-}                                                                                        // [fix]
-
-static void handle_command(TSNode command_node) {
-    int argc = 0;
-    int err  = EXPAND_OK;
-
-    /* Build argv with full expansion. */
-    char **argv = expand_to_argv(command_node, input, last_status, &argc, &err);
-    if (!argv || argc == 0 || !argv[0]) {
-        /* Nothing to run or expansion failed. Choose status policy. */
-        last_status = 1;
-        if (argv) free_argv(argv);
+    /* Children we do not track, such as those of $(...), are waited
+     * for by whoever started them. */
+    struct process *p = find_process(pid);
+    if (p == NULL) {
+        (void)expand_subst_reaped(pid, status);
         return;
     }
-
-    /* Builtin: echo (already expanded) */
-    if (strcmp(argv[0], "echo") == 0) {
-        /* Print argv[1..] separated by a single space; trailing newline. */
-        for (int i = 1; i < argc; i++) {
-            if (i > 1) fputc(' ', stdout);
-            fputs(argv[i], stdout);
-        }
-        fputc('\n', stdout);
-        free_argv(argv);
-        last_status = 0;
+    struct job *job = p->job;
+
+    /* Without job control a stopped foreground job is simply waited
+     * for until it is continued and exits, as bash does in a script;
+     * only background jobs show as stopped. */
+    if (WIFSTOPPED(status)) {
+        if (job->status == BACKGROUND)
+            job->status = STOPPED;
         return;
     }
-
-    if (strcmp(argv[0], ":") == 0) {
-        free_argv(argv);
-        last_status = 0;
+    if (WIFCONTINUED(status)) {
+        if (job->status == STOPPED)
+            job->status = BACKGROUND;
         return;
     }
+    if (!WIFEXITED(status) && !WIFSIGNALED(status))
+        return;
 
-    /* External command */
-    pid_t pid = fork();
-    if (pid == 0) {
-        /* child */
-        if (strchr(argv[0], '/') == NULL) {
-            execvp(argv[0], argv);
-        } else {
-            execv(argv[0], argv);
-        }
-        _exit(127); /* exec failed */
-    }
-
-    /* parent */
-    int st = 0;
-    (void)waitpid(pid, &st, 0);
-    if (WIFEXITED(st))        last_status = WEXITSTATUS(st);
-    else if (WIFSIGNALED(st)) last_status = 128 + WTERMSIG(st);
-    else                      last_status = 1;
+    if (pid == job->last_pid)
+        job->last_status = status;
+    tommy_hashlin_remove_existing(&pid2proc, &p->node);
+    free(p);
 
-    free_argv(argv);
+    if (--job->num_processes_alive == 0) {
+        if (job->jid != -1)
+            bg_running--;
+        job->status = WIFSIGNALED(job->last_status) ? TERMINATED_VIA_SIGNAL
+                                                    : TERMINATED_VIA_EXIT;
+    }
 }
 
+/* Wait for a job started in the foreground and release it.  Returns
+ * the shell status of its last process. */
+static int
+wait_for_foreground_job(struct job *job)
+{
+    if (job->num_processes_alive > 0)
+        wait_for_job(job);
+    int status = exit_status(job->last_status);
+    delete_job(job, false);
+    return status;
+}
 
-
-static int collect_pipeline_commands(TSNode pipeline, TSNode **out_cmds) {
-    int total_named = (int) ts_node_named_child_count(pipeline);
-
-    int ncmds = 0;
-    for (int i = 0; i < total_named; i++) {
-        TSNode ch = ts_node_named_child(pipeline, (uint32_t)i);
-        if (ts_node_symbol(ch) == sym_command)
-            ncmds++;
-    }
-
-    if (ncmds == 0) {
-        *out_cmds = NULL;
-        DBG("[COLLECT] ncmds=0\n");
-        return 0;
+/* The exit builtin: leave the shell with the given status, or with $?. */
+int builtin_exit(int argc, char **argv, io_ctx *io) {
+    int status = last_status;
+    if (argc > 2) {
+        io_errorf(io, "exit: too many arguments\n");
+        return 1;
     }
-
-    TSNode *cmds = malloc((size_t)ncmds * sizeof *cmds);
-    if (!cmds) {
-        *out_cmds = NULL;
-        return -1;
+    if (argc == 2) {
+        char *end;
+        long v = strtol(argv[1], &end, 10);
+        if (argv[1][0] == '\0' || *end != '\0') {
+            io_errorf(io, "exit: %s: numeric argument required\n", argv[1]);
+            v = 2;
+        }
+        status = (int)(v & 0xff);
     }
+    io_flush();
+    exit(status);
+}
 
-    int j = 0;
-    for (int i = 0; i < total_named; i++) {
-        TSNode ch = ts_node_named_child(pipeline, (uint32_t)i);
-        if (ts_node_symbol(ch) == sym_command)
-            cmds[j++] = ch;
-    }
+/* ======== BACKGROUND JOBS ======== */
 
-    *out_cmds = cmds;
-    DBG("[COLLECT] ncmds=%d\n", ncmds);
-    return ncmds;
+/* The MINIBASH_MAX_JOBS cap on running background jobs, 0 if none. */
+static int
+max_background_jobs(void)
+{
+    const char *v = vars_get("MINIBASH_MAX_JOBS");
+    if (v == NULL)
+        return 0;
+    long n = strtol(v, NULL, 10);
+    return n > 0 && n < MAXJOBS ? (int)n : 0;
 }
 
-static char **build_argv_words_only(TSNode command, char *input) {
-    TSNode name_node = ts_node_child_by_field_id(command, nameId);
-    if (ts_node_is_null(name_node)) return NULL;
+static bool
+job_slot_free(void *arg)
+{
+    return bg_running < *(int *)arg;
+}
 
-    TSNode name_word = ts_node_named_child(name_node, 0);
-    if (ts_node_is_null(name_word) || ts_node_symbol(name_word) != sym_word)
-        return NULL;
+static void
+background_job_started(struct job *job, const struct ir_node *n)
+{
+    job->status = BACKGROUND;
+    if (n->text)
+        job->cmdline = strdup(n->text);
+    bg_running++;
+
+    char pid[16];
+    snprintf(pid, sizeof pid, "%d", (int)job->last_pid);
+    vars_set("!", pid);
+    if (interactive)
+        fprintf(stderr, "[%d] %s\n", job->jid, pid);
+}
 
-    uint32_t named = ts_node_named_child_count(command);
-    int argc = 1;  // program name
-    for (uint32_t i = 0; i < named; i++) {
-        TSNode ch = ts_node_named_child(command, i);
-        if (ts_node_symbol(ch) == sym_word)
-            argc++;
+/* Start n, which was followed by &, and return without waiting for it.
+ * A simple external command is spawned directly; anything else runs in
+ * a forked copy of the shell.  Background jobs read from /dev/null, as
+ * in bash when job control is off.  With MINIBASH_MAX_JOBS set, wait
+ * here until fewer than that many are running. */
+static int
+run_background(const struct ir_node *n)
+{
+    int cap = max_background_jobs();
+    if (cap > 0)
+        wait_until(job_slot_free, &cap);
+
+    int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    last_status = 0;
+    io_flush();
+
+    /* A simple command is expanded here, once, and spawned if it can be;
+       the child forked otherwise reuses the argv.  Unless expanding it
+       could assign a variable: that belongs in the child alone. */
+    struct arena_mark mark = arena_mark(&cmd_arena);
+    char **argv = NULL;
+    int argc = 0, err = EXPAND_OK;
+    if (n->kind == IR_COMMAND && n->nwords > 0 && devnull >= 0 && !words_have_effects(n)) {
+        argv = expand_argv(&cmd_arena, n->words, n->nwords, last_status, &argc, &err);
+        pid_t pid = -1;
+        bool spawned = false;
+        if (err == EXPAND_OK && argc > 0 && argv[0] && !builtin_lookup(argv[0])) {
+            struct spawn_plan plan;
+            if (spawn_plan_init(&plan) == 0) {
+                /* a failed spawn is left to the child below to report */
+                spawned = plan_command_redirections(n, devnull, -1, -1, &plan, NULL) == 0
+                          && spawn_command(argv, &plan, &pid) == 0;
+                spawn_plan_destroy(&plan);
+            }
+        }
+        if (spawned) {
+            arena_reset(&cmd_arena, mark);
+            close(devnull);
+            struct job *job = allocate_job(true);
+            add_process(job, pid);
+            background_job_started(job, n);
+            return last_status;
+        }
     }
 
-    char **argv = calloc((size_t)argc + 1, sizeof *argv);
-    if (!argv) return NULL;
-
-    argv[0] = ts_extract_node_text(input, name_word);
-    if (!argv[0]) { free(argv); return NULL; }
-
-    int k = 1;
-    for (uint32_t i = 0; i < named; i++) {
-        TSNode ch = ts_node_named_child(command, i);
-        if (ts_node_symbol(ch) != sym_word) continue;
-        char *w = ts_extract_node_text(input, ch);
-        if (!w) w = strdup("");
-        argv[k++] = w;
+    pid_t pid = fork();
+    if (pid == 0) {
+        forget_jobs();
+        if (devnull >= 0)
+            dup2(devnull, STDIN_FILENO);
+        stdout_capture = NULL;
+        if (argv) {
+            if (err != EXPAND_OK)
+                _exit(1);
+            if (argc == 0 || !argv[0])
+                _exit(127);
+            exec_argv_redirected(n, argc, argv);
+        }
+        eval_node(n);
+        io_flush();
+        _exit(last_status);
     }
-    argv[k] = NULL;
-
-#if MB_DEBUG
-    for (int a = 0; argv[a]; a++)
-        DBG("[ARGV] argv[%d] = '%s'\n", a, argv[a]);
-#endif
+    arena_reset(&cmd_arena, mark);
+    if (devnull >= 0)
+        close(devnull);
+    if (pid < 0) {
+        utils_error("minibash: fork: ");
+        last_status = 1;
+        return last_status;
+    }
+    struct job *job = allocate_job(true);
+    add_process(job, pid);
+    background_job_started(job, n);
+    return last_status;
+}
 
-    return argv;
+/* Print one line of jobs output for job.  marker is '+' for the current
+   job, '-' for the previous one. */
+static void
+print_job(io_ctx *io, struct job *job, char marker, bool with_pid)
+{
+    char state[32];
+    if (job->num_processes_alive > 0)
+        snprintf(state, sizeof state, job->status == STOPPED ? "Stopped" : "Running");
+    else if (WIFSIGNALED(job->last_status))
+        snprintf(state, sizeof state, "%s", strsignal(WTERMSIG(job->last_status)));
+    else if (exit_status(job->last_status) != 0)
+        snprintf(state, sizeof state, "Exit %d", exit_status(job->last_status));
+    else
+        snprintf(state, sizeof state, "Done");
+
+    io_printf(io, "[%d]%c ", job->jid, marker);
+    if (with_pid)
+        io_printf(io, "%d ", (int)job->last_pid);
+    io_printf(io, " %-24s%s%s\n", state, job->cmdline ? job->cmdline : "",
+              job->num_processes_alive > 0 ? " &" : "");
 }
 
+/* Which jobs a listing shows. */
+enum job_filter {
+    JOBS_ALL,
+    JOBS_DONE,          /* terminated: the notice before a prompt */
+    JOBS_RUNNING,       /* jobs -r */
+    JOBS_STOPPED,       /* jobs -s */
+};
 
-static void handle_pipeline(TSNode pipeline_node) {
-    TSNode *cmds = NULL;
-    int ncmds = collect_pipeline_commands(pipeline_node, &cmds);
-    if (ncmds <= 0) return;
+static bool
+job_shown(const struct job *job, enum job_filter which)
+{
+    bool alive = job->num_processes_alive > 0;
+    switch (which) {
+    case JOBS_DONE:     return !alive;
+    case JOBS_RUNNING:  return alive && job->status != STOPPED;
+    case JOBS_STOPPED:  return alive && job->status == STOPPED;
+    default:            return true;
+    }
+}
 
-    char ***argvs = calloc((size_t)ncmds, sizeof *argvs);
-    if (!argvs) { free(cmds); return; }
+/* Print the jobs of the job list that pass which. */
+static void
+report_jobs(io_ctx *io, enum job_filter which, bool with_pid)
+{
+    struct list_elem *cur = list_empty(&job_list) ? NULL : list_back(&job_list);
+    struct list_elem *prev = cur && cur != list_front(&job_list) ? list_prev(cur) : NULL;
 
-    for (int i = 0; i < ncmds; i++) {
-        argvs[i] = build_argv_words_only(cmds[i], input);
-        if (!argvs[i] || !argvs[i][0]) {
-            for (int j = 0; j <= i; j++) free_argv(argvs[j]);
-            free(argvs);
-            free(cmds);
-            return;
-        }
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e)) {
+        struct job *job = list_entry(e, struct job, elem);
+        if (job_shown(job, which))
+            print_job(io, job, e == cur ? '+' : e == prev ? '-' : ' ', with_pid);
     }
+}
 
-    int (*pipes)[2] = NULL;
-    if (ncmds > 1) {
-        pipes = calloc((size_t)(ncmds - 1), sizeof *pipes);
-        if (!pipes) {
-            for (int i = 0; i < ncmds; i++) free_argv(argvs[i]);
-            free(argvs); free(cmds);
-            return;
+/* jobs [-lprs]: list background jobs, then forget those reported as
+   terminated.  jobs only writes output, so `jobs | wc -l` and $(jobs)
+   run it in the shell; their output is captured, and as in the
+   subshell bash would use, the table is left alone. */
+int builtin_jobs(int argc, char **argv, io_ctx *io) {
+    bool with_pid = false, pids_only = false;
+    enum job_filter which = JOBS_ALL;
+    for (int i = 1; i < argc; i++) {
+        const char *o = argv[i];
+        if (o[0] != '-' || o[1] == '\0') {
+            io_errorf(io, "jobs: %s: invalid option\n", argv[i]);
+            return 2;
         }
-        for (int i = 0; i < ncmds - 1; i++) {
-            if (pipe(pipes[i]) != 0) {
-                for (int j = 0; j < i; j++) { close(pipes[j][0]); close(pipes[j][1]); }
-                for (int k = 0; k < ncmds; k++) free_argv(argvs[k]);
-                free(pipes); free(argvs); free(cmds);
-                return;
+        while (*++o) {
+            switch (*o) {
+            case 'l': with_pid = true; break;
+            case 'p': pids_only = true; break;
+            case 'r': which = JOBS_RUNNING; break;
+            case 's': which = JOBS_STOPPED; break;
+            default:
+                io_errorf(io, "jobs: -%c: invalid option\n", *o);
+                return 2;
             }
         }
     }
 
-    pid_t *pids = calloc((size_t)ncmds, sizeof *pids);
-    if (!pids) {
-        if (pipes) {
-            for (int i = 0; i < ncmds - 1; i++) { close(pipes[i][0]); close(pipes[i][1]); }
-            free(pipes);
+    reap_children();
+    if (pids_only) {
+        for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e)) {
+            struct job *job = list_entry(e, struct job, elem);
+            if (job_shown(job, which))
+                io_printf(io, "%d\n", (int)job->last_pid);
         }
-        for (int i = 0; i < ncmds; i++) free_argv(argvs[i]);
-        free(argvs); free(cmds);
-        return;
+    } else {
+        report_jobs(io, which, with_pid);
     }
+    if (!io->capture)
+        purge_finished_jobs();
+    return 0;
+}
 
-    for (int i = 0; i < ncmds; i++) {
-        pid_t pid = fork();
-        if (pid == 0) {
-            if (i > 0)          dup2(pipes[i-1][0], STDIN_FILENO);
-            if (i < ncmds - 1)  dup2(pipes[i][1], STDOUT_FILENO);
-            if (pipes) {
-                for (int j = 0; j < ncmds - 1; j++) { close(pipes[j][0]); close(pipes[j][1]); }
-            }
-            execvp(argvs[i][0], argvs[i]);
-            _exit(127);
-        } else if (pid > 0) {
-            pids[i] = pid;
-        } else {
-            /* fork failed: best-effort cleanup */
-        }
+/* Find the background job named by a wait/jobs operand: %N or a pid. */
+static struct job *
+find_job(const char *spec)
+{
+    char *end;
+    if (spec[0] == '%') {
+        long jid = strtol(spec + 1, &end, 10);
+        if (spec[1] == '\0' || *end != '\0' || jid <= 0 || jid >= MAXJOBS)
+            return NULL;
+        return get_job_from_jid((int)jid);
     }
 
-    if (pipes) {
-        for (int i = 0; i < ncmds - 1; i++) { close(pipes[i][0]); close(pipes[i][1]); }
-        free(pipes);
+    long pid = strtol(spec, &end, 10);
+    if (spec[0] == '\0' || *end != '\0' || pid <= 0)
+        return NULL;
+    struct process *p = find_process((pid_t)pid);
+    if (p && p->job->jid != -1)
+        return p->job;
+    /* terminated: the job remembers the status of its last process */
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e)) {
+        struct job *job = list_entry(e, struct job, elem);
+        if (job->last_pid == pid)
+            return job;
     }
+    return NULL;
+}
 
-    for (int i = 0; i < ncmds; i++) free_argv(argvs[i]);
-    free(argvs);
+static bool
+job_terminated(void *arg)
+{
+    return ((struct job *)arg)->num_processes_alive == 0;
+}
+
+static bool
+no_background_running(void *arg)
+{
+    return bg_running == 0;
+}
+
+/* For wait -n: the candidate jobs, NULL where an operand named none. */
+struct wait_any {
+    struct job **jobs;
+    int n;
+    struct job *done;           /* set once one of them has terminated */
+};
 
-    for (int i = 0; i < ncmds; i++) {
-        int st;
-        (void)waitpid(pids[i], &st, 0);
-        if (i == ncmds - 1) {
-            if (WIFEXITED(st)) last_status = WEXITSTATUS(st);
-            else if (WIFSIGNALED(st)) last_status = 128 + WTERMSIG(st);
-            else last_status = 1;
+static bool
+any_job_terminated(void *arg)
+{
+    struct wait_any *w = arg;
+    if (w->jobs == NULL) {
+        for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e)) {
+            struct job *job = list_entry(e, struct job, elem);
+            if (job->num_processes_alive == 0) {
+                w->done = job;
+                return true;
+            }
+        }
+        return list_empty(&job_list);
+    }
+    for (int i = 0; i < w->n; i++) {
+        if (w->jobs[i] && w->jobs[i]->num_processes_alive == 0) {
+            w->done = w->jobs[i];
+            return true;
         }
     }
-    free(pids);
+    return false;
+}
 
-    /* FIX: free the cmds array we allocated */
-    free(cmds);
+/* Collect a terminated job: its status, which it is then forgotten. */
+static int
+reap_job(struct job *job)
+{
+    int status = exit_status(job->last_status);
+    delete_job(job, true);
+    return status;
 }
 
-/* Run a single command node assuming stdio is already set up (dup2 done).
-   This is used by pipeline children and by the fork in run_command_with_io(). */
-static void exec_command_in_child(TSNode command_node) {
-    /* apply per-command redirects first */
-    if (apply_command_redirections(command_node) != 0) {
-        /* flush stdio before exiting the child */
-        fflush(NULL);
-        _exit(1);
+/* wait [-n] [ID...]: wait for background jobs.  IDs are pids or %N.
+   Without IDs, wait waits for all of them and returns 0, and wait -n
+   for whichever terminates first (one that already has counts). */
+int builtin_wait(int argc, char **argv, io_ctx *io) {
+    bool any = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "-n") == 0) {
+            any = true;
+        } else if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else {
+            io_errorf(io, "wait: %s: invalid option\n", argv[i]);
+            return 2;
+        }
     }
 
-    int argc = 0, err = EXPAND_OK;
-    char **argv = expand_to_argv(command_node, input, last_status, &argc, &err);
-    if (!argv || argc == 0 || !argv[0]) {
-        /* nothing to exec (or expansion error) */
-        if (argv) free_argv(argv);
-        _exit(127);
-        return; /* not reached */
-    }
-
-    /* builtin: echo (args already expanded) */
-    if (strcmp(argv[0], "echo") == 0) {
-        for (int i = 1; i < argc; i++) {
-            if (i > 1) (void)!write(STDOUT_FILENO, " ", 1);
-            size_t L = strlen(argv[i]);
-            if (L) (void)!write(STDOUT_FILENO, argv[i], L);
+    struct job **jobs = NULL;
+    int njobs = argc - i, nfound = 0;
+    if (njobs > 0) {
+        jobs = arena_alloc(&cmd_arena, (size_t)njobs * sizeof *jobs);
+        for (int k = 0; k < njobs; k++) {
+            jobs[k] = find_job(argv[i + k]);
+            if (jobs[k] != NULL)
+                nfound++;
+            else if (argv[i + k][0] == '%')
+                io_errorf(io, "wait: %s: no such job\n", argv[i + k]);
+            else
+                io_errorf(io, "wait: pid %s is not a child of this shell\n", argv[i + k]);
         }
-        (void)!write(STDOUT_FILENO, "\n", 1);
-        free_argv(argv);
-        _exit(0);
     }
 
-     if (strcmp(argv[0], ":") == 0) {
-        free_argv(argv);
-        _exit(0);
+    if (any) {
+        struct wait_any w = { jobs, njobs, NULL };
+        if (jobs ? nfound == 0 : list_empty(&job_list))
+            return 127;
+        wait_until(any_job_terminated, &w);
+        return w.done ? reap_job(w.done) : 127;
     }
 
-
-    /* external */
-    if (strchr(argv[0], '/') == NULL) {
-        execvp(argv[0], argv);
-    } else {
-        execv(argv[0], argv);
+    if (jobs == NULL) {
+        wait_until(no_background_running, NULL);
+        purge_finished_jobs();
+        return 0;
     }
 
-    /* exec failed */
-    free_argv(argv);
-    fflush(NULL);
-    _exit(127);
-}
-
-/* Run a pipeline with optional overall in/out FDs (apply to first/last stage).
-   Uses words-only argv/exec for externals and builtin echo via exec_command_in_child. */
-static int run_pipeline_with_io(TSNode pipeline_node, int pipe_in_fd, int pipe_out_fd) {
-    TSNode *cmds = NULL;
-    int n = collect_pipeline_commands(pipeline_node, &cmds);
-    if (n <= 0) return 0;
-
-    int (*pipes)[2] = NULL;
-    if (n > 1) {
-        pipes = calloc((size_t)(n - 1), sizeof *pipes);
-        if (!pipes) { free(cmds); return 1; }
-        for (int i = 0; i < n - 1; i++) {
-            if (pipe(pipes[i]) != 0) {
-                for (int k = 0; k < i; k++) { close(pipes[k][0]); close(pipes[k][1]); }
-                free(pipes); free(cmds);
-                return 1;
-            }
+    /* $? is that of the last operand */
+    int status = 127;
+    for (int k = 0; k < njobs; k++) {
+        status = 127;
+        if (jobs[k] != NULL) {
+            wait_until(job_terminated, jobs[k]);
+            status = exit_status(jobs[k]->last_status);
         }
     }
-
-    pid_t *pids = calloc((size_t)n, sizeof *pids);
-    if (!pids) {
-        if (pipes) { for (int i = 0; i < n - 1; i++) { close(pipes[i][0]); close(pipes[i][1]); } free(pipes); }
-        free(cmds);
-        return 1;
+    for (int k = 0; k < njobs; k++) {
+        if (jobs[k] == NULL)
+            continue;
+        for (int m = k + 1; m < njobs; m++)     /* named twice */
+            if (jobs[m] == jobs[k])
+                jobs[m] = NULL;
+        delete_job(jobs[k], true);
     }
+    return status;
+}
 
-    for (int i = 0; i < n; i++) {
-        pid_t pid = fork();
-        if (pid == 0) {
-            DFD("[PL] child[%d] pid=%d\n", i, (int)getpid());
-
-            /* stdin */
-            if (i == 0) {
-                if (pipe_in_fd != -1) {
-                    DFD("[PL] stage0 dup2(%d->0)\n", pipe_in_fd);
-                    dup2(pipe_in_fd, STDIN_FILENO);
-                }
-            } else {
-                DFD("[PL] stage%d dup2(%d->0)\n", i, pipes[i-1][0]);
-                dup2(pipes[i-1][0], STDIN_FILENO);
-            }
+/* ======== PARALLEL LOOPS ======== */
 
-            /* stdout */
-            if (i == n - 1) {
-                if (pipe_out_fd != -1) {
-                    DFD("[PL] stageLast dup2(%d->1)\n", pipe_out_fd);
-                    dup2(pipe_out_fd, STDOUT_FILENO);
-                }
-            } else {
-                DFD("[PL] stage%d dup2(%d->1)\n", i, pipes[i][1]);
-                dup2(pipes[i][1], STDOUT_FILENO);
-            }
+/* One iteration of parallel_for. */
+struct pf_iter {
+    struct job *job;        /* while its worker runs */
+    int fd;                 /* -k: read end of its stdout, -1 once closed */
+    char *buf;              /* -k: output held back until its turn */
+    size_t len, cap;
+    bool done;
+};
 
-            /* close all pipe fds in child */
-            if (pipes) {
-                for (int j = 0; j < n - 1; j++) {
-                    close(pipes[j][0]); close(pipes[j][1]);
-                }
-            }
-            if (i == 0 && pipe_in_fd  != -1)  close(pipe_in_fd);
-            if (i == n-1 && pipe_out_fd != -1) close(pipe_out_fd);
+struct pf_loop {
+    struct pf_iter *iters;
+    int n, max;
+    int started, running;
+    int first_live;         /* iterations before this one are done */
+    int next_out;           /* -k: first iteration whose output is not all out */
+    int worst;              /* highest status of the iterations so far */
+    io_ctx *io;
+};
 
-            DFD("[PL] child[%d] fds wired, exec...\n", i);
-            exec_command_in_child(cmds[i]); /* never returns on success */
-            _exit(127);
-        }
-        pids[i] = pid;
+static void
+pf_read(int fd, uint32_t events, void *arg)
+{
+    struct pf_iter *it = arg;
+    if (it->cap - it->len < 4096) {
+        it->cap = it->cap ? 2 * it->cap : 16384;
+        it->buf = realloc(it->buf, it->cap);
+        if (!it->buf)
+            utils_fatal_error("minibash: out of memory");
     }
-
-    if (pipes) {
-        for (int i = 0; i < n - 1; i++) { close(pipes[i][0]); close(pipes[i][1]); }
-        free(pipes);
+    ssize_t r = read(fd, it->buf + it->len, it->cap - it->len);
+    if (r < 0 && errno == EINTR)
+        return;
+    if (r <= 0) {
+        events_del(fd);
+        close(fd);
+        it->fd = -1;
+        return;
     }
-    free(cmds);
+    it->len += (size_t)r;
+}
 
-    DBG("[PL] parent waiting for %d stages\n", n);
-    int st = 0;
-    for (int i = 0; i < n; i++) {
-        int cur = 0;
-        (void)waitpid(pids[i], &cur, 0);
-        DBG("[PL] waitpid pid=%d status=%d%s\n", (int)pids[i], cur, i==n-1 ? " (last)" : "");
-        if (i == n - 1) st = cur;
+/* Retire the iterations whose worker has exited and whose output is all
+   in, then pass on output in iteration order.  The oldest unfinished
+   iteration's output is passed on as it arrives. */
+static void
+pf_collect(struct pf_loop *l)
+{
+    for (int i = l->first_live; i < l->started; i++) {
+        struct pf_iter *it = &l->iters[i];
+        if (it->done || it->job->num_processes_alive > 0 || it->fd != -1)
+            continue;
+        int status = exit_status(it->job->last_status);
+        if (status > l->worst)
+            l->worst = status;
+        delete_job(it->job, false);
+        it->job = NULL;
+        it->done = true;
+        l->running--;
+    }
+    while (l->first_live < l->started && l->iters[l->first_live].done)
+        l->first_live++;
+
+    for (; l->next_out < l->started; l->next_out++) {
+        struct pf_iter *it = &l->iters[l->next_out];
+        if (it->len) {
+            io_write(l->io, it->buf, it->len);
+            it->len = 0;
+        }
+        if (!it->done)
+            break;
+        free(it->buf);
+        it->buf = NULL;
     }
-    free(pids);
+}
 
-    if (WIFEXITED(st))        last_status = WEXITSTATUS(st);
-    else if (WIFSIGNALED(st)) last_status = 128 + WTERMSIG(st);
-    else                      last_status = 1;
-    return last_status;
+static bool
+pf_slot_free(void *arg)
+{
+    struct pf_loop *l = arg;
+    pf_collect(l);
+    return l->running < l->max;
 }
 
-/* =========================
- * COMMAND EXECUTION HELPERS
- * ========================= */
+static bool
+pf_all_done(void *arg)
+{
+    struct pf_loop *l = arg;
+    pf_collect(l);
+    return l->running == 0;
+}
 
-/* Run a single command with optional in/out FDs.
-   Returns the command’s exit status (0..255) and updates last_status. */
-static int run_command_with_io(TSNode cmd, int in_fd, int out_fd) {
+/* Start iteration i: a forked worker binds the loop variable and runs
+   the body.  Returns false if no worker could be started. */
+static bool
+pf_start(struct pf_loop *l, int i, struct shell_var *var, const char *value,
+         const struct ir_node *body, bool ordered)
+{
+    struct pf_iter *it = &l->iters[i];
+    int fds[2] = { -1, -1 };
+    it->fd = -1;
+    if (ordered && pipe2(fds, O_CLOEXEC) != 0) {
+        utils_error("minibash: pipe: ");
+        return false;
+    }
+
+    io_flush();
     pid_t pid = fork();
     if (pid == 0) {
-        if (in_fd  != -1) dup2(in_fd,  STDIN_FILENO);
-        if (out_fd != -1) dup2(out_fd, STDOUT_FILENO);
-        exec_command_in_child(cmd);   /* never returns on success */
-        _exit(127);
+        forget_jobs();
+        if (l->io->in_fd != STDIN_FILENO)
+            dup2(l->io->in_fd, STDIN_FILENO);
+        if (ordered)
+            dup2(fds[1], STDOUT_FILENO);
+        else if (l->io->out_fd != STDOUT_FILENO)
+            dup2(l->io->out_fd, STDOUT_FILENO);
+        stdout_capture = NULL;
+        var_assign(var, value, strlen(value));
+        (void)eval_list(body);
+        io_flush();
+        _exit(last_status);
     }
-
-    int st = 0;
-    (void)waitpid(pid, &st, 0);
-    if (WIFEXITED(st))        last_status = WEXITSTATUS(st);
-    else if (WIFSIGNALED(st)) last_status = 128 + WTERMSIG(st);
-    else                      last_status = 1;
-    return last_status;
+    if (ordered)
+        close(fds[1]);
+    if (pid < 0) {
+        utils_error("minibash: fork: ");
+        if (ordered)
+            close(fds[0]);
+        return false;
+    }
+    if (ordered) {
+        it->fd = fds[0];
+        if (events_add(it->fd, EPOLLIN, pf_read, it) != 0)
+            utils_fatal_error("minibash: cannot watch worker output: ");
+    }
+    it->job = allocate_job(false);
+    add_process(it->job, pid);
+    l->started++;
+    l->running++;
+    return true;
 }
 
-/* ======== REDIRECTS FOR A SINGLE COMMAND (used inside pipeline/exec) ======== */
-/* Return 0 on success, -1 on error (prints a message and _exit(1) in child). */
-/* prototype goes near the top: static int apply_command_redirections(TSNode); */
-/* ======== REDIRECTS FOR A SINGLE COMMAND (used inside pipeline/exec) ======== */
-/* Return 0 on success, -1 on error (prints a message and _exit(1) in child). */
-static int apply_command_redirections(TSNode command_node) {
-    uint32_t n = ts_node_named_child_count(command_node);
-    for (uint32_t i = 0; i < n; i++) {
-        TSNode ch = ts_node_named_child(command_node, i);
-        if (ts_node_symbol(ch) != sym_file_redirect)
-            continue;
-
-        char *redir_txt = ts_extract_node_text(input, ch);
-        if (!redir_txt) redir_txt = strdup("");
-        const char *p = redir_txt;
-        while (*p == ' ' || *p == '\t') p++;
-        char op1 = *p;
-        char op2 = (p[0] && p[1]) ? p[1] : '\0';
-        int is_input  = (op1 == '<');
-        int is_append = (op1 == '>' && op2 == '>');
-
-        TSNode dest = ts_node_child_by_field_id(ch, destinationId);
-        char *path = ts_extract_node_text(input, dest);
-        if (!path) path = strdup("");
-
-        DBG("[CR] op='%c%c' path='%s'\n", op1, op2 ? op2 : ' ', path);
-
-        int fd = -1;
-        if (is_input) {
-            fd = open(path, O_RDONLY);
-            if (fd < 0) {
-                utils_error("minibash: cannot open for input: %s", path);
-                free(path); free(redir_txt);
-                return -1;
-            }
-            if (dup2(fd, STDIN_FILENO) < 0) {
-                close(fd); free(path); free(redir_txt);
-                return -1;
+/* parallel_for [-j N] [-k] NAME BODY [WORD...]
+ *
+ * Run the shell code BODY once for each WORD with NAME set to it, like
+ * a for loop, but each iteration in a forked worker and up to N of them
+ * at a time (default: the number of online CPUs).  Assignments made by
+ * BODY stay in its worker.  With -k each iteration's output is held
+ * back until the ones before it are done, so the output is that of the
+ * serial loop.  The status is the highest status of any iteration. */
+int builtin_parallel_for(int argc, char **argv, io_ctx *io) {
+    long max = sysconf(_SC_NPROCESSORS_ONLN);
+    bool ordered = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-k") == 0) {
+            ordered = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            char *end;
+            max = strtol(argv[++i], &end, 10);
+            if (argv[i][0] == '\0' || *end != '\0' || max < 1) {
+                io_errorf(io, "parallel_for: %s: invalid number of jobs\n", argv[i]);
+                return 2;
             }
-            DBG("[CR] dup2(%d -> STDIN) ok\n", fd);
-            close(fd);
+        } else if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
         } else {
-            int flags = O_WRONLY | O_CREAT | (is_append ? O_APPEND : O_TRUNC);
-            fd = open(path, flags, 0666);
-            if (fd < 0) {
-                utils_error("minibash: cannot open for output: %s", path);
-                free(path); free(redir_txt);
-                return -1;
-            }
-            if (dup2(fd, STDOUT_FILENO) < 0) {
-                close(fd); free(path); free(redir_txt);
-                return -1;
-            }
-            DBG("[CR] dup2(%d -> STDOUT) ok\n", fd);
-            close(fd);
+            io_errorf(io, "parallel_for: %s: invalid option\n", argv[i]);
+            return 2;
         }
-
-        free(path);
-        free(redir_txt);
     }
-    return 0;
-}
-
-
-static int eval_node_status(TSNode n) {
-    switch (ts_node_symbol(n)) {
-        case sym_command:
-            handle_command(n);
-            return last_status;
-
-        case sym_pipeline:
-            (void)run_pipeline_with_io(n, -1, -1);
-            return last_status;
-
-        case sym_redirected_statement:
-            handle_redirected_statement(n);
-            return last_status;
+    if (argc - i < 2) {
+        io_errorf(io, "parallel_for: usage: parallel_for [-j N] [-k] NAME BODY [WORD...]\n");
+        return 2;
+    }
+    const char *name = argv[i];
+    const char *src = argv[i + 1];
+    i += 2;
+
+    /* lowered once, run by every worker */
+    TSTree *tree = ts_parser_parse_string(parser, NULL, src, (uint32_t)strlen(src));
+    struct ir_program prog;
+    ir_lower(&prog, ts_tree_root_node(tree), src);
+    ts_tree_delete(tree);
 
-        case sym_else_clause: {
-            TSNode body = unwrap_else_body(n);
-            if (!ts_node_is_null(body))
-                return eval_node_status(body);  /* recurse into the real body */
-            last_status = 0;                    /* empty else: success */
-            return last_status;
+    struct pf_loop l = {
+        .n = argc - i,
+        .max = max < 1 ? 1 : max > MAXJOBS ? MAXJOBS : (int)max,
+        .io = io,
+    };
+    l.iters = arena_zalloc(&cmd_arena, (size_t)(l.n ? l.n : 1) * sizeof *l.iters);
+    struct shell_var *var = vars_intern(name);
+    for (int k = 0; k < l.n; k++) {
+        wait_until(pf_slot_free, &l);
+        if (!pf_start(&l, k, var, argv[i + k], &prog.root, ordered)) {
+            l.worst = l.worst > 1 ? l.worst : 1;
+            break;
         }
+    }
+    wait_until(pf_all_done, &l);
 
-        case sym_test_command:
-            return eval_test_command(n);
+    ir_free(&prog);
+    return l.worst;
+}
 
-        case sym_elif_clause: {
-            /* Should normally be handled inside eval_if_statement.
-               If we get here, just evaluate it like a mini if: first named child is test, second is body. */
-            uint32_t k = ts_node_named_child_count(n);
-            TSNode c = (k >= 1) ? ts_node_named_child(n, 0) : (TSNode){0};
-            TSNode b = (k >= 2) ? ts_node_named_child(n, 1) : (TSNode){0};
-            if (!ts_node_is_null(c)) (void)eval_node_status(c);
-            if (last_status == 0 && !ts_node_is_null(b)) (void)eval_node_status(b);
+/* NAME=VALUE [NAME=VALUE ...] without a command word. */
+static int assign_variables(const struct ir_node *cmd) {
+    struct arena_mark mark = arena_mark(&cmd_arena);
+    (void)expand_subst_status();
+    for (uint32_t i = 0; i < cmd->nassigns; i++) {
+        const struct ir_assign *a = &cmd->assigns[i];
+        int err = EXPAND_OK;
+        char *val = expand_word(&cmd_arena, &a->value, last_status, &err);
+        if (err == EXPAND_ARITH_FAIL || err == EXPAND_PARAM_FAIL) {
+            arena_reset(&cmd_arena, mark);
+            last_status = 1;
             return last_status;
         }
+        vars_set(a->name, val);
+    }
+    arena_reset(&cmd_arena, mark);
+
+    /* Redirections without a command still create/truncate their files. */
+    struct redir_plan plan;
+    redir_plan_init(&plan, -1, -1, -1);
+    int rc = redir_plan_add(&plan, cmd->redirs, cmd->nredirs, &cmd_arena, last_status);
+    redir_plan_release(&plan);
+    /* like bash, x=$(cmd) leaves cmd's status in $? */
+    int subst = expand_subst_status();
+    last_status = rc != 0 ? 1 : subst >= 0 ? subst : 0;
+    return last_status;
+}
 
-        case sym_variable_assignment:
-            /* Reuse the same handler you already use at top-level so that
-               assignments inside if/elif/else actually take effect. */
-            handle_variable_assignment(n);
-            return last_status;
-
-        case sym_list: {
-            uint32_t m = ts_node_named_child_count(n);
-            if (m == 0) { last_status = 0; return last_status; }
-
-            /* Evaluate the first chunk. */
-            TSNode prev = ts_node_named_child(n, 0);
-            int status = eval_node_status(prev);
-
-            /* Walk the rest, inspecting the operator text between prev and cur. */
-            for (uint32_t i = 1; i < m; i++) {
-                TSNode cur = ts_node_named_child(n, i);
-
-                uint32_t prev_end  = ts_node_end_byte(prev);
-                uint32_t cur_start = ts_node_start_byte(cur);
-                const char *seg    = input + prev_end;
-                size_t seglen      = (cur_start > prev_end) ? (size_t)(cur_start - prev_end) : 0;
-
-                /* Find the operator between prev and cur: &&, ||, ;, & (ignore whitespace/newlines). */
-                const char *p = seg, *pend = seg + seglen;
-                int is_and = 0, is_or = 0, is_semi = 0, is_bg = 0;
-                while (p < pend) {
-                    if (p + 1 < pend && p[0] == '&' && p[1] == '&') { is_and = 1; break; }
-                    if (p + 1 < pend && p[0] == '|' && p[1] == '|') { is_or  = 1; break; }
-                    if (*p == ';') { is_semi = 1; break; }
-                    if (*p == '&') { is_bg   = 1; break; }  /* not fully implemented here */
-                    p++;
-                }
-
-                /* Decide whether to run the right child based on the operator. */
-                int run_right = 1;
-                if (is_and)      run_right = (status == 0);
-                else if (is_or)  run_right = (status != 0);
-                else if (is_semi || is_bg) run_right = 1;  /* sequencing */
-
-                if (run_right) {
-                    status = eval_node_status(cur);
-                } else {
-                    /* short-circuited: keep previous status; skip cur */
-                }
-
-                prev = cur;
-            }
+/* Could expanding cmd's words assign a variable or leave the shell? */
+static bool
+words_have_effects(const struct ir_node *cmd)
+{
+    for (uint32_t i = 0; i < cmd->nwords; i++)
+        if (expand_has_effects(&cmd->words[i]))
+            return true;
+    return false;
+}
 
-            last_status = status;
-            return last_status;
-        }
+/* Apply cmd's redirections in a forked child and run its already
+   expanded argv.  Never returns. */
+static void
+exec_argv_redirected(const struct ir_node *cmd, int argc, char **argv)
+{
+    struct redir_plan plan;
+    redir_plan_init(&plan, -1, -1, -1);
+    if (redir_plan_add(&plan, cmd->redirs, cmd->nredirs, &cmd_arena, last_status) != 0
+        || redir_plan_apply(&plan, NULL) != 0)
+        _exit(1);
+    exec_argv_in_child(argc, argv);
+}
 
-#ifdef sym_do_group
-    case sym_do_group: {
-        uint32_t m = ts_node_named_child_count(n);
-        int status = 0;
-        for (uint32_t i = 0; i < m; i++) {
-            TSNode ch = ts_node_named_child(n, i);
-            status = eval_node_status(ch);
-        }
-        last_status = status;
-        return last_status;
+/* Run an already expanded argv in a forked child.  Never returns. */
+static void exec_argv_in_child(int argc, char **argv) {
+    const struct builtin *b = builtin_lookup(argv[0]);
+    if (b) {
+        io_ctx io = IO_CTX_STDIO;
+        int rc = b->fn(argc, argv, &io);
+        io_flush();
+        _exit(rc);
     }
-#endif
 
+    /* external: exec the hashed location instead of searching PATH */
+    const char *path = argv[0];
+    if (strchr(argv[0], '/') == NULL)
+        path = pathcache_lookup(argv[0]);
+    int rc = 127;
+    if (path) {
+        signal_unblock(SIGCHLD);        /* blocked for the event loop */
+        execve(path, argv, vars_environ());
+        rc = spawn_error_status(argv[0], errno, STDERR_FILENO);
+    } else {
+        rc = spawn_error_status(argv[0], ENOENT, STDERR_FILENO);
+    }
 
+    /* exec failed */
+    io_flush();
+    _exit(rc);
+}
 
-        /* If your generated headers have an explicit sym_and_or, prefer it. */
-#ifdef sym_and_or
-        case sym_and_or:
-            return eval_andor(n);
-#endif
+/* A pipeline being started: the expanded argv of each simple command
+   stage, and the job its processes join. */
+struct pipeline_run {
+    const struct ir_node *pl;
+    char ***argvs;
+    int *argcs;
+    bool *failed;       /* expanding the words reported an error */
+    struct job *job;
+};
 
-#ifdef sym_subshell
-        case sym_subshell: {
-            uint32_t m = ts_node_named_child_count(n);
-            for (uint32_t i = 0; i < m; i++) {
-                TSNode ch = ts_node_named_child(n, i);
-                execute_node(ch);
-            }
-            return last_status;
-        }
-#endif
+/* Plain external commands are spawned, and builtins that only produce
+   output run in the shell.  Anything else that needs shell code
+   (other builtins, compound statements, assignments) is forked. */
+static enum piping_how
+stage_how(void *ctx, uint32_t i)
+{
+    struct pipeline_run *r = ctx;
+    const struct ir_node *st = &r->pl->kids[i];
+    if (r->failed[i])
+        return PIPING_SPAWN;    /* stage_spawn() fails it, starting nothing */
+    if (!r->argvs[i])
+        return PIPING_FORK;
+    const struct builtin *b = builtin_lookup(r->argvs[i][0]);
+    if (!b)
+        return PIPING_SPAWN;
+    if (b->pure && st->nredirs == 0 && !(st->flags & IR_F_PIPE_STDERR))
+        return PIPING_INLINE;
+    return PIPING_FORK;
+}
 
-        /* Some grammars represent &&/|| as a binary_expression with fields. */
-#ifdef sym_binary_expression
-        case sym_binary_expression:
-            return eval_andor(n);
-#endif
+/* Run a pure builtin stage in the shell.  Its output is collected in
+   memory and fed to the pipe while the later stages run. */
+static void
+stage_run_inline(void *ctx, uint32_t i, const struct piping_stage *st)
+{
+    struct pipeline_run *r = ctx;
+    const struct builtin *b = builtin_lookup(r->argvs[i][0]);
+    struct io_capture cap = { .arena = &cmd_arena };
+    io_ctx io = IO_CTX_STDIO;
+    if (st->in != -1)
+        io.in_fd = st->in;
+    io.capture = &cap;
+    (void)b->fn(r->argcs[i], r->argvs[i], &io);
+    piping_feed(st->out, cap.buf, cap.len);
+}
 
-        default: {
-            /* Fallback: if the node has an operator field, treat it as and/or. */
-            TSNode opn = ts_node_child_by_field_id(n, operatorId);
-            if (!ts_node_is_null(opn)) {
-                return eval_andor(n);
-            }
-            ts_print_node_info(n, "eval_node_status: unimplemented node");
-            last_status = 1;
-            return last_status;
-        }
+static int
+stage_spawn(void *ctx, uint32_t i, const struct piping_stage *st, pid_t *pid)
+{
+    struct pipeline_run *r = ctx;
+    struct spawn_plan plan;
+    if (r->failed[i] || spawn_plan_init(&plan) != 0)
+        return 1;
+    /* the stage's own redirections apply after the pipes */
+    int rc = 1, err_fd;
+    if (plan_command_redirections(&r->pl->kids[i], st->in, st->out,
+                                  st->err_too ? st->out : -1, &plan, &err_fd) == 0) {
+        int serr = spawn_command(r->argvs[i], &plan, pid);
+        rc = serr ? spawn_error_status(r->argvs[i][0], serr, err_fd) : 0;
     }
+    spawn_plan_destroy(&plan);
+    return rc;
 }
 
+static void
+stage_run_child(void *ctx, uint32_t i)
+{
+    struct pipeline_run *r = ctx;
+    const struct ir_node *st = &r->pl->kids[i];
+    forget_jobs();
+    if (st->kind != IR_COMMAND) {
+        eval_node(st);
+        io_flush();
+        _exit(last_status);
+    }
+    struct redir_plan plan;
+    redir_plan_init(&plan, -1, -1, -1);
+    if (redir_plan_add(&plan, st->redirs, st->nredirs, &cmd_arena, last_status) != 0
+        || redir_plan_apply(&plan, NULL) != 0) {
+        io_flush();
+        _exit(1);
+    }
+    if (!r->argvs[i]) {
+        (void)assign_variables(st);
+        _exit(last_status);
+    }
+    exec_argv_in_child(r->argcs[i], r->argvs[i]);     /* never returns */
+}
 
-static int eval_andor(TSNode andor_node) {
-    uint32_t npipes = ts_node_named_child_count(andor_node);
-    if (npipes == 0) { last_status = 0; return last_status; }
-
-    /* Evaluate the first pipeline. */
-    TSNode left = ts_node_named_child(andor_node, 0);
-    int status = eval_node_status(left);
-
-    /* Walk the rest, respecting &&/|| short-circuit. */
-    for (uint32_t i = 1; i < npipes; i++) {
-        TSNode prev = ts_node_named_child(andor_node, i - 1);
-        TSNode cur  = ts_node_named_child(andor_node, i);
+static void
+stage_started(void *ctx, uint32_t i, pid_t pid)
+{
+    struct pipeline_run *r = ctx;
+    add_process(r->job, pid);
+}
 
-        /* Slice text between prev and cur to discover the operator. */
-        uint32_t prev_end  = ts_node_end_byte(prev);
-        uint32_t cur_start = ts_node_start_byte(cur);
-        const char *seg    = input + prev_end;
-        size_t seglen      = (cur_start > prev_end) ? (size_t)(cur_start - prev_end) : 0;
+static const struct piping_ops pipeline_ops = {
+    .how = stage_how,
+    .spawn = stage_spawn,
+    .run_child = stage_run_child,
+    .run_inline = stage_run_inline,
+    .started = stage_started,
+};
 
-        /* Scan for "&&" or "||" ignoring whitespace. */
-        const char *p = seg, *pend = seg + seglen;
-        int is_and = 0, is_or = 0;
-        while (p + 1 < pend) {
-            if (p[0] == '&' && p[1] == '&') { is_and = 1; break; }
-            if (p[0] == '|' && p[1] == '|') { is_or  = 1; break; }
-            ++p;
+/* Run a pipeline with optional overall in/out FDs (apply to first/last stage).
+   argv's are expanded in the shell, then piping_start() wires up and
+   starts the stages through pipeline_ops.  The per-pipeline arrays and
+   all argvs come from cmd_arena and are released together when the
+   pipeline is done. */
+static int run_pipeline_with_io(const struct ir_node *pl, int pipe_in_fd, int pipe_out_fd) {
+    int n = (int)pl->nkids;
+    if (n == 0) { last_status = 0; return last_status; }
+
+    struct arena_mark mark = arena_mark(&cmd_arena);
+    struct pipeline_run run = {
+        .pl = pl,
+        .argvs = arena_zalloc(&cmd_arena, (size_t)n * sizeof *run.argvs),
+        .argcs = arena_zalloc(&cmd_arena, (size_t)n * sizeof *run.argcs),
+        .failed = arena_zalloc(&cmd_arena, (size_t)n * sizeof *run.failed),
+        .job = allocate_job(false),
+    };
+    for (int i = 0; i < n; i++) {
+        const struct ir_node *st = &pl->kids[i];
+        if (st->kind == IR_COMMAND && st->nwords > 0) {
+            int err = EXPAND_OK;
+            run.argvs[i] = expand_argv(&cmd_arena, st->words, st->nwords, last_status,
+                                       &run.argcs[i], &err);
+            /* as for a simple command: the stage does not run, status 1 */
+            run.failed[i] = err == EXPAND_ARITH_FAIL || err == EXPAND_PARAM_FAIL;
         }
+    }
 
-        int run_right = 1; /* default: sequence if no operator found */
-        if (is_and) run_right = (status == 0);
-        else if (is_or) run_right = (status != 0);
+    io_flush();
+    int spawn_status = piping_start(pl, pipe_in_fd, pipe_out_fd, &pipeline_ops, &run);
 
-        if (run_right) {
-            status = eval_node_status(cur);  /* update with right status */
-        } else {
-            /* short-circuited: keep prior status, skip cur */
-        }
-    }
+    /* if the last stage did not start, its failure decides $? */
+    int status = wait_for_foreground_job(run.job);
+    if (spawn_status != -1)
+        status = spawn_status;
 
+    arena_reset(&cmd_arena, mark);
     last_status = status;
     return last_status;
 }
 
+/* =========================
+ * COMMAND EXECUTION HELPERS
+ * ========================= */
 
-/* Handle: redirected_statement := (body: command|pipeline) (file_redirect ...)+ */
-static void handle_redirected_statement(TSNode rs)
-{
-    TSNode body = ts_node_child_by_field_id(rs, bodyId);
-    if (ts_node_is_null(body)) return;
-
-    DBG("[RS] body=%s\n", ts_node_type(body));
-
-    int in_fd  = -1;
-    int out_fd = -1;
-    bool have_in  = false;
-    bool have_out = false;
-
-    uint32_t n = ts_node_named_child_count(rs);
-    for (uint32_t i = 0; i < n; i++) {
-        TSNode ch = ts_node_named_child(rs, i);
-        if (ts_node_symbol(ch) != sym_file_redirect) continue;
-
-        char *redir_txt = ts_extract_node_text(input, ch);
-        if (!redir_txt) redir_txt = strdup("");
-        const char *p = redir_txt;
-        while (*p == ' ' || *p == '\t') p++;
-        char op1 = *p;
-        char op2 = (p[0] && p[1]) ? p[1] : '\0';
-        bool is_input  = (op1 == '<');
-        bool is_append = (op1 == '>' && op2 == '>');
-
-        TSNode dest = ts_node_child_by_field_id(ch, destinationId);
-        char *path = ts_extract_node_text(input, dest);
-        if (!path) path = strdup("");
-
-        DBG("[RS] redirect op='%c%c' path='%s'\n", op1, op2 ? op2 : ' ', path);
-
-        if (is_input) {
-            if (have_in && in_fd >= 0) close(in_fd);
-            int fd = open(path, O_RDONLY);
-            if (fd < 0) {
-                utils_error("minibash: cannot open for input: %s", path);
-                free(path); free(redir_txt);
-                if (have_out && out_fd >= 0) close(out_fd);
-                if (have_in  && in_fd  >= 0) close(in_fd);
-                last_status = 1;
-                return;
-            }
-            in_fd = fd; have_in = true;
-        } else {
-            if (have_out && out_fd >= 0) close(out_fd);
-            int flags = O_WRONLY | O_CREAT | (is_append ? O_APPEND : O_TRUNC);
-            int fd = open(path, flags, 0666);
-            if (fd < 0) {
-                utils_error("minibash: cannot open for output: %s", path);
-                free(path); free(redir_txt);
-                if (have_out && out_fd >= 0) close(out_fd);
-                if (have_in  && in_fd  >= 0) close(in_fd);
-                last_status = 1;
-                return;
-            }
-            out_fd = fd; have_out = true;
-            (void)is_append;
-        }
-
-        free(path);
-        free(redir_txt);
-    }
-
-    DBG("[RS] in_fd=%d have_in=%d  out_fd=%d have_out=%d\n",
-        in_fd, (int)have_in, out_fd, (int)have_out);
-
+/* Run a builtin inside the shell.  The in/out fds and the command's own
+   redirections are resolved into a plan whose fds 0-2 become the
+   builtin's io_ctx, so neither a fork nor a dup2 of the shell's
+   descriptors is needed, and releasing the plan undoes it all. */
+static int run_builtin(const struct builtin *b, const struct ir_node *cmd, int argc, char **argv,
+                       int in_fd, int out_fd) {
+    struct redir_plan plan;
+    redir_plan_init(&plan, in_fd, out_fd, -1);
     int rc = 0;
-    switch (ts_node_symbol(body)) {
-        case sym_command:
-            DBG("[RS] run command with in=%d out=%d\n",
-                have_in ? in_fd : -1, have_out ? out_fd : -1);
-            rc = run_command_with_io(body, have_in ? in_fd : -1, have_out ? out_fd : -1);
-            break;
-        case sym_pipeline:
-            DBG("[RS] run pipeline with in=%d out=%d\n",
-                have_in ? in_fd : -1, have_out ? out_fd : -1);
-            rc = run_pipeline_with_io(body, have_in ? in_fd : -1, have_out ? out_fd : -1);
-            break;
-        default:
-            ts_print_node_info(body, "redirected_statement: unexpected body");
+    if (cmd->nredirs > 0) {
+        io_flush();     /* a redirection may name what stdout already is */
+        if (redir_plan_add(&plan, cmd->redirs, cmd->nredirs, &cmd_arena, last_status) != 0)
             rc = 1;
-            break;
     }
 
-    if (have_in  && in_fd  >= 0) close(in_fd);
-    if (have_out && out_fd >= 0) close(out_fd);
+    io_ctx io = IO_CTX_STDIO;
+    io.in_fd  = redir_plan_src(&plan, STDIN_FILENO);
+    io.out_fd = redir_plan_src(&plan, STDOUT_FILENO);
+    io.err_fd = redir_plan_src(&plan, STDERR_FILENO);
+    if (out_fd == -1 && !redir_plan_touches(&plan, STDOUT_FILENO))
+        io.capture = stdout_capture;
+
+    if (rc == 0)
+        rc = b->fn(argc, argv, &io);
 
-    last_status = rc;
+    redir_plan_release(&plan);
+    return rc;
 }
 
-/* Evaluate: test_command → unary_expression.
- * Supports common unary ops used by the tests:
- *   -e (exists), -f (regular file), -d (directory),
- *   -r (readable), -w (writable), -x (executable),
- *   -n (string length > 0), -z (string length == 0).
- * Returns 0 on true, 1 on false.
- */
-static int eval_test_command(TSNode test_cmd) {
-    /* Locate unary_expression child */
-    TSNode ue = (TSNode){0};
-    uint32_t n = ts_node_named_child_count(test_cmd);
-    for (uint32_t i = 0; i < n; i++) {
-        TSNode ch = ts_node_named_child(test_cmd, i);
-        if (strcmp(ts_node_type(ch), "unary_expression") == 0) { ue = ch; break; }
-    }
-    if (ts_node_is_null(ue)) { last_status = 1; return last_status; }
-
-    /* Operator text (e.g., "-x", "-e", "-n", "-z", ...) */
-    TSNode opn = ts_node_child_by_field_id(ue, operatorId);
-    char *op = ts_extract_node_text(input, opn);
-    if (!op) op = strdup("");
-
-    /* Operand node: could be word/string/raw_string/simple_expansion/expansion */
-    TSNode argn = (TSNode){0};
-    uint32_t m = ts_node_named_child_count(ue);
-    for (uint32_t i = 0; i < m; i++) {
-        TSNode ch = ts_node_named_child(ue, i);
-        int s = ts_node_symbol(ch);
-        if (s == sym_word || s == sym_string || s == sym_raw_string ||
-            s == sym_simple_expansion || s == sym_expansion || s == sym_command_substitution) {
-            argn = ch; break;
-        }
-    }
+/* Run a single command with optional in/out FDs.
+   The argv is expanded in the shell.  Builtins run in-process; external
+   commands are spawned with the fd wiring expressed as spawn file actions.
+   Returns the command’s exit status (0..255) and updates last_status. */
+static int run_command_with_io(const struct ir_node *cmd, int in_fd, int out_fd) {
+    if (cmd->nwords == 0)
+        return assign_variables(cmd);
 
-    /* Expand operand to a C string using your existing expansion engine */
-    int ex_err = EXPAND_OK;
-    char *arg = ts_node_is_null(argn)
-                  ? strdup("")
-                  : expand_one_arg(argn, input, last_status, &ex_err);
-    if (!arg) arg = strdup("");
-
-    int truth = 0;
-
-    /* File tests (+ string tests) */
-    if (strcmp(op, "-e") == 0) {
-        truth = (access(arg, F_OK) == 0);
-    } else if (strcmp(op, "-f") == 0) {
-        struct stat st; truth = (stat(arg, &st) == 0 && S_ISREG(st.st_mode));
-    } else if (strcmp(op, "-d") == 0) {
-        struct stat st; truth = (stat(arg, &st) == 0 && S_ISDIR(st.st_mode));
-    } else if (strcmp(op, "-r") == 0) {
-        truth = (access(arg, R_OK) == 0);
-    } else if (strcmp(op, "-w") == 0) {
-        truth = (access(arg, W_OK) == 0);
-    } else if (strcmp(op, "-x") == 0) {
-        truth = (access(arg, X_OK) == 0);
-    } else if (strcmp(op, "-n") == 0) {
-        truth = (arg && arg[0] != '\0');
-    } else if (strcmp(op, "-z") == 0) {
-        truth = (!arg || arg[0] == '\0');
-    } else {
-        /* Unknown operator → false for now; easy to extend later */
-        truth = 0;
+    struct arena_mark mark = arena_mark(&cmd_arena);
+    int argc = 0, err = EXPAND_OK;
+    char **argv = expand_argv(&cmd_arena, cmd->words, cmd->nwords, last_status, &argc, &err);
+    if (err == EXPAND_ARITH_FAIL || err == EXPAND_PARAM_FAIL) {
+        last_status = 1;
+        goto out;
+    }
+    if (argc == 0 || !argv[0]) {
+        last_status = 127;
+        goto out;
     }
 
-    free(op);
-    free(arg);
+    const struct builtin *b = builtin_lookup(argv[0]);
+    if (b) {
+        last_status = run_builtin(b, cmd, argc, argv, in_fd, out_fd);
+        goto out;
+    }
 
-    last_status = truth ? 0 : 1;
+    io_flush();
+    pid_t pid;
+    struct spawn_plan plan;
+    if (spawn_plan_init(&plan) != 0) {
+        last_status = 1;
+        goto out;
+    }
+    int err_fd;
+    if (plan_command_redirections(cmd, in_fd, out_fd, -1, &plan, &err_fd) != 0) {
+        spawn_plan_destroy(&plan);
+        last_status = 1;
+        goto out;
+    }
+    int serr = spawn_command(argv, &plan, &pid);
+    if (serr != 0)
+        last_status = spawn_error_status(argv[0], serr, err_fd);
+    spawn_plan_destroy(&plan);
+    if (serr != 0)
+        goto out;
+
+    struct job *job = allocate_job(false);
+    add_process(job, pid);
+    last_status = wait_for_foreground_job(job);
+out:
+    arena_reset(&cmd_arena, mark);
     return last_status;
 }
 
-/* Pull the actual executable body out of an else_clause wrapper. */
-/* Pull the actual executable body out of an else_clause wrapper. */
-static TSNode unwrap_else_body(TSNode n) {
-    if (ts_node_is_null(n)) return n;
-    const char *t = ts_node_type(n);
-    if (t && strcmp(t, "else_clause") == 0) {
-        uint32_t m = ts_node_named_child_count(n);
-        for (uint32_t i = 0; i < m; i++) {
-            TSNode ch = ts_node_named_child(n, i);
-            int s = ts_node_symbol(ch);
-            if (s == sym_command ||
-                s == sym_list ||
-                s == sym_pipeline ||
-#ifdef sym_redirected_statement
-                s == sym_redirected_statement ||
-#endif
-                s == sym_variable_assignment)            /* <-- add this */
-            {
-                return ch;
-            }
-        }
-        TSNode nulln = (TSNode){0};
-        return nulln;
-    }
-    return n;
-}
-
-/* C99, no extra field-IDs required.
-   Works with the tree you printed where:
-   named children of if_statement are, in order:
-     0: condition (command or list)
-     1: then-body (command or list)
-     2: optional else-body (command or list)
-*/
-static int eval_if_statement(TSNode if_node) {
-    /* Grab condition (field preferred) and the straight then-body. */
-    TSNode cond = ts_node_child_by_field_id(if_node, conditionId);
-    uint32_t n  = ts_node_named_child_count(if_node);
-    if (ts_node_is_null(cond) && n >= 1) cond = ts_node_named_child(if_node, 0);
-
-    TSNode thenb = (n >= 2) ? ts_node_named_child(if_node, 1) : (TSNode){0};
-    if (ts_node_is_null(cond) || ts_node_is_null(thenb)) { last_status = 2; return last_status; }
-
-    /* 1) Evaluate the primary condition */
-    (void)eval_node_status(cond);
-    if (last_status == 0) {
-        (void)eval_node_status(thenb);
+/* ======== REDIRECTS FOR A SINGLE COMMAND ======== */
+/* Add the command's redirections, on top of the given pipes (-1: none),
+   to a spawn plan.  The files opened for it are handed to the plan.
+   If stderr_fd is not NULL, it is set to the shell descriptor that will
+   be the command's stderr, for reporting a failed spawn; it stays open
+   until the plan is destroyed.  Return 0 on success, -1 on error. */
+static int plan_command_redirections(const struct ir_node *cmd, int in_fd, int out_fd, int err_fd,
+                                     struct spawn_plan *plan, int *stderr_fd) {
+    struct redir_plan rp;
+    redir_plan_init(&rp, in_fd, out_fd, err_fd);
+    if (redir_plan_add(&rp, cmd->redirs, cmd->nredirs, &cmd_arena, last_status) != 0
+        || redir_plan_spawn(&rp, plan) != 0) {
+        redir_plan_release(&rp);
+        return -1;
+    }
+    if (stderr_fd)
+        *stderr_fd = redir_plan_src(&rp, STDERR_FILENO);
+    return 0;
+}
+
+/* Evaluate a list: each element runs unless its && / || connector
+   short-circuits it, in which case the previous status is kept. */
+static int eval_list(const struct ir_node *list) {
+    if (list->nkids == 0) {
+        last_status = 0;
         return last_status;
     }
+    for (uint32_t i = 0; i < list->nkids; i++) {
+        const struct ir_node *n = &list->kids[i];
+        if (n->conn == IR_CONN_AND && last_status != 0) continue;
+        if (n->conn == IR_CONN_OR  && last_status == 0) continue;
+        if (n->flags & IR_F_ASYNC)
+            run_background(n);
+        else
+            eval_node(n);
+        if (unwind)
+            break;
+    }
+    return last_status;
+}
 
-    /* 2) Walk remaining named children looking for elif clauses (and maybe an else at the end) */
-    TSNode elseb = (TSNode){0};
-    for (uint32_t i = 2; i < n; i++) {
-        TSNode ch = ts_node_named_child(if_node, i);
-        const char *t = ts_node_type(ch);
+static int eval_node(const struct ir_node *n) {
+    switch (n->kind) {
+        case IR_LIST:
+            return eval_list(n);
 
-        if (t && strcmp(t, "elif_clause") == 0) {
-            /* elif_clause’s named children: test_command, then-body */
-            uint32_t m = ts_node_named_child_count(ch);
-            TSNode econd = (m >= 1) ? ts_node_named_child(ch, 0) : (TSNode){0};
-            TSNode ebody = (m >= 2) ? ts_node_named_child(ch, 1) : (TSNode){0};
+        case IR_COMMAND:
+            return run_command_with_io(n, -1, -1);
 
-            if (!ts_node_is_null(econd)) (void)eval_node_status(econd);
-            if (last_status == 0) {
-                if (!ts_node_is_null(ebody)) (void)eval_node_status(ebody);
-                return last_status;   /* took this elif branch */
-            }
-        } else if (t && strcmp(t, "else_clause") == 0) {
-            elseb = ch;  /* remember; unwrap and run if no prior branch matched */
-        }
-    }
+        case IR_PIPELINE:
+            return run_pipeline_with_io(n, -1, -1);
 
-    /* 3) else clause (if present) */
-    if (!ts_node_is_null(elseb)) {
-        TSNode body = unwrap_else_body(elseb);
-        if (!ts_node_is_null(body)) (void)eval_node_status(body);
-        return last_status;
-    }
+        case IR_REDIRECTED:
+            return eval_redirected(n);
 
-    /* nothing matched */
-    return last_status;  /* nonzero from the last condition */
-}
-
-
-/* Evaluate: for_statement with explicit value list:
-     for <var> in <value>...; do <body>; done
-   Tree-sitter (bash) gives:
-     variable: variable_name
-     value: (word|number|string|raw_string|simple_expansion|expansion...)
-     body: do_group
-*/
-static int eval_for_statement(TSNode for_node) {
-    /* 1) Variable name */
-    TSNode varn = ts_node_child_by_field_id(for_node, variableId);
-    if (ts_node_is_null(varn))
-        varn = ts_node_named_child(for_node, 0);
-    char *vname = ts_extract_node_text(input, varn);
-    if (!vname) vname = strdup("");
-
-    /* 2) Body */
-    TSNode body = ts_node_child_by_field_id(for_node, bodyId);
-    if (ts_node_is_null(body)) {
-        /* fall back: find named child of kind do_group/list/command */
-        uint32_t nn = ts_node_named_child_count(for_node);
-        for (uint32_t i = 0; i < nn; i++) {
-            TSNode ch = ts_node_named_child(for_node, i);
-            int s = ts_node_symbol(ch);
-            if (s == sym_do_group || s == sym_list || s == sym_command || s == sym_pipeline) {
-                body = ch; break;
-            }
-        }
-    }
-    if (ts_node_is_null(body)) {
-        free(vname);
-        last_status = 0;    /* empty body – nothing to do */
-        return last_status;
-    }
+        case IR_TEST:
+            return eval_test_command(n);
 
-    /* 3) Collect and expand all values */
-    uint32_t n = ts_node_named_child_count(for_node);
-    char **vals = NULL;
-    int nvals = 0, cap = 0;
+        case IR_IF:
+            return eval_if_statement(n);
 
-    for (uint32_t i = 0; i < n; i++) {
-        TSNode ch = ts_node_named_child(for_node, i);
-        if (ts_node_eq(ch, varn) || ts_node_eq(ch, body))
-            continue;               /* skip var and body */
+        case IR_FOR:
+            return eval_for_statement(n);
 
-        /* Only take plausible "value" nodes. (Tree shows number/string here.) */
-        int sym = ts_node_symbol(ch);
-        bool looks_value =
-            sym == sym_word || sym == sym_number || sym == sym_string || sym == sym_raw_string ||
-            sym == sym_simple_expansion || sym == sym_expansion || sym == sym_command_substitution;
+        case IR_WHILE:
+            return eval_while_statement(n);
 
-        if (!looks_value) continue;
+        case IR_ARITH:
+            return eval_arith_command(n);
 
-        int err = EXPAND_OK;
-        char *val = expand_one_arg(ch, input, last_status, &err);
-        if (!val) val = strdup("");
+        default:
+            fprintf(stderr, "minibash: line %u: %s: not implemented\n", n->line, n->name);
+            last_status = 1;
+            return last_status;
+    }
+}
 
-        if (nvals == cap) {
-            cap = cap ? cap * 2 : 8;
-            vals = realloc(vals, (size_t)cap * sizeof *vals);
-        }
-        vals[nvals++] = val;
+/* Redirections around a pipeline or compound statement.  A pipeline
+   that only has its ends redirected takes them as its outer fds; any
+   other body runs in the shell with the plan dup2'ed into place, and
+   the shell's own descriptors are put back afterwards. */
+static int eval_redirected(const struct ir_node *rs) {
+    if (rs->nkids == 0) { last_status = 0; return last_status; }
+    const struct ir_node *body = &rs->kids[0];
+
+    io_flush();
+    struct redir_plan plan;
+    redir_plan_init(&plan, -1, -1, -1);
+    if (redir_plan_add(&plan, rs->redirs, rs->nredirs, &cmd_arena, last_status) != 0) {
+        redir_plan_release(&plan);
+        last_status = 1;
+        return last_status;
     }
 
-    /* 4) Execute body once per value, setting var each time */
-    for (int i = 0; i < nvals; i++) {
-        setenv(vname, vals[i], 1);
-        (void)eval_node_status(body);
+    bool ends_only = body->kind == IR_PIPELINE;
+    for (int i = 0; i < plan.nslots && ends_only; i++)
+        ends_only = plan.slots[i].fd <= STDOUT_FILENO && plan.slots[i].src >= 0;
+
+    if (ends_only) {
+        int in_fd = -1, out_fd = -1;
+        if (redir_plan_touches(&plan, STDIN_FILENO))
+            in_fd = redir_plan_src(&plan, STDIN_FILENO);
+        if (redir_plan_touches(&plan, STDOUT_FILENO))
+            out_fd = redir_plan_src(&plan, STDOUT_FILENO);
+        run_pipeline_with_io(body, in_fd, out_fd);
+    } else {
+        struct redir_saved saved;
+        struct io_capture *capture = stdout_capture;
+        if (redir_plan_touches(&plan, STDOUT_FILENO))
+            stdout_capture = NULL;
+        if (redir_plan_apply(&plan, &saved) == 0)
+            eval_node(body);
+        else
+            last_status = 1;
+        io_flush();
+        redir_restore(&saved);
+        stdout_capture = capture;
     }
 
-    for (int i = 0; i < nvals; i++) free(vals[i]);
-    free(vals);
+    redir_plan_release(&plan);
+    return last_status;
+}
 
-    /* Bash leaves variable bound to last value; we already did that. */
-    free(vname);
-    return last_status;  /* status of the last iteration (or 0 if none) */
+/* [ ... ] and [[ ... ]] written out in the script: the expression was
+   parsed when lowering, so no argv is built and no builtin is looked up. */
+static int eval_test_command(const struct ir_node *test) {
+    last_status = cond_eval(test->test, test->flags & IR_F_DOUBLE_BRACKET,
+                            &cmd_arena, last_status);
+    return last_status;
 }
 
+/* (( expr )): true if the value is not zero. */
+static int eval_arith_command(const struct ir_node *n) {
+    long long v;
+    last_status = arith_eval(n->arith, last_status, &v) != 0 ? 1 : v == 0;
+    return last_status;
+}
 
-static void execute_node(TSNode child) {
-    switch (ts_node_symbol(child)) {
-        case sym_comment:
-            break;
+/* kids hold condition/body pairs for the if and each elif, followed by
+   the else body if there is one. */
+static int eval_if_statement(const struct ir_node *if_node) {
+    uint32_t i = 0;
+    for (; i + 1 < if_node->nkids; i += 2) {
+        (void)eval_node(&if_node->kids[i]);
+        if (unwind)
+            return last_status;
+        if (last_status == 0)
+            return eval_node(&if_node->kids[i + 1]);
+    }
+    if (i < if_node->nkids)
+        return eval_node(&if_node->kids[i]);
 
-        case sym_if_statement:
-            (void)eval_if_statement(child);   /* updates last_status */
-            break;
+    /* nothing matched */
+    last_status = 0;
+    return last_status;
+}
 
-        case sym_variable_assignment:
-            handle_variable_assignment(child);
-            break;
+/* ======== LOOPS ======== */
 
-        case sym_list:
-            (void)eval_node_status(child);    /* updates last_status */
-            break;
+/* break [N] and continue [N] */
+static int
+loop_control(int argc, char **argv, io_ctx *io, bool cont)
+{
+    if (loop_depth == 0) {
+        io_errorf(io, "%s: only meaningful in a `for', `while', or `until' loop\n", argv[0]);
+        return 0;
+    }
+    long n = 1;
+    if (argc > 1) {
+        char *end;
+        n = strtol(argv[1], &end, 10);
+        if (argv[1][0] == '\0' || *end != '\0') {
+            io_errorf(io, "%s: %s: numeric argument required\n", argv[0], argv[1]);
+            return 1;
+        }
+        if (n < 1) {
+            io_errorf(io, "%s: %s: loop count out of range\n", argv[0], argv[1]);
+            return 1;
+        }
+    }
+    unwind = n < loop_depth ? (int)n : loop_depth;
+    unwind_continue = cont;
+    return 0;
+}
 
-#ifdef sym_and_or
-        case sym_and_or:
-            (void)eval_andor(child);
-            break;
-#endif
+int builtin_break(int argc, char **argv, io_ctx *io) {
+    return loop_control(argc, argv, io, false);
+}
 
-#ifdef sym_binary_expression
-        case sym_binary_expression:
-            (void)eval_andor(child);
-            break;
-#endif
+int builtin_continue(int argc, char **argv, io_ctx *io) {
+    return loop_control(argc, argv, io, true);
+}
 
-        case sym_command:
-            handle_command(child);
-            break;
+/* Called by a loop after its body (or condition) ran: take up a pending
+   break or continue.  Returns true if the loop is to be left. */
+static bool
+leave_loop(void)
+{
+    if (unwind == 0)
+        return false;
+    if (--unwind == 0 && unwind_continue)
+        return false;
+    return true;
+}
 
-        case sym_redirected_statement:
-            handle_redirected_statement(child);
+/* for NAME in WORD...; do BODY; done */
+static int eval_for_statement(const struct ir_node *for_node) {
+    /* Expand all values before the first iteration; they stay in
+       cmd_arena below everything the body allocates. */
+    struct arena_mark mark = arena_mark(&cmd_arena);
+    int nvals = 0, err = EXPAND_OK;
+    char **vals = expand_argv(&cmd_arena, for_node->words, for_node->nwords,
+                              last_status, &nvals, &err);
+
+    struct shell_var *var = vars_intern(for_node->name);
+    last_status = 0;    /* status if the body never runs */
+    loop_depth++;
+    for (int i = 0; i < nvals; i++) {
+        var_assign(var, vals[i], strlen(vals[i]));
+        (void)eval_node(&for_node->kids[0]);
+        if (leave_loop())
             break;
+    }
+    loop_depth--;
+    redir_cache_drop();
 
-        case sym_pipeline:
-            handle_pipeline(child);
-            break;
-        case sym_for_statement:
-            (void)eval_for_statement(child);
-            break;
+    /* Bash leaves variable bound to last value; we already did that. */
+    arena_reset(&cmd_arena, mark);
+    return last_status;  /* status of the last iteration (or 0 if none) */
+}
 
+/* while COND; do BODY; done, and until.  The condition is the lowered
+   list itself, run in the shell like any other: made of builtins, it
+   costs no fork per iteration. */
+static int eval_while_statement(const struct ir_node *while_node) {
+    const struct ir_node *cond = &while_node->kids[0];
+    const struct ir_node *body = &while_node->kids[1];
+    bool until = while_node->flags & IR_F_UNTIL;
+    int status = 0;     /* status if the body never runs */
 
-        default: {
-            TSNode opn = ts_node_child_by_field_id(child, operatorId);
-            if (!ts_node_is_null(opn)) {
-                (void)eval_andor(child);
+    loop_depth++;
+    for (;;) {
+        (void)eval_node(cond);
+        if (unwind) {
+            status = last_status;
+            if (leave_loop())
                 break;
-            }
-            ts_print_node_info(child, "Unimplemented node");
+            continue;
+        }
+        if ((last_status == 0) == until)
             break;
+        (void)eval_node(body);
+        status = last_status;
+        if (leave_loop())
+            break;
+    }
+    loop_depth--;
+    redir_cache_drop();
+
+    last_status = status;
+    return last_status;
+}
+
+/* ======== COMMAND SUBSTITUTION ======== */
+
+/* True if body consists of builtins that only produce output, with words
+   that assign nothing ($((i++)), ${v:=x}), so that running it in the
+   shell cannot be told apart from running it in a subshell. */
+static bool
+cmdsub_is_inline(const struct ir_node *body)
+{
+    for (uint32_t i = 0; i < body->nkids; i++) {
+        const struct ir_node *n = &body->kids[i];
+        if (n->flags & IR_F_ASYNC)
+            return false;
+        if (n->kind == IR_LIST) {
+            if (!cmdsub_is_inline(n))
+                return false;
+            continue;
         }
+        if (n->kind != IR_COMMAND || n->nwords == 0 || n->nassigns || n->nredirs
+            || !n->words[0].lit || words_have_effects(n))
+            return false;
+        const struct builtin *b = builtin_lookup(n->words[0].lit);
+        if (!b || !b->pure)
+            return false;
     }
+    return true;
+}
+
+static bool
+eval_cmdsub_inline(const struct ir_node *body, struct io_capture *cap, int *status)
+{
+    if (!cmdsub_is_inline(body))
+        return false;
+
+    /* $? is the subshell's own business */
+    int saved_status = last_status;
+    struct io_capture *saved = stdout_capture;
+    stdout_capture = cap;
+    *status = eval_list(body);
+    stdout_capture = saved;
+    last_status = saved_status;
+    return true;
+}
+
+/* ${name:?} failed: like bash, a shell running a script gives up on it
+   (a subshell or $( ... ) child only ends itself). */
+static void
+param_error(void)
+{
+    if (interactive)
+        return;
+    io_flush();
+    exit(1);
+}
+
+/* Runs in the forked child of a $(...) whose stdout is the pipe. */
+static int
+eval_cmdsub_subshell(const struct ir_node *body)
+{
+    stdout_capture = NULL;
+    forget_jobs();
+    (void)eval_list(body);
+    io_flush();
+    return last_status;
 }
 
 /*
  * Run a program.
  *
- * A program's named children are various types of statements which 
- * you can start implementing here.
+ * A program's statements have been lowered into an IR_LIST.
  */
 static void 
-run_program(TSNode program)
+run_program(const struct ir_program *prog)
 {
-    uint32_t n = ts_node_named_child_count(program);
-    for (uint32_t i = 0; i < n; i++) {
-        TSNode child = ts_node_named_child(program, i);
-        execute_node(child);
-    }
+    (void)eval_list(&prog->root);
 }
 
 /*
- * Read a script from this (already opened) file descriptor,
- * return a newly allocated buffer.
+ * Streaming execution of scripts read from a file or a pipe.
+ *
+ * Input is read in chunks.  Each round parses what has been read up to
+ * the last complete line, runs the top-level statements that are known
+ * to be complete (all but the last one, and none from the first one with
+ * a syntax error on, since more input may still change how they parse),
+ * and then drops the input they came from.  Memory use is bounded by the
+ * chunk size plus the largest single top-level statement.
  */
-static char *
-read_script_from_fd(int readfd)
+#define SCRIPT_CHUNK (64 * 1024)
+
+struct script_stream {
+    int fd;
+    char *buf;          /* input not yet executed */
+    size_t len, cap;
+    size_t limit;       /* the parser sees buf[0 .. limit) */
+    bool eof;
+    uint32_t line;      /* script line number of buf[0] */
+};
+
+/* TSInput callback: hand the parser the window in one piece. */
+static const char *
+script_stream_read(void *payload, uint32_t byte_index, TSPoint position, uint32_t *bytes_read)
 {
-    struct stat st;
-    if (fstat(readfd, &st) != 0) {
-        utils_error("Could not fstat input");
-        return NULL;
+    struct script_stream *s = payload;
+    if (byte_index >= s->limit) {
+        *bytes_read = 0;
+        return "";
     }
+    *bytes_read = (uint32_t)(s->limit - byte_index);
+    return s->buf + byte_index;
+}
 
-    char *userinput = malloc(st.st_size+1);
-    if (read(readfd, userinput, st.st_size) != st.st_size) {
-        utils_error("Could not read input");
-        free(userinput);
-        return NULL;
+/* Read until want more bytes are buffered or the input ends. */
+static void
+script_stream_fill(struct script_stream *s, size_t want)
+{
+    size_t goal = s->len + want;
+    if (goal > s->cap) {
+        s->cap = goal;
+        s->buf = realloc(s->buf, s->cap);
+        if (!s->buf)
+            utils_fatal_error("Could not read input");
+    }
+    while (!s->eof && s->len < goal) {
+        ssize_t n = read(s->fd, s->buf + s->len, goal - s->len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            utils_fatal_error("Could not read input");
+        if (n == 0)
+            s->eof = true;
+        s->len += (size_t)n;
+    }
+}
+
+/* Byte offset up to which the statements of this parse can be run. */
+static uint32_t
+complete_prefix(TSNode program, uint32_t limit)
+{
+    uint32_t done = limit;      /* nothing but blanks: all of it */
+    TSTreeCursor c = ts_tree_cursor_new(program);
+    if (ts_tree_cursor_goto_first_child(&c)) {
+        do {
+            TSNode n = ts_tree_cursor_current_node(&c);
+            if (!ts_node_is_named(n))
+                continue;
+            done = ts_node_start_byte(n);
+            if (ts_node_has_error(n))
+                break;
+        } while (ts_tree_cursor_goto_next_sibling(&c));
     }
-    userinput[st.st_size] = 0;
-    return userinput;
+    ts_tree_cursor_delete(&c);
+    return done;
 }
 
+static void
+execute_stream(int fd)
+{
+    struct script_stream s = { .fd = fd, .line = 1 };
+    TSInput in = {
+        .payload = &s,
+        .read = script_stream_read,
+        .encoding = TSInputEncodingUTF8,
+    };
+
+    size_t want = SCRIPT_CHUNK;
+    for (;;) {
+        script_stream_fill(&s, want);
+        if (s.eof) {
+            s.limit = s.len;
+        } else {
+            char *nl = memrchr(s.buf, '\n', s.len);
+            s.limit = nl ? (size_t)(nl - s.buf) + 1 : 0;
+        }
+
+        uint32_t done = 0;
+        if (s.limit > 0) {
+            TSTree *tree = ts_parser_parse(parser, NULL, in);
+            TSNode root = ts_tree_root_node(tree);
+            done = s.eof ? (uint32_t)s.limit : complete_prefix(root, (uint32_t)s.limit);
+            if (done > 0) {
+                struct ir_program prog;
+                ir_lower_until(&prog, root, s.buf, done, s.line);
+                ts_tree_delete(tree);
+
+                run_program(&prog);
+                ir_free(&prog);
+            } else {
+                ts_tree_delete(tree);
+            }
+        }
+
+        /* release the input that has been run */
+        for (char *p = s.buf; (p = memchr(p, '\n', s.buf + done - p)) != NULL; p++)
+            s.line++;
+        memmove(s.buf, s.buf + done, s.len - done);
+        s.len -= done;
+
+        if (s.eof && s.len == 0)
+            break;
+        /* an unfinished statement is re-parsed each round: grow the read
+           size with it so a huge statement costs O(n log n), not O(n^2) */
+        want = s.len > SCRIPT_CHUNK ? s.len : SCRIPT_CHUNK;
+    }
+    free(s.buf);
+}
 
 /* 
  * Execute the script whose content is provided in `script`
@@ -1398,18 +1856,63 @@ execute_script(char *script)
 {
     input = script;
     TSTree *tree = ts_parser_parse_string(parser, NULL, input, strlen(input));
-    TSNode  program = ts_tree_root_node(tree);
-    signal_block(SIGCHLD);
-    run_program(program);
-    signal_unblock(SIGCHLD);
+
+    /* The evaluators run on the IR; the CST is not needed past this point. */
+    struct ir_program prog;
+    ir_lower(&prog, ts_tree_root_node(tree), input);
     ts_tree_delete(tree);
+
+    run_program(&prog);
+    ir_free(&prog);
+}
+
+static bool input_done;     /* the terminal reached end of input */
+static void handle_terminal_input(int fd, uint32_t events, void *arg);
+
+/* readline's line handler: run a complete line, NULL at end of input. */
+static void
+handle_input_line(char *line)
+{
+    if (line == NULL) {
+        /* removing the handler here keeps readline from prompting again */
+        rl_callback_handler_remove();
+        input_done = true;
+        return;
+    }
+    /* Commands own the terminal while they run: type-ahead is left
+       for them, or for the next prompt. */
+    events_del(0);
+    execute_script(line);
+    free(line);
+    io_flush();
+    redir_cache_drop();
+
+    /* tell about background jobs that finished since the last prompt */
+    reap_children();
+    io_ctx io = IO_CTX_STDIO;
+    io.out_fd = STDERR_FILENO;
+    report_jobs(&io, JOBS_DONE, false);
+    purge_finished_jobs();
+    if (events_add(0, EPOLLIN, handle_terminal_input, NULL) != 0)
+        utils_fatal_error("Could not watch the terminal: ");
+
+    char *prompt = build_prompt();
+    rl_set_prompt(prompt);
+    free(prompt);
+}
+
+static void
+handle_terminal_input(int fd, uint32_t events, void *arg)
+{
+    rl_callback_read_char();
 }
 
 int
 main(int ac, char *av[])
 {
     int opt;
-    tommy_hashdyn_init(&shell_vars);
+    vars_init();
+    pathcache_init();
 
     /* Process command-line arguments. See getopt(3) */
     while ((opt = getopt(ac, av, "h")) > 0) {
@@ -1423,63 +1926,45 @@ main(int ac, char *av[])
 
     parser = ts_parser_new();
     const TSLanguage *bash = tree_sitter_bash();
-#define DEFINE_FIELD_ID(name) \
-    name##Id = ts_language_field_id_for_name(bash, #name, strlen(#name))
-    DEFINE_FIELD_ID(body);
-    DEFINE_FIELD_ID(condition);
-    DEFINE_FIELD_ID(name);
-    DEFINE_FIELD_ID(right);
-    DEFINE_FIELD_ID(left);
-    DEFINE_FIELD_ID(operator);
-    DEFINE_FIELD_ID(value);
-    DEFINE_FIELD_ID(redirect);
-    DEFINE_FIELD_ID(destination);
-    DEFINE_FIELD_ID(variable);
-
-
-
     ts_parser_set_language(parser, bash);
 
     list_init(&job_list);
-    signal_set_handler(SIGCHLD, sigchld_handler);
-
+    tommy_hashlin_init(&pid2proc);
+    arena_init(&cmd_arena);
+    expand_set_hooks(&(struct expand_hooks){
+        .eval_inline = eval_cmdsub_inline,
+        .eval_subshell = eval_cmdsub_subshell,
+        .param_error = param_error,
+    });
+    events_init(reap_children);
 
     /* Read/eval loop. */
-    bool shouldexit = false;
-    for (;;) {
-        if (shouldexit)
-            break;
-
-        /* If you fail this assertion, you were about to enter readline()
-         * while SIGCHLD is blocked.  This means that your shell would be
-         * unable to receive SIGCHLD signals, and thus would be unable to
-         * wait for background jobs that may finish while the
-         * shell is sitting at the prompt waiting for user input.
-         */
-        assert(!signal_is_blocked(SIGCHLD));
-
-        char *userinput = NULL;
-        /* Do not output a prompt unless shell's stdin is a terminal */
-        if (isatty(0) && av[optind] == NULL) {
-            char *prompt = isatty(0) ? build_prompt() : NULL;
-            userinput = readline(prompt);
-            free (prompt);
-            if (userinput == NULL)
-                break;
-        } else {
-            int readfd = 0;
-            if (av[optind] != NULL)
-                readfd = open(av[optind], O_RDONLY);
-
-            userinput = read_script_from_fd(readfd);
-            close(readfd);
-            if (userinput == NULL)
-                utils_fatal_error("Could not read input");
-            shouldexit = true;
-        }
-        execute_script(userinput);
-        free(userinput);
+    /* Do not output a prompt unless shell's stdin is a terminal */
+    interactive = isatty(0) && av[optind] == NULL;
+    if (interactive) {
+        /* readline is fed from the event loop, so jobs that finish
+           while the shell sits at the prompt are reaped right away */
+        char *prompt = build_prompt();
+        rl_callback_handler_install(prompt, handle_input_line);
+        free(prompt);
+        if (events_add(0, EPOLLIN, handle_terminal_input, NULL) != 0)
+            utils_fatal_error("Could not watch the terminal: ");
+        while (!input_done)
+            events_wait(-1);
+        events_del(0);
+    } else {
+        /* a script file or a pipe: run it as it is read */
+        int readfd = 0;
+        if (av[optind] != NULL)
+            readfd = open(av[optind], O_RDONLY | O_CLOEXEC);
+        if (readfd < 0)
+            utils_fatal_error("Could not open %s: ", av[optind]);
+
+        execute_stream(readfd);
+        close(readfd);
     }
+    io_flush();
+    redir_cache_drop();
 
     /* 
      * Even though it is not necessary for the purposes of resource
@@ -1487,7 +1972,14 @@ main(int ac, char *av[])
      * so that we can use valgrind's leak checker.
      */
     ts_parser_delete(parser);
-    tommy_hashdyn_foreach(&shell_vars, hash_free);
-    tommy_hashdyn_done(&shell_vars);
+    vars_done();
+    forget_jobs();
+    tommy_hashlin_done(&pid2proc);
+    free(jid2job);
+    free(jid_used);
+    free(jid_full);
+    pathcache_done();
+    arena_free(&cmd_arena);
+    events_done();
     return EXIT_SUCCESS;
 }
\ No newline at end of file
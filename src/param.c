@@ -0,0 +1,494 @@
+// param.c
+// ${name<op>...}: defaults, substrings, pattern trimming and replacement,
+// case conversion.
+
+#define _GNU_SOURCE
+#include "param.h"
+
+#include <fnmatch.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arith.h"
+#include "builtins.h"
+#include "expand.h"
+#include "vars.h"
+
+/* ---------------- results ---------------- */
+
+struct sbuf {
+    struct arena *a;
+    char *p;
+    size_t len, cap;
+};
+
+static void
+sb_add(struct sbuf *b, const char *s, size_t n)
+{
+    if (n == 0)
+        return;
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 64;
+        while (cap < b->len + n)
+            cap *= 2;
+        b->p = b->p ? arena_grow(b->a, b->p, b->cap, cap) : arena_alloc(b->a, cap);
+        b->cap = cap;
+    }
+    memcpy(b->p + b->len, s, n);
+    b->len += n;
+}
+
+/* ---------------- patterns ---------------- */
+
+enum {
+    PAT_LITERAL,        /* no glob characters */
+    PAT_STAR_LIT,       /* *literal */
+    PAT_LIT_STAR,       /* literal* */
+    PAT_ONE,            /* ? or [...]: exactly one character */
+    PAT_GLOB,
+};
+
+struct pattern {
+    int kind;
+    const char *glob;   /* as written, backslash escapes and all */
+    const char *lit;    /* the literal part, unescaped */
+    size_t litlen;
+    char *copy;         /* writable copy of the value, for fnmatch() on prefixes */
+};
+
+static void
+pattern_init(struct arena *a, const char *glob, struct pattern *pat)
+{
+    size_t n = strlen(glob), len = 0, nmeta = 0;
+    char *lit = arena_alloc(a, n + 1);
+    bool lead = false, trail = false;
+
+    for (size_t i = 0; i < n; i++) {
+        char c = glob[i];
+        if (c == '\\' && i + 1 < n) {
+            lit[len++] = glob[++i];
+        } else if (c == '*' || c == '?' || c == '[') {
+            nmeta++;
+            lead |= c == '*' && i == 0;
+            trail |= c == '*' && i == n - 1;
+        } else {
+            lit[len++] = c;
+        }
+    }
+    lit[len] = '\0';
+
+    *pat = (struct pattern){ .glob = glob, .lit = lit, .litlen = len };
+    const char *close = n > 2 ? strchr(glob + 2, ']') : NULL;
+    if (nmeta == 0)
+        pat->kind = PAT_LITERAL;
+    else if (nmeta == 1 && lead)
+        pat->kind = PAT_STAR_LIT;
+    else if (nmeta == 1 && trail)
+        pat->kind = PAT_LIT_STAR;
+    else if ((n == 1 && glob[0] == '?') ||
+             (glob[0] == '[' && close && close == glob + n - 1 && !strchr(glob + 1, '[')))
+        pat->kind = PAT_ONE;
+    else
+        pat->kind = PAT_GLOB;
+}
+
+/* Does the pattern match v[i..j)?  v must be pat->copy. */
+static bool
+glob_match(const struct pattern *pat, size_t i, size_t j)
+{
+    char save = pat->copy[j];
+    pat->copy[j] = '\0';
+    bool m = fnmatch(pat->glob, pat->copy + i, 0) == 0;
+    pat->copy[j] = save;
+    return m;
+}
+
+static void
+need_copy(struct arena *a, struct pattern *pat, const char *v, size_t n)
+{
+    if (!pat->copy)
+        pat->copy = arena_strndup(a, v, n);
+}
+
+/* Last occurrence of lit in v[0..n), or NULL. */
+static const char *
+last_mem(const char *v, size_t n, const char *lit, size_t len)
+{
+    if (len == 1)
+        return memrchr(v, lit[0], n);
+    const char *last = NULL;
+    for (const char *p = v; (p = memmem(p, n - (size_t)(p - v), lit, len)) != NULL; p++)
+        last = p;
+    return last;
+}
+
+static bool
+has_prefix(const char *v, size_t n, const char *lit, size_t len)
+{
+    return n >= len && memcmp(v, lit, len) == 0;
+}
+
+static bool
+has_suffix(const char *v, size_t n, const char *lit, size_t len)
+{
+    return n >= len && memcmp(v + n - len, lit, len) == 0;
+}
+
+/* Length of the shortest (or longest) prefix of v the pattern matches,
+   or -1. */
+static ptrdiff_t
+match_prefix(struct arena *a, struct pattern *pat, const char *v, size_t n, bool longest)
+{
+    const char *lit = pat->lit;
+    size_t len = pat->litlen;
+    const char *p;
+
+    switch (pat->kind) {
+    case PAT_LITERAL:
+        return has_prefix(v, n, lit, len) ? (ptrdiff_t)len : -1;
+    case PAT_LIT_STAR:
+        if (!has_prefix(v, n, lit, len))
+            return -1;
+        return longest ? (ptrdiff_t)n : (ptrdiff_t)len;
+    case PAT_STAR_LIT:
+        if (len == 0)
+            return longest ? (ptrdiff_t)n : 0;
+        p = longest ? last_mem(v, n, lit, len) : memmem(v, n, lit, len);
+        return p ? p - v + (ptrdiff_t)len : -1;
+    }
+
+    need_copy(a, pat, v, n);
+    if (pat->kind == PAT_ONE)
+        return n > 0 && glob_match(pat, 0, 1) ? 1 : -1;
+    if (longest) {
+        for (size_t i = n + 1; i-- > 0; )
+            if (glob_match(pat, 0, i))
+                return (ptrdiff_t)i;
+    } else {
+        for (size_t i = 0; i <= n; i++)
+            if (glob_match(pat, 0, i))
+                return (ptrdiff_t)i;
+    }
+    return -1;
+}
+
+/* Offset of the shortest (or longest) suffix of v the pattern matches,
+   or -1.  v must be NUL-terminated. */
+static ptrdiff_t
+match_suffix(struct pattern *pat, const char *v, size_t n, bool longest)
+{
+    const char *lit = pat->lit;
+    size_t len = pat->litlen;
+    const char *p;
+
+    switch (pat->kind) {
+    case PAT_LITERAL:
+        return has_suffix(v, n, lit, len) ? (ptrdiff_t)(n - len) : -1;
+    case PAT_STAR_LIT:
+        if (!has_suffix(v, n, lit, len))
+            return -1;
+        return longest ? 0 : (ptrdiff_t)(n - len);
+    case PAT_LIT_STAR:
+        if (len == 0)
+            return longest ? 0 : (ptrdiff_t)n;
+        p = longest ? memmem(v, n, lit, len) : last_mem(v, n, lit, len);
+        return p ? p - v : -1;
+    case PAT_ONE:
+        return n > 0 && fnmatch(pat->glob, v + n - 1, 0) == 0 ? (ptrdiff_t)n - 1 : -1;
+    }
+
+    if (longest) {
+        for (size_t i = 0; i <= n; i++)
+            if (fnmatch(pat->glob, v + i, 0) == 0)
+                return (ptrdiff_t)i;
+    } else {
+        for (size_t i = n + 1; i-- > 0; )
+            if (fnmatch(pat->glob, v + i, 0) == 0)
+                return (ptrdiff_t)i;
+    }
+    return -1;
+}
+
+/* First match at or after i: sets *start and *end.  Matches are the
+   longest at their starting point, and never empty. */
+static bool
+match_next(struct arena *a, struct pattern *pat, const char *v, size_t n, size_t i,
+           size_t *start, size_t *end)
+{
+    if (pat->kind == PAT_LITERAL) {
+        const char *p = memmem(v + i, n - i, pat->lit, pat->litlen);
+        if (!p)
+            return false;
+        *start = (size_t)(p - v);
+        *end = *start + pat->litlen;
+        return true;
+    }
+
+    need_copy(a, pat, v, n);
+    for (; i < n; i++) {
+        if (pat->kind == PAT_ONE) {
+            if (glob_match(pat, i, i + 1)) {
+                *start = i;
+                *end = i + 1;
+                return true;
+            }
+            continue;
+        }
+        for (size_t j = n; j > i; j--) {
+            if (glob_match(pat, i, j)) {
+                *start = i;
+                *end = j;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static const char *
+replace(struct arena *a, const struct ir_param *p, const char *v, size_t n,
+        struct pattern *pat, const char *repl, size_t *len)
+{
+    size_t rlen = strlen(repl);
+    struct sbuf b = { a };
+    ptrdiff_t m;
+
+    switch (p->op) {
+    case IR_PARAM_REPLACE_PREFIX:
+        if ((m = match_prefix(a, pat, v, n, true)) < 0)
+            break;
+        sb_add(&b, repl, rlen);
+        sb_add(&b, v + m, n - (size_t)m);
+        *len = b.len;
+        return b.p ? b.p : "";
+
+    case IR_PARAM_REPLACE_SUFFIX:
+        if ((m = match_suffix(pat, v, n, true)) < 0)
+            break;
+        sb_add(&b, v, (size_t)m);
+        sb_add(&b, repl, rlen);
+        *len = b.len;
+        return b.p ? b.p : "";
+
+    default: {
+        if (pat->glob[0] == '\0')
+            break;
+        if (n == 0) {
+            /* the one match an empty value can have is an empty one */
+            if (match_prefix(a, pat, v, 0, false) != 0)
+                break;
+            *len = rlen;
+            return repl;
+        }
+        size_t i = 0, start, end;
+        while (match_next(a, pat, v, n, i, &start, &end)) {
+            sb_add(&b, v + i, start - i);
+            sb_add(&b, repl, rlen);
+            i = end;
+            if (p->op != IR_PARAM_REPLACE_ALL)
+                break;
+        }
+        if (i == 0)
+            break;
+        sb_add(&b, v + i, n - i);
+        *len = b.len;
+        return b.p ? b.p : "";
+    }
+    }
+    *len = n;
+    return v;
+}
+
+/* ---------------- case conversion ---------------- */
+
+/* Convert the ASCII letters in [lo, hi] by flipping their 0x20 bit,
+   eight bytes at a time.  For each byte b < 0x80, b + (0x80 - lo) has
+   its high bit set iff b >= lo, and no byte carries into the next. */
+static void
+convert_case(char *dst, const char *src, size_t n, bool upper)
+{
+    const uint64_t ones = 0x0101010101010101ULL, high = 0x8080808080808080ULL;
+    const unsigned lo = upper ? 'a' : 'A', hi = upper ? 'z' : 'Z';
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x;
+        memcpy(&x, src + i, 8);
+        uint64_t x7 = x & ~high;
+        uint64_t ge = x7 + ones * (0x80 - lo);
+        uint64_t gt = x7 + ones * (0x80 - hi - 1);
+        x ^= (ge & ~gt & ~x & high) >> 2;
+        memcpy(dst + i, &x, 8);
+    }
+    for (; i < n; i++) {
+        unsigned char c = (unsigned char)src[i];
+        dst[i] = (char)(c >= lo && c <= hi ? c ^ 0x20 : c);
+    }
+}
+
+/* ---------------- substrings ---------------- */
+
+static const char *
+substring(const struct ir_param *p, const char *v, size_t n, int last_status,
+          size_t *len, int *out_err)
+{
+    long long off, count;
+    if (arith_eval(p->offset, last_status, &off) != 0 ||
+        (p->length && arith_eval(p->length, last_status, &count) != 0)) {
+        *out_err = EXPAND_PARAM_FAIL;
+        *len = 0;
+        return "";
+    }
+
+    /* Offsets count bytes, as bash does in the C locale. */
+    long long size = (long long)n;
+    *len = 0;
+    if (off < 0)
+        off += size;
+    if (off < 0 || off > size)
+        return "";
+    if (!p->length) {
+        *len = n - (size_t)off;
+        return v + off;
+    }
+    if (count < 0) {
+        if (size + count < off) {
+            io_flush();
+            fprintf(stderr, "minibash: %lld: substring expression < 0\n", count);
+            *out_err = EXPAND_PARAM_FAIL;
+            return "";
+        }
+        count = size + count - off;
+    }
+    *len = (size_t)(count < size - off ? count : size - off);
+    return v + off;
+}
+
+/* ---------------- entry point ---------------- */
+
+static const char *
+expand_sub(struct arena *a, const struct ir_word *w, int last_status, int *out_err)
+{
+    int err = EXPAND_OK;
+    const char *s = expand_word(a, w, last_status, &err);
+    if (err != EXPAND_OK)
+        *out_err = err;
+    return s;
+}
+
+const char *
+param_expand(struct arena *a, const char *name, const struct ir_param *p,
+             int last_status, size_t *len, int *out_err)
+{
+    const char *v = vars_get(name), *w;
+    bool unset = !v || (p->colon && !*v);
+    char num[24];
+    int ignored;
+
+    if (!out_err)
+        out_err = &ignored;
+    switch (p->op) {
+    case IR_PARAM_DEFAULT:
+        v = unset ? expand_sub(a, &p->word, last_status, out_err) : v;
+        *len = strlen(v);
+        return v;
+    case IR_PARAM_ASSIGN:
+        if (unset) {
+            v = expand_sub(a, &p->word, last_status, out_err);
+            vars_set(name, v);
+        }
+        *len = strlen(v);
+        return v;
+    case IR_PARAM_ALTERNATE:
+        v = unset ? "" : expand_sub(a, &p->word, last_status, out_err);
+        *len = strlen(v);
+        return v;
+    case IR_PARAM_ERROR:
+        if (unset) {
+            w = expand_sub(a, &p->word, last_status, out_err);
+            io_flush();
+            fprintf(stderr, "minibash: %s: %s\n", name,
+                    *w ? w : p->colon ? "parameter null or not set" : "parameter not set");
+            expand_param_error();
+            *out_err = EXPAND_PARAM_FAIL;
+            v = "";
+        }
+        *len = strlen(v);
+        return v;
+    }
+
+    bool set = v != NULL;
+    if (!v)
+        v = "";
+    size_t n = strlen(v);
+    struct pattern pat;
+    ptrdiff_t m;
+    char *out;
+
+    switch (p->op) {
+    case IR_PARAM_LENGTH:
+        *len = (size_t)snprintf(num, sizeof num, "%zu", n);
+        return arena_strndup(a, num, *len);
+
+    case IR_PARAM_SUBSTR:
+        return substring(p, v, n, last_status, len, out_err);
+
+    case IR_PARAM_TRIM_PREFIX:
+    case IR_PARAM_TRIM_PREFIX_LONG:
+        pattern_init(a, expand_sub(a, &p->word, last_status, out_err), &pat);
+        m = match_prefix(a, &pat, v, n, p->op == IR_PARAM_TRIM_PREFIX_LONG);
+        m = m < 0 ? 0 : m;
+        *len = n - (size_t)m;
+        return v + m;
+
+    case IR_PARAM_TRIM_SUFFIX:
+    case IR_PARAM_TRIM_SUFFIX_LONG:
+        pattern_init(a, expand_sub(a, &p->word, last_status, out_err), &pat);
+        m = match_suffix(&pat, v, n, p->op == IR_PARAM_TRIM_SUFFIX_LONG);
+        *len = m < 0 ? n : (size_t)m;
+        return v;
+
+    case IR_PARAM_REPLACE:
+    case IR_PARAM_REPLACE_ALL:
+    case IR_PARAM_REPLACE_PREFIX:
+    case IR_PARAM_REPLACE_SUFFIX:
+        pattern_init(a, expand_sub(a, &p->word, last_status, out_err), &pat);
+        w = expand_sub(a, &p->repl, last_status, out_err);
+        if (!set) {             /* nothing to match, not even "" */
+            *len = 0;
+            return v;
+        }
+        return replace(a, p, v, n, &pat, w, len);
+
+    case IR_PARAM_UPPER:
+    case IR_PARAM_LOWER:
+        out = arena_alloc(a, n + 1);
+        convert_case(out, v, n, p->op == IR_PARAM_UPPER);
+        *len = n;
+        return out;
+
+    case IR_PARAM_QUOTE:
+    case IR_PARAM_QUOTE_REGEX:
+        w = p->op == IR_PARAM_QUOTE ? "*?[]\\" : ".[]()*+?{}|^$\\";
+        out = arena_alloc(a, 2 * n + 1);
+        *len = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (strchr(w, v[i]))
+                out[(*len)++] = '\\';
+            out[(*len)++] = v[i];
+        }
+        return out;
+
+    case IR_PARAM_UPPER_FIRST:
+    case IR_PARAM_LOWER_FIRST:
+        out = arena_strndup(a, v, n);
+        convert_case(out, v, n > 0, p->op == IR_PARAM_UPPER_FIRST);
+        *len = n;
+        return out;
+    }
+
+    *len = n;
+    return v;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stddef.h>
+
+#include "arena.h"
+#include "ir.h"
+
+/*
+ * Parameter expansion operators: ${#v}, ${v:-w} and the rest of
+ * enum ir_param_op.
+ *
+ * Results that are part of the value (a trimmed prefix or suffix, a
+ * substring) are returned as views into it; anything new is built in
+ * the caller's arena.  Patterns without glob characters, and the
+ * `*literal` and `literal*` shapes of ${file##*.} and ${f%.*}, are searched
+ * for with memmem()/memchr() rather than fnmatch() at every offset, and
+ * case conversion goes eight bytes at a time, so large values do not
+ * need a trip through sed.
+ */
+
+/* Expand ${name op ...}.  Returns the result and sets *len; it is not
+   necessarily NUL-terminated.  On an error (${v:?}, a bad substring
+   length) a message is printed and *out_err, if not NULL, is set to
+   EXPAND_PARAM_FAIL. */
+const char *param_expand(struct arena *a, const char *name, const struct ir_param *p,
+                         int last_status, size_t *len, int *out_err);
@@ -0,0 +1,222 @@
+// pathcache.c
+// Command location cache backed by the tommy_hashdyn wrapper in hashtable.h.
+
+#define _GNU_SOURCE
+#include "pathcache.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* hashtable.h defines a number of static helpers we do not all use. */
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "builtins.h"
+#include "hashtable.h"
+#include "vars.h"
+
+static tommy_hashdyn cmd_paths;     /* command name -> absolute path */
+static char *cached_for_path;       /* value of PATH the entries were resolved with */
+
+void
+pathcache_init(void)
+{
+    tommy_hashdyn_init(&cmd_paths);
+    cached_for_path = NULL;
+}
+
+void
+pathcache_done(void)
+{
+    tommy_hashdyn_foreach(&cmd_paths, hash_free);
+    tommy_hashdyn_done(&cmd_paths);
+    free(cached_for_path);
+    cached_for_path = NULL;
+}
+
+/* Drop every entry if PATH is no longer what the cache was built from. */
+static void
+validate_against_path(void)
+{
+    const char *path = vars_get("PATH");
+    if (!path) path = "";
+    if (cached_for_path && strcmp(cached_for_path, path) == 0)
+        return;
+
+    hash_clear(&cmd_paths);
+    free(cached_for_path);
+    cached_for_path = strdup(path);
+}
+
+/* Search PATH for an executable regular file called name.
+   Returns a malloc'ed path containing a '/', or NULL. */
+static char *
+search_path(const char *name)
+{
+    const char *path = vars_get("PATH");
+    if (!path) path = "";
+
+    size_t nlen = strlen(name);
+    const char *dir = path;
+    for (;;) {
+        const char *end = strchrnul(dir, ':');
+        size_t dlen = (size_t)(end - dir);
+
+        if (dlen == 0) {                          /* empty element means "." */
+            dir = ".";
+            dlen = 1;
+        }
+        char *cand = malloc(dlen + 1 + nlen + 1);
+        if (cand) {
+            memcpy(cand, dir, dlen);
+            cand[dlen] = '/';
+            memcpy(cand + dlen + 1, name, nlen + 1);
+        }
+        if (!cand)
+            return NULL;
+
+        struct stat st;
+        if (stat(cand, &st) == 0 && S_ISREG(st.st_mode) && access(cand, X_OK) == 0)
+            return cand;
+        free(cand);
+
+        if (*end == '\0')
+            return NULL;
+        dir = end + 1;
+    }
+}
+
+/* Resolve name and (re)insert it.  Returns the entry or NULL if not found. */
+static entry *
+hash_command(const char *name)
+{
+    char *found = search_path(name);
+    if (!found)
+        return NULL;
+    hash_put(&cmd_paths, name, found);
+    free(found);
+    return hash_find(&cmd_paths, name);
+}
+
+const char *
+pathcache_lookup(const char *name)
+{
+    validate_against_path();
+
+    entry *e = hash_find(&cmd_paths, name);
+    if (!e)
+        e = hash_command(name);
+    if (!e)
+        return NULL;
+    e->hits++;
+    return e->val;
+}
+
+void
+pathcache_forget(const char *name)
+{
+    hash_del(&cmd_paths, name);
+}
+
+/* ---------------- the `hash` builtin ---------------- */
+
+static void
+print_hits(void *arg, void *obj)
+{
+    entry *e = obj;
+    io_printf(arg, "%4u\t%s\n", e->hits, e->val);
+}
+
+static void
+print_reusable(void *arg, void *obj)
+{
+    entry *e = obj;
+    io_printf(arg, "builtin hash -p %s %s\n", e->val, e->key);
+}
+
+int
+pathcache_hash_builtin(int argc, char **argv, io_ctx *io)
+{
+    bool opt_l = false, opt_r = false, opt_t = false, opt_d = false;
+    const char *opt_p = NULL;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) { i++; break; }
+        for (const char *o = argv[i] + 1; *o; o++) {
+            switch (*o) {
+            case 'l': opt_l = true; break;
+            case 'r': opt_r = true; break;
+            case 't': opt_t = true; break;
+            case 'd': opt_d = true; break;
+            case 'p':
+                if (i + 1 >= argc) {
+                    io_errorf(io, "hash: -p: option requires an argument\n");
+                    return 2;
+                }
+                opt_p = argv[++i];
+                goto next_arg;
+            default:
+                io_errorf(io, "hash: -%c: invalid option\n", *o);
+                return 2;
+            }
+        }
+    next_arg: ;
+    }
+
+    validate_against_path();
+    if (opt_r)
+        hash_clear(&cmd_paths);
+
+    if (i == argc) {
+        if (opt_r || opt_p)
+            return 0;
+        if (tommy_hashdyn_count(&cmd_paths) == 0) {
+            io_printf(io, "hash: hash table empty\n");
+            return 0;
+        }
+        if (opt_l) {
+            tommy_hashdyn_foreach_arg(&cmd_paths, print_reusable, io);
+        } else {
+            io_printf(io, "hits\tcommand\n");
+            tommy_hashdyn_foreach_arg(&cmd_paths, print_hits, io);
+        }
+        return 0;
+    }
+
+    bool many = argc - i > 1;   /* -t labels each path when given several names */
+    int status = 0;
+    for (; i < argc; i++) {
+        const char *name = argv[i];
+        if (opt_p) {
+            hash_put(&cmd_paths, name, opt_p);
+        } else if (opt_d) {
+            if (!hash_find(&cmd_paths, name)) {
+                io_errorf(io, "hash: %s: not found\n", name);
+                status = 1;
+            } else {
+                hash_del(&cmd_paths, name);
+            }
+        } else if (opt_t) {
+            entry *e = hash_find(&cmd_paths, name);
+            if (!e) {
+                io_errorf(io, "hash: %s: not found\n", name);
+                status = 1;
+                continue;
+            }
+            e->hits++;
+            if (many)
+                io_printf(io, "%s\t%s\n", name, e->val);
+            else
+                io_printf(io, "%s\n", e->val);
+        } else if (strchr(name, '/') == NULL) {
+            if (!hash_command(name)) {
+                io_errorf(io, "hash: %s: not found\n", name);
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
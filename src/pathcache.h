@@ -0,0 +1,29 @@
+#pragma once
+
+#include "builtins.h"
+
+/*
+ * Command location cache (bash's "hash table").
+ *
+ * Maps command names to the absolute path found by searching PATH, so
+ * that repeated invocations exec the binary directly instead of trying
+ * every PATH directory.  The whole cache is dropped when PATH changes;
+ * a single entry is dropped when its path turns out to be gone.
+ */
+
+/* Set up / tear down the cache. */
+void pathcache_init(void);
+void pathcache_done(void);
+
+/* Return the absolute path for a command name without a '/', searching
+   PATH on a miss.  Counts a hit.  Returns NULL if the command is not
+   found.  The returned string stays valid until the next call that
+   modifies the cache. */
+const char *pathcache_lookup(const char *name);
+
+/* Drop the entry for name, e.g., after its cached path failed to exec. */
+void pathcache_forget(const char *name);
+
+/* The `hash` builtin: hash [-lrt] [-d name] [-p path name] [name ...]
+   Writes through io like any other builtin.  Returns exit status. */
+int pathcache_hash_builtin(int argc, char **argv, io_ctx *io);
@@ -1,205 +1,211 @@
 // piping.c
-// Pipeline wiring/execution (no expansions, no redirections, no globals)
+// Pipeline wiring: pipes and per-stage descriptors.  How a stage runs
+// (expansion, redirections, exec) is up to the caller's callbacks.
 
+#define _GNU_SOURCE
 #include "piping.h"
 
-#include <tree_sitter/api.h>
-#include "ts_symbols.h"
-
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/wait.h>
-#include <errno.h>
 
-/* -------- optional minimal debug ------- */
-#ifndef PIPE_DEBUG
-#define PIPE_DEBUG 0
-#endif
-#if PIPE_DEBUG
-#  include <stdio.h>
-#  define PDBG(...) fprintf(stderr, __VA_ARGS__)
-#else
-#  define PDBG(...) ((void)0)
-#endif
-/* --------------------------------------- */
-
-/* Collect the list of sym_command children inside a sym_pipeline.
- * Returns the number of commands on success (>=0).
- * On success, *out_cmds is a malloc'ed array of TSNode of length ncmds (caller frees).
- * Returns -1 on OOM.
- */
-static int
-collect_pipeline_commands(TSNode pipeline_node, TSNode **out_cmds)
-{
-    *out_cmds = NULL;
+#include "events.h"
+#include "utils.h"
 
-    uint32_t total_named = ts_node_named_child_count(pipeline_node);
-    int ncmds = 0;
+static void close_feeds(void);
 
-    for (uint32_t i = 0; i < total_named; i++) {
-        TSNode ch = ts_node_named_child(pipeline_node, i);
-        if (ts_node_symbol(ch) == sym_command)
-            ncmds++;
-    }
+/* Close fd in a forked stage unless it is one of the standard three. */
+static void
+close_stray(int fd)
+{
+    if (fd > STDERR_FILENO)
+        close(fd);
+}
 
-    if (ncmds == 0) {
+/* Start stage i.  stray is the read end of the stage's own output pipe,
+   which only the next stage may hold.  Returns as piping_start(). */
+static int
+start_stage(uint32_t i, enum piping_how how, const struct piping_stage *st, int stray,
+            int in_fd, int out_fd, const struct piping_ops *ops, void *ctx)
+{
+    pid_t pid;
+    if (how == PIPING_INLINE) {
+        ops->run_inline(ctx, i, st);
         return 0;
     }
-
-    TSNode *cmds = (TSNode *)malloc((size_t)ncmds * sizeof *cmds);
-    if (!cmds) {
+    if (how == PIPING_SPAWN) {
+        int rc = ops->spawn(ctx, i, st, &pid);
+        if (rc != 0)
+            return rc;
+        ops->started(ctx, i, pid);
         return -1;
     }
 
-    int j = 0;
-    for (uint32_t i = 0; i < total_named; i++) {
-        TSNode ch = ts_node_named_child(pipeline_node, i);
-        if (ts_node_symbol(ch) == sym_command)
-            cmds[j++] = ch;
+    pid = fork();
+    if (pid == 0) {
+        if (st->in  != -1) dup2(st->in,  STDIN_FILENO);
+        if (st->out != -1) dup2(st->out, STDOUT_FILENO);
+        if (st->err_too)   dup2(st->out, STDERR_FILENO);
+        /* everything pipe-related the shell held when it forked */
+        close_stray(st->in);
+        close_stray(st->out);
+        close_stray(stray);
+        close_stray(in_fd);
+        close_stray(out_fd);
+        close_feeds();
+        ops->run_child(ctx, i);
+        _exit(127);
     }
-
-    *out_cmds = cmds;
-    return ncmds;
-}
-
-/* Close N-1 pipes (2 fds each). Safe on NULL. */
-static void
-close_all_pipes(int (*pipes)[2], int ncmds)
-{
-    if (!pipes || ncmds <= 1) return;
-    for (int i = 0; i < ncmds - 1; i++) {
-        if (pipes[i][0] >= 0) close(pipes[i][0]);
-        if (pipes[i][1] >= 0) close(pipes[i][1]);
+    if (pid < 0) {
+        utils_error("minibash: fork: ");
+        return 1;
     }
-}
-
-/* Normalize a wait status to a shell-like exit status. */
-static int
-status_to_exitcode(int st)
-{
-    if (WIFEXITED(st))  return WEXITSTATUS(st);
-    if (WIFSIGNALED(st)) return 128 + WTERMSIG(st);
-    return 1;
+    ops->started(ctx, i, pid);
+    return -1;
 }
 
 int
-piping_run_pipeline_with_io(TSNode pipeline_node,
-                            int pipe_in_fd,
-                            int pipe_out_fd,
-                            piping_exec_child_cb exec_cb)
+piping_start(const struct ir_node *pl, int in_fd, int out_fd,
+             const struct piping_ops *ops, void *ctx)
 {
-    if (!exec_cb) return 1; /* invalid usage */
-
-    /* Collect commands */
-    TSNode *cmds = NULL;
-    int ncmds = collect_pipeline_commands(pipeline_node, &cmds);
-    if (ncmds < 0) return 1;       /* OOM */
-    if (ncmds == 0) return 0;      /* empty pipeline => no-op success */
-
-    /* Create N-1 pipes if needed */
-    int (*pipes)[2] = NULL;
-    if (ncmds > 1) {
-        pipes = (int (*)[2])calloc((size_t)(ncmds - 1), sizeof *pipes);
-        if (!pipes) { free(cmds); return 1; }
-        for (int i = 0; i < ncmds - 1; i++) {
-            if (pipe(pipes[i]) != 0) {
-                for (int k = 0; k < i; k++) {
-                    close(pipes[k][0]);
-                    close(pipes[k][1]);
-                }
-                free(pipes);
-                free(cmds);
-                return 1;
+    uint32_t n = pl->nkids;
+    int prev = in_fd;           /* stdin of the next stage to start */
+    int result = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        struct piping_stage st = { .in = prev, .out = out_fd };
+        int next[2] = { -1, -1 };
+        if (i < n - 1) {
+            if (pipe2(next, O_CLOEXEC) != 0) {
+                utils_error("minibash: pipe: ");
+                result = 1;
+                break;
             }
+            st.out = next[1];
+            st.err_too = (pl->kids[i].flags & IR_F_PIPE_STDERR) != 0;
         }
-    }
 
-    pid_t *pids = (pid_t *)calloc((size_t)ncmds, sizeof *pids);
-    if (!pids) {
-        close_all_pipes(pipes, ncmds);
-        free(pipes);
-        free(cmds);
-        return 1;
+        enum piping_how how = ops->how(ctx, i);
+        if (how == PIPING_INLINE && i == n - 1)
+            how = PIPING_FORK;
+        int rc = start_stage(i, how, &st, next[0], in_fd, out_fd, ops, ctx);
+        if (i == n - 1)
+            result = rc;
+
+        if (prev != in_fd)
+            close(prev);
+        if (next[1] != -1 && how != PIPING_INLINE)
+            close(next[1]);     /* an inline stage has taken it over */
+        prev = next[0];
     }
+    if (prev != in_fd && prev != -1)
+        close(prev);
+    return result;
+}
 
-    /* Fork/wire children */
-    for (int i = 0; i < ncmds; i++) {
-        pid_t pid = fork();
-        if (pid == 0) {
-            /* ----- child ----- */
-
-            /* stdin wiring */
-            if (i == 0) {
-                if (pipe_in_fd != -1) {
-                    (void)dup2(pipe_in_fd, STDIN_FILENO);
-                }
-            } else {
-                (void)dup2(pipes[i - 1][0], STDIN_FILENO);
-            }
-
-            /* stdout wiring */
-            if (i == ncmds - 1) {
-                if (pipe_out_fd != -1) {
-                    (void)dup2(pipe_out_fd, STDOUT_FILENO);
-                }
-            } else {
-                (void)dup2(pipes[i][1], STDOUT_FILENO);
-            }
-
-            /* close all pipe FDs in the child (now that dup2 is done) */
-            close_all_pipes(pipes, ncmds);
+/* ---------- feeding a pipe from the shell ---------- */
 
-            /* close the optional in/out FDs in the child if they were used */
-            if (i == 0 && pipe_in_fd  != -1) close(pipe_in_fd);
-            if (i == ncmds - 1 && pipe_out_fd != -1) close(pipe_out_fd);
+struct feed {
+    int fd;
+    struct feed *next;
+    size_t len, off;
+    char buf[];
+};
 
-            /* hand off to caller-provided exec callback (should not return) */
-            exec_cb(cmds[i]);
+/* Pipes still being fed.  A forked stage must not keep their write ends
+   open, or their readers would never see EOF. */
+static struct feed *feeds;
 
-            /* if it returns, fail hard */
-            _exit(127);
-        }
+static void
+close_feeds(void)
+{
+    for (struct feed *f = feeds; f; f = f->next)
+        close(f->fd);
+    feeds = NULL;
+}
 
-        if (pid < 0) {
-            /* fork failed: clean up parent, reap any started children */
-            int saved_errno = errno;
+/* write() that turns SIGPIPE into a plain EPIPE: a stage that stops
+   reading must not kill the shell. */
+static ssize_t
+feed_write(int fd, const char *buf, size_t len)
+{
+    sigset_t pipe_set, old;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    sigprocmask(SIG_BLOCK, &pipe_set, &old);
+
+    ssize_t n = write(fd, buf, len);
+    if (n < 0 && errno == EPIPE) {
+        int saved = errno;
+        struct timespec zero = { 0, 0 };
+        (void)sigtimedwait(&pipe_set, NULL, &zero);     /* discard it */
+        errno = saved;
+    }
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return n;
+}
 
-            close_all_pipes(pipes, ncmds);
-            free(pipes);
+/* Write as much as the pipe takes.  Returns false once done with fd. */
+static bool
+feed_some(int fd, const char *buf, size_t len, size_t *off)
+{
+    while (*off < len) {
+        ssize_t n = feed_write(fd, buf + *off, len - *off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return errno == EAGAIN;
+        *off += (size_t)n;
+    }
+    return false;
+}
 
-            for (int k = 0; k < i; k++) {
-                int st; (void)waitpid(pids[k], &st, 0);
+static void
+feed_ready(int fd, uint32_t events, void *arg)
+{
+    struct feed *f = arg;
+    if (!feed_some(fd, f->buf, f->len, &f->off)) {
+        events_del(fd);
+        close(fd);
+        for (struct feed **pp = &feeds; *pp; pp = &(*pp)->next) {
+            if (*pp == f) {
+                *pp = f->next;
+                break;
             }
-
-            free(pids);
-            free(cmds);
-            (void)saved_errno;
-            return 1;
         }
-
-        /* parent */
-        pids[i] = pid;
-    }
-
-    /* parent closes its pipe FDs; caller retains ownership of pipe_in_fd/out_fd */
-    close_all_pipes(pipes, ncmds);
-    free(pipes);
-    free(cmds);
-
-    /* wait for all children; return the last one's exit status */
-    int last_status = 0;
-    for (int i = 0; i < ncmds; i++) {
-        int st = 0;
-        (void)waitpid(pids[i], &st, 0);
-        if (i == ncmds - 1) last_status = st;
+        free(f);
     }
-    free(pids);
-
-    return status_to_exitcode(last_status);
 }
 
-int
-piping_handle_pipeline(TSNode pipeline_node, piping_exec_child_cb exec_cb)
+void
+piping_feed(int fd, const void *buf, size_t len)
 {
-    return piping_run_pipeline_with_io(pipeline_node, -1, -1, exec_cb);
+    size_t off = 0;
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0
+        || !feed_some(fd, buf, len, &off)) {
+        close(fd);
+        return;
+    }
+
+    struct feed *f = malloc(sizeof *f + (len - off));
+    if (f == NULL) {
+        close(fd);
+        return;
+    }
+    f->fd = fd;
+    f->len = len - off;
+    f->off = 0;
+    memcpy(f->buf, (const char *)buf + off, len - off);
+    if (events_add(fd, EPOLLOUT, feed_ready, f) != 0) {
+        close(fd);
+        free(f);
+        return;
+    }
+    f->next = feeds;
+    feeds = f;
 }
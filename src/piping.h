@@ -1,20 +1,71 @@
 #pragma once
-#include <tree_sitter/api.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
 
-#ifdef __cplusplus
-extern "C" {
-#endif
+#include "ir.h"
 
-typedef void (*piping_exec_child_cb)(TSNode command_node);
+/*
+ * Pipeline wiring.
+ *
+ * The engine creates the pipes and decides which descriptors each stage
+ * gets; the caller decides how a stage runs, through callbacks.  Pipe i
+ * is created just before stage i starts, and the shell drops its ends
+ * as soon as the stages on both sides hold theirs, so it never has more
+ * than three pipe descriptors open (besides those it is feeding, see
+ * piping_feed()) and a forked stage has a fixed number of stray
+ * descriptors to close.  All pipe ends are close-on-exec, so an
+ * exec'ed stage needs no cleanup at all.  Starting an N-stage pipeline
+ * costs O(N) system calls.
+ *
+ * Waiting is left to the caller, which learns each pid from started().
+ */
 
-int piping_run_pipeline_with_io(TSNode pipeline_node,
-                                int pipe_in_fd,
-                                int pipe_out_fd,
-                                piping_exec_child_cb exec_cb);
+/* The descriptors of one stage; -1 means the shell's own. */
+struct piping_stage {
+    int in;
+    int out;
+    bool err_too;       /* stderr goes to out as well (|&) */
+};
 
-int piping_handle_pipeline(TSNode pipeline_node,
-                           piping_exec_child_cb exec_cb);
+enum piping_how {
+    PIPING_SPAWN,       /* ops->spawn starts it, no shell code in the child */
+    PIPING_FORK,        /* forked; ops->run_child runs in the child */
+    PIPING_INLINE,      /* run in the shell by ops->run_inline; only for a
+                           stage that is not the last, else it is forked */
+};
 
-#ifdef __cplusplus
-}
-#endif
+struct piping_ops {
+    enum piping_how (*how)(void *ctx, uint32_t i);
+
+    /* PIPING_SPAWN: start stage i with the descriptors in st.  Return 0
+       and set *pid, or the stage's exit status if it did not start. */
+    int (*spawn)(void *ctx, uint32_t i, const struct piping_stage *st, pid_t *pid);
+
+    /* PIPING_FORK: runs in the child, with the stage's descriptors on
+       0, 1 (and 2).  Must not return. */
+    void (*run_child)(void *ctx, uint32_t i);
+
+    /* PIPING_INLINE: run stage i in the shell.  st->out is the write end
+       of a pipe which the callback takes over, typically by handing
+       the stage's output to piping_feed().  Such a stage has no process
+       and its status is not needed: only the last stage's is. */
+    void (*run_inline)(void *ctx, uint32_t i, const struct piping_stage *st);
+
+    /* In the shell, for each stage that started. */
+    void (*started)(void *ctx, uint32_t i, pid_t pid);
+};
+
+/* Start the stages of pl, an IR_PIPELINE.  in_fd is the first stage's
+   stdin and out_fd the last stage's stdout (-1: the shell's own); they
+   stay open.  Returns -1 if the last stage started, otherwise the exit
+   status that stands in for it. */
+int piping_start(const struct ir_node *pl, int in_fd, int out_fd,
+                 const struct piping_ops *ops, void *ctx);
+
+/* Write len bytes of buf into fd, the write end of a pipe, and close it.
+   Whatever the pipe cannot take right away is copied and written from
+   the event loop (events.h) as the reader drains it, so the shell never
+   blocks on a stage that has not started yet.  If the reader goes away
+   the rest is dropped; the shell gets EPIPE, never SIGPIPE. */
+void piping_feed(int fd, const void *buf, size_t len);
@@ -0,0 +1,368 @@
+// redir.c
+// Redirection plans: built once per command, applied with dup2 or as
+// posix_spawn file actions, or just read by a builtin's io_ctx.
+
+#define _GNU_SOURCE
+#include "redir.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "expand.h"
+#include "utils.h"
+
+/* Copies made to move a descriptor out of the way start here, above
+   the ones scripts usually name. */
+#define REDIR_HIGH_FD 10
+
+/*
+ * Append targets kept open between commands.  `echo "$x" >>log` in a
+ * loop would otherwise open and close the log every iteration; with
+ * O_APPEND every write goes to the end of the file anyway, so one
+ * descriptor serves them all for as long as the name still refers to
+ * the same file.  redir_cache_drop() is called whenever that may stop
+ * being true.
+ */
+#define REDIR_CACHE_SIZE 8
+
+static struct {
+    char *path;
+    int fd;
+} cache[REDIR_CACHE_SIZE];
+static int ncache;
+
+void
+redir_cache_drop(void)
+{
+    for (int i = 0; i < ncache; i++) {
+        close(cache[i].fd);
+        free(cache[i].path);
+    }
+    ncache = 0;
+}
+
+/* Open path for appending, or hand out the descriptor of an earlier
+   open.  *cached is set if the cache keeps it; if not, the caller must
+   close it. */
+static int
+open_append(const char *path, bool *cached)
+{
+    for (int i = 0; i < ncache; i++) {
+        if (strcmp(cache[i].path, path) == 0) {
+            *cached = true;
+            return cache[i].fd;
+        }
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    *cached = false;
+    if (fd >= 0 && ncache < REDIR_CACHE_SIZE) {
+        char *copy = strdup(path);
+        if (copy) {
+            cache[ncache].path = copy;
+            cache[ncache++].fd = fd;
+            *cached = true;
+        }
+    }
+    return fd;
+}
+
+static int
+slot_index(const struct redir_plan *p, int fd)
+{
+    for (int i = 0; i < p->nslots; i++)
+        if (p->slots[i].fd == fd)
+            return i;
+    return -1;
+}
+
+/* Make fd refer to src.  Returns 0, or -1 if the plan is full. */
+static int
+set_slot(struct redir_plan *p, int fd, int src)
+{
+    int i = slot_index(p, fd);
+    if (i < 0) {
+        if (p->nslots == REDIR_MAX) {
+            fprintf(stderr, "minibash: too many redirections\n");
+            return -1;
+        }
+        i = p->nslots++;
+        p->slots[i].fd = fd;
+    }
+    p->slots[i].src = src;
+    return 0;
+}
+
+static int
+own(struct redir_plan *p, int fd)
+{
+    if (p->nowned == (int)(sizeof p->owned / sizeof p->owned[0])) {
+        close(fd);
+        fprintf(stderr, "minibash: too many redirections\n");
+        return -1;
+    }
+    p->owned[p->nowned++] = fd;
+    return 0;
+}
+
+void
+redir_plan_init(struct redir_plan *p, int in_fd, int out_fd, int err_fd)
+{
+    p->nslots = p->nowned = 0;
+    if (in_fd != -1)  (void)set_slot(p, STDIN_FILENO, in_fd);
+    if (out_fd != -1) (void)set_slot(p, STDOUT_FILENO, out_fd);
+    if (err_fd != -1) (void)set_slot(p, STDERR_FILENO, err_fd);
+}
+
+int
+redir_plan_src(const struct redir_plan *p, int fd)
+{
+    int i = slot_index(p, fd);
+    return i < 0 ? fd : p->slots[i].src;
+}
+
+bool
+redir_plan_touches(const struct redir_plan *p, int fd)
+{
+    int i = slot_index(p, fd);
+    return i >= 0 && p->slots[i].src != fd;
+}
+
+void
+redir_plan_release(struct redir_plan *p)
+{
+    for (int i = 0; i < p->nowned; i++)
+        close(p->owned[i]);
+    p->nowned = 0;
+}
+
+/* A descriptor a script may name in n>&m: one it inherited or opened
+   itself.  Those the shell keeps for its own use are close-on-exec. */
+static bool
+script_fd(int fd)
+{
+    int flags = fcntl(fd, F_GETFD);
+    return flags >= 0 && (fd <= STDERR_FILENO || !(flags & FD_CLOEXEC));
+}
+
+static int
+open_flags(int op)
+{
+    switch (op) {
+    case IR_REDIR_IN:           return O_RDONLY;
+    case IR_REDIR_OUT:
+    case IR_REDIR_CLOBBER:
+    case IR_REDIR_OUT_ERR:      return O_WRONLY | O_CREAT | O_TRUNC;
+    case IR_REDIR_APPEND:
+    case IR_REDIR_APPEND_ERR:   return O_WRONLY | O_CREAT | O_APPEND;
+    case IR_REDIR_RDWR:         return O_RDWR | O_CREAT;
+    default:                    return -1;
+    }
+}
+
+/* n>&m, n<&m and n>&- */
+static int
+add_dup(struct redir_plan *p, const struct ir_redir *r, const char *word)
+{
+    if (strcmp(word, "-") == 0)
+        return set_slot(p, r->fd, -1);
+
+    char *end;
+    long m = strtol(word, &end, 10);
+    if (word[0] < '0' || word[0] > '9' || *end != '\0' || m > INT_MAX) {
+        fprintf(stderr, "minibash: %s: ambiguous redirect\n", word);
+        return -1;
+    }
+    int src = redir_plan_src(p, (int)m);
+    if (src < 0 || (slot_index(p, (int)m) < 0 && !script_fd(src))) {
+        fprintf(stderr, "minibash: %s: bad file descriptor\n", word);
+        return -1;
+    }
+    return set_slot(p, r->fd, src);
+}
+
+static int
+add_one(struct redir_plan *p, const struct ir_redir *r, const char *word)
+{
+    int op = r->op;
+    if (op == IR_REDIR_DUP_IN || op == IR_REDIR_DUP_OUT) {
+        /* >&word with a file name, not a descriptor, is &>word */
+        bool is_fd = strcmp(word, "-") == 0 || (word[0] >= '0' && word[0] <= '9');
+        if (is_fd || op == IR_REDIR_DUP_IN || r->fd != STDOUT_FILENO)
+            return add_dup(p, r, word);
+        op = IR_REDIR_OUT_ERR;
+    }
+
+    int flags = open_flags(op);
+    if (flags < 0) {
+        fprintf(stderr, "minibash: redirection not supported\n");
+        return -1;
+    }
+    bool cached = false;
+    int fd = (flags & O_APPEND) ? open_append(word, &cached)
+                                : open(word, flags | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        utils_error("minibash: cannot open for %s: %s: ",
+                    op == IR_REDIR_IN ? "input" : "output", word);
+        return -1;
+    }
+    if ((!cached && own(p, fd) != 0) || set_slot(p, r->fd, fd) != 0)
+        return -1;
+    if (op == IR_REDIR_OUT_ERR || op == IR_REDIR_APPEND_ERR)
+        return set_slot(p, STDERR_FILENO, fd);
+    return 0;
+}
+
+int
+redir_plan_add(struct redir_plan *p, const struct ir_redir *redirs, uint32_t n,
+               struct arena *a, int last_status)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        struct arena_mark mark = arena_mark(a);
+        int err = EXPAND_OK;
+        char *word = expand_word(a, &redirs[i].target, last_status, &err);
+        int rc = add_one(p, &redirs[i], word);
+        arena_reset(a, mark);
+        if (rc != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Lowest descriptor above every one the plan assigns to. */
+static int
+first_free_fd(const struct redir_plan *p)
+{
+    int low = REDIR_HIGH_FD;
+    for (int i = 0; i < p->nslots; i++)
+        if (p->slots[i].fd >= low)
+            low = p->slots[i].fd + 1;
+    return low;
+}
+
+/* Make the slots independent of the order they are applied in: no
+   source may be a descriptor that another slot replaces.  A descriptor
+   the shell opened that happens to have its target's number is moved
+   as well, as dup2() onto itself would leave it close-on-exec. */
+static int
+untangle(struct redir_plan *p)
+{
+    int low = first_free_fd(p);
+    for (int i = 0; i < p->nslots; i++) {
+        struct redir_slot *s = &p->slots[i];
+        if (s->src < 0)
+            continue;
+        bool move;
+        if (s->src == s->fd) {
+            int flags = fcntl(s->src, F_GETFD);
+            move = flags >= 0 && (flags & FD_CLOEXEC);
+        } else {
+            int j = slot_index(p, s->src);
+            move = j >= 0 && p->slots[j].src != p->slots[j].fd;
+        }
+        if (!move)
+            continue;
+        int fd = fcntl(s->src, F_DUPFD_CLOEXEC, low);
+        if (fd < 0) {
+            utils_error("minibash: %d: ", s->src);
+            return -1;
+        }
+        if (own(p, fd) != 0)
+            return -1;
+        s->src = fd;
+    }
+    return 0;
+}
+
+int
+redir_plan_spawn(struct redir_plan *p, struct spawn_plan *sp)
+{
+    if (untangle(p) != 0)
+        return -1;
+    if (sp->nowned + p->nowned > SPAWN_PLAN_MAX_OWNED) {
+        fprintf(stderr, "minibash: too many redirections\n");
+        return -1;
+    }
+    for (int i = 0; i < p->nslots; i++) {
+        const struct redir_slot *s = &p->slots[i];
+        int rc = s->src < 0 ? spawn_plan_close(sp, s->fd)
+                            : spawn_plan_dup2(sp, s->src, s->fd);
+        if (rc != 0) {
+            errno = rc;
+            utils_error("minibash: redirection: ");
+            return -1;
+        }
+    }
+    for (int i = 0; i < p->nowned; i++)
+        (void)spawn_plan_adopt(sp, p->owned[i]);
+    p->nowned = 0;
+    return 0;
+}
+
+/* A plan about to dup2 over a cached descriptor takes it over, or the
+   cache would hand out whatever the plan puts there. */
+static int
+uncache_targets(struct redir_plan *p)
+{
+    for (int i = 0; i < p->nslots; i++) {
+        const struct redir_slot *s = &p->slots[i];
+        for (int j = 0; j < ncache && s->src != s->fd; j++) {
+            if (cache[j].fd != s->fd)
+                continue;
+            free(cache[j].path);
+            cache[j] = cache[--ncache];
+            if (own(p, s->fd) != 0)
+                return -1;
+            break;
+        }
+    }
+    return 0;
+}
+
+int
+redir_plan_apply(struct redir_plan *p, struct redir_saved *saved)
+{
+    if (saved)
+        saved->n = 0;
+    if (uncache_targets(p) != 0 || untangle(p) != 0)
+        return -1;
+
+    int low = first_free_fd(p);
+    for (int i = 0; i < p->nslots; i++) {
+        const struct redir_slot *s = &p->slots[i];
+        if (s->src == s->fd)
+            continue;
+        if (saved) {
+            /* -1 (EBADF) if it was closed: restoring closes it again */
+            int copy = fcntl(s->fd, F_DUPFD_CLOEXEC, low);
+            saved->fds[saved->n++] = (struct redir_slot){ s->fd, copy };
+        }
+        if (s->src < 0) {
+            close(s->fd);
+        } else if (dup2(s->src, s->fd) < 0) {
+            utils_error("minibash: %d: ", s->fd);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void
+redir_restore(struct redir_saved *saved)
+{
+    for (int i = saved->n - 1; i >= 0; i--) {
+        const struct redir_slot *s = &saved->fds[i];
+        if (s->src < 0) {
+            close(s->fd);
+        } else {
+            dup2(s->src, s->fd);
+            close(s->src);
+        }
+    }
+    saved->n = 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <stdbool.h>
+
+#include "arena.h"
+#include "ir.h"
+#include "spawn.h"
+
+/*
+ * Redirections, resolved.
+ *
+ * A command's redirections are evaluated left to right into a plan: for
+ * each descriptor the command will see, the shell descriptor it is to
+ * be (a file the plan opened, a pipe, one of the shell's own fds) or
+ * "closed".  Nothing is dup2'ed while the plan is built, so the same
+ * plan serves a builtin that runs in the shell (its io_ctx just takes
+ * the resolved fds, and releasing the plan is all the undoing needed),
+ * a spawned command (as file actions) and a forked child.
+ *
+ * n>&m looks m up in the plan built so far, so `cmd >>log 2>&1` sends
+ * both descriptors to the log with one open() and two dup2()s.
+ */
+
+/* Distinct descriptors one command can redirect. */
+#define REDIR_MAX 16
+
+struct redir_slot {
+    int fd;             /* descriptor the command sees */
+    int src;            /* shell descriptor it refers to; -1: closed */
+};
+
+struct redir_plan {
+    int nslots;
+    struct redir_slot slots[REDIR_MAX];
+    int nowned;
+    int owned[2 * REDIR_MAX];   /* opened for the plan, close-on-exec */
+};
+
+/* Saved descriptors, for redirections applied to the shell itself. */
+struct redir_saved {
+    int n;
+    struct redir_slot fds[REDIR_MAX];   /* src: copy of the original, or -1 */
+};
+
+/* Start a plan from the command's pipes: in_fd, out_fd and err_fd
+   (each -1 if not redirected) become fds 0, 1 and 2. */
+void redir_plan_init(struct redir_plan *p, int in_fd, int out_fd, int err_fd);
+
+/* Add redirections in order; target words are expanded in a, which is
+   reset afterwards.  Returns 0, or -1 after printing a message (the
+   plan still needs redir_plan_release()). */
+int redir_plan_add(struct redir_plan *p, const struct ir_redir *redirs, uint32_t n,
+                   struct arena *a, int last_status);
+
+/* The shell descriptor fd refers to under the plan, -1 if closed. */
+int redir_plan_src(const struct redir_plan *p, int fd);
+
+/* True if the plan changes fd. */
+bool redir_plan_touches(const struct redir_plan *p, int fd);
+
+/* Close the descriptors the plan opened. */
+void redir_plan_release(struct redir_plan *p);
+
+/* Express the plan as file actions.  The plan's descriptors are handed
+   over to sp, which closes them.  Returns 0 or -1. */
+int redir_plan_spawn(struct redir_plan *p, struct spawn_plan *sp);
+
+/* dup2 the plan into place in this process.  If saved is not NULL, the
+   descriptors it replaces are kept there for redir_restore().
+   Returns 0 or -1 after printing a message. */
+int redir_plan_apply(struct redir_plan *p, struct redir_saved *saved);
+
+/* Put back what redir_plan_apply() saved. */
+void redir_restore(struct redir_saved *saved);
+
+/* Descriptors opened for >> and &>> are cached by path and reused by
+   later plans; they are not the plans' to close.  Drop the cache when
+   a path may no longer name the same file: after a cd, when a child
+   process that could rename or unlink it starts, when a loop is left,
+   and at the end of a script or command line. */
+void redir_cache_drop(void);
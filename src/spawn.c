@@ -0,0 +1,131 @@
+// spawn.c
+// posix_spawn-based launcher for external commands.
+//
+// glibc implements posix_spawn with clone(CLONE_VM|CLONE_VFORK), so the
+// child shares the shell's address space until it execs: no page tables
+// are copied no matter how large the shell's resident set is.  That only
+// works because the child runs no shell code; everything it has to do
+// before exec is expressed as file actions.
+
+#define _GNU_SOURCE
+#include "spawn.h"
+#include "pathcache.h"
+#include "vars.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+int
+spawn_plan_init(struct spawn_plan *plan)
+{
+    plan->nowned = 0;
+    return posix_spawn_file_actions_init(&plan->actions);
+}
+
+int
+spawn_plan_dup2(struct spawn_plan *plan, int fd, int newfd)
+{
+    if (fd == newfd)
+        return 0;   /* nothing to do; the fd is inherited as is */
+    return posix_spawn_file_actions_adddup2(&plan->actions, fd, newfd);
+}
+
+int
+spawn_plan_close(struct spawn_plan *plan, int fd)
+{
+    return posix_spawn_file_actions_addclose(&plan->actions, fd);
+}
+
+int
+spawn_plan_adopt(struct spawn_plan *plan, int fd)
+{
+    if (plan->nowned == SPAWN_PLAN_MAX_OWNED)
+        return EMFILE;
+    plan->owned[plan->nowned++] = fd;
+    return 0;
+}
+
+void
+spawn_plan_destroy(struct spawn_plan *plan)
+{
+    for (int i = 0; i < plan->nowned; i++)
+        close(plan->owned[i]);
+    if (plan->nowned >= 0)
+        posix_spawn_file_actions_destroy(&plan->actions);
+    plan->nowned = -1;
+}
+
+/* posix_spawn(), plus execvp()'s fallback for a file that is not an
+   executable format: a script without #! is run by /bin/sh. */
+static int
+spawn_path(pid_t *out_pid, const char *path, const posix_spawn_file_actions_t *fa,
+           const posix_spawnattr_t *attr, char **argv)
+{
+    int rc = posix_spawn(out_pid, path, fa, attr, argv, vars_environ());
+    if (rc != ENOEXEC)
+        return rc;
+
+    size_t argc = 0;
+    while (argv[argc])
+        argc++;
+    char **sh_argv = malloc((argc + 2) * sizeof *sh_argv);
+    if (!sh_argv)
+        return ENOMEM;
+    sh_argv[0] = "/bin/sh";
+    sh_argv[1] = (char *)path;
+    memcpy(sh_argv + 2, argv + 1, argc * sizeof *sh_argv);     /* with the NULL */
+    rc = posix_spawn(out_pid, "/bin/sh", fa, attr, sh_argv, vars_environ());
+    free(sh_argv);
+    return rc;
+}
+
+int
+spawn_command(char **argv, struct spawn_plan *plan, pid_t *out_pid)
+{
+    posix_spawnattr_t attr;
+    int rc = posix_spawnattr_init(&attr);
+    if (rc != 0)
+        return rc;
+
+    /* The shell runs with SIGCHLD blocked while executing a script;
+       the child must not inherit that. */
+    sigset_t empty;
+    sigemptyset(&empty);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    const posix_spawn_file_actions_t *fa = plan ? &plan->actions : NULL;
+    if (strchr(argv[0], '/') != NULL) {
+        rc = spawn_path(out_pid, argv[0], fa, &attr, argv);
+    } else {
+        /* exec the hashed location directly; if it vanished, search once more */
+        const char *path = pathcache_lookup(argv[0]);
+        rc = path ? spawn_path(out_pid, path, fa, &attr, argv) : ENOENT;
+        if (path && (rc == ENOENT || rc == ENOTDIR)) {
+            pathcache_forget(argv[0]);
+            path = pathcache_lookup(argv[0]);
+            rc = path ? spawn_path(out_pid, path, fa, &attr, argv) : ENOENT;
+        }
+    }
+
+    posix_spawnattr_destroy(&attr);
+    return rc;
+}
+
+int
+spawn_error_status(const char *argv0, int err, int err_fd)
+{
+    if (err == ENOENT && strchr(argv0, '/') == NULL) {
+        if (err_fd >= 0)
+            dprintf(err_fd, "minibash: %s: command not found\n", argv0);
+        return 127;
+    }
+    if (err_fd >= 0)
+        dprintf(err_fd, "minibash: %s: %s\n", argv0, strerror(err));
+    return (err == ENOENT) ? 127 : 126;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <spawn.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Launching external commands without a full fork().
+ *
+ * A spawn_plan collects the fd wiring a child needs (dup2/close) as
+ * posix_spawn file actions, so the child never runs shell code between
+ * clone(CLONE_VM|CLONE_VFORK) and execve().  Descriptors the parent opened
+ * only for the child (redirection targets) can be handed to the plan and
+ * are closed in the parent by spawn_plan_destroy().
+ */
+
+#define SPAWN_PLAN_MAX_OWNED 32
+
+struct spawn_plan {
+    posix_spawn_file_actions_t actions;
+    int owned[SPAWN_PLAN_MAX_OWNED];   /* parent fds closed on destroy */
+    int nowned;
+};
+
+/* Initialize an empty plan.  Returns 0 or an errno value. */
+int spawn_plan_init(struct spawn_plan *plan);
+
+/* In the child, make newfd refer to fd.  Returns 0 or an errno value. */
+int spawn_plan_dup2(struct spawn_plan *plan, int fd, int newfd);
+
+/* In the child, close fd.  Returns 0 or an errno value. */
+int spawn_plan_close(struct spawn_plan *plan, int fd);
+
+/* Transfer ownership of a parent fd to the plan (closed on destroy).
+   Returns 0, or EMFILE if the plan cannot track more descriptors. */
+int spawn_plan_adopt(struct spawn_plan *plan, int fd);
+
+/* Release the plan and close all adopted descriptors.  Safe to call twice. */
+void spawn_plan_destroy(struct spawn_plan *plan);
+
+/* Spawn argv[0] with the given plan (may be NULL).  A name without a '/'
+   is resolved through the command location cache (pathcache.h).
+   A file without an executable format (a script with no #! line) is run
+   by /bin/sh, as execvp() does.  The child starts with an empty signal
+   mask.
+   On success stores the pid in *out_pid and returns 0; otherwise returns
+   the errno value reported by posix_spawn (e.g., ENOENT, EACCES). */
+int spawn_command(char **argv, struct spawn_plan *plan, pid_t *out_pid);
+
+/* Map a spawn error to the conventional shell status (127 or 126) and
+   print a diagnostic for argv0 on err_fd, the descriptor the command's
+   stderr was to be (nothing if -1: its stderr was closed). */
+int spawn_error_status(const char *argv0, int err, int err_fd);
@@ -0,0 +1,218 @@
+// vars.c
+// Shell variable store backed by a tommy_hashdyn.
+
+#include "vars.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tommyds/tommyhashdyn.h"
+#include "tommyds/tommyhash.h"
+#include "utils.h"
+
+extern char **environ;
+
+struct shell_var {
+    tommy_node node;
+    size_t namelen;
+    size_t len;         /* of the value */
+    size_t cap;         /* of buf */
+    char *buf;          /* "NAME=VALUE"; NULL until first assigned */
+    bool set;
+    bool exported;
+    char name[];
+};
+
+static tommy_hashdyn shell_vars;        /* name -> struct shell_var */
+
+/* Bumped whenever the environment of a new command would change. */
+static unsigned long env_generation = 1;
+static unsigned long envp_generation;   /* env_generation envp was built at */
+static char **envp;
+static size_t envp_cap;
+
+static tommy_hash_t
+name_hash(const char *name, size_t len)
+{
+    return tommy_hash_u32(0, name, len);
+}
+
+static int
+var_cmp(const void *arg, const void *obj)
+{
+    return strcmp((const char *)arg, ((const struct shell_var *)obj)->name);
+}
+
+static struct shell_var *
+vars_find(const char *name)
+{
+    return tommy_hashdyn_search(&shell_vars, var_cmp, name, name_hash(name, strlen(name)));
+}
+
+struct shell_var *
+vars_intern(const char *name)
+{
+    size_t nlen = strlen(name);
+    tommy_hash_t h = name_hash(name, nlen);
+    struct shell_var *v = tommy_hashdyn_search(&shell_vars, var_cmp, name, h);
+    if (v)
+        return v;
+
+    v = calloc(1, sizeof *v + nlen + 1);
+    if (!v)
+        utils_fatal_error("vars: out of memory");
+    v->namelen = nlen;
+    memcpy(v->name, name, nlen + 1);
+    tommy_hashdyn_insert(&shell_vars, &v->node, v, h);
+    return v;
+}
+
+const char *
+var_value(const struct shell_var *v)
+{
+    return v->set ? v->buf + v->namelen + 1 : NULL;
+}
+
+const char *
+vars_get(const char *name)
+{
+    struct shell_var *v = vars_find(name);
+    return v ? var_value(v) : NULL;
+}
+
+void
+var_assign(struct shell_var *v, const char *val, size_t len)
+{
+    size_t need = v->namelen + 1 + len + 1;
+    if (need > v->cap) {
+        size_t cap = v->cap ? v->cap : 32;
+        while (cap < need)
+            cap *= 2;
+        char *buf = realloc(v->buf, cap);
+        if (!buf)
+            utils_fatal_error("vars: out of memory");
+        memcpy(buf, v->name, v->namelen);
+        buf[v->namelen] = '=';
+        v->buf = buf;
+        v->cap = cap;
+        if (v->exported)
+            env_generation++;       /* envp points at the old buffer */
+    } else if (v->exported && !v->set) {
+        env_generation++;
+    }
+    /* Otherwise envp already points at buf and sees the new value. */
+
+    char *dst = v->buf + v->namelen + 1;
+    memmove(dst, val, len);
+    dst[len] = '\0';
+    v->len = len;
+    v->set = true;
+}
+
+void
+vars_set(const char *name, const char *val)
+{
+    var_assign(vars_intern(name), val, strlen(val));
+}
+
+void
+var_export(struct shell_var *v)
+{
+    if (!v->exported) {
+        v->exported = true;
+        if (v->set)
+            env_generation++;
+    }
+}
+
+void
+vars_unset(const char *name)
+{
+    /* The record stays, since callers may hold on to it. */
+    struct shell_var *v = vars_find(name);
+    if (!v)
+        return;
+    if (v->exported && v->set)
+        env_generation++;
+    v->set = false;
+    v->exported = false;
+}
+
+struct env_builder {
+    char **vec;
+    size_t n, cap;
+};
+
+static void
+add_env_entry(void *arg, void *obj)
+{
+    struct env_builder *b = arg;
+    struct shell_var *v = obj;
+    if (!v->set || !v->exported)
+        return;
+    if (b->n + 1 >= b->cap) {
+        b->cap = b->cap ? 2 * b->cap : 64;
+        b->vec = realloc(b->vec, b->cap * sizeof *b->vec);
+        if (!b->vec)
+            utils_fatal_error("vars: out of memory");
+    }
+    b->vec[b->n++] = v->buf;
+}
+
+char **
+vars_environ(void)
+{
+    if (envp_generation == env_generation)
+        return envp;
+
+    struct env_builder b = { envp, 0, envp_cap };
+    tommy_hashdyn_foreach_arg(&shell_vars, add_env_entry, &b);
+    if (b.cap == 0) {
+        b.cap = 1;
+        b.vec = malloc(sizeof *b.vec);
+        if (!b.vec)
+            utils_fatal_error("vars: out of memory");
+    }
+    b.vec[b.n] = NULL;
+    envp = b.vec;
+    envp_cap = b.cap;
+    envp_generation = env_generation;
+    return envp;
+}
+
+void
+vars_init(void)
+{
+    tommy_hashdyn_init(&shell_vars);
+    for (char **e = environ; *e; e++) {
+        const char *eq = strchr(*e, '=');
+        if (!eq)
+            continue;
+        char *name = strndup(*e, (size_t)(eq - *e));
+        if (!name)
+            utils_fatal_error("vars: out of memory");
+        struct shell_var *v = vars_intern(name);
+        var_assign(v, eq + 1, strlen(eq + 1));
+        var_export(v);
+        free(name);
+    }
+}
+
+static void
+var_free(void *obj)
+{
+    struct shell_var *v = obj;
+    free(v->buf);
+    free(v);
+}
+
+void
+vars_done(void)
+{
+    tommy_hashdyn_foreach(&shell_vars, var_free);
+    tommy_hashdyn_done(&shell_vars);
+    free(envp);
+    envp = NULL;
+    envp_cap = 0;
+    envp_generation = 0;
+}
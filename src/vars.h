@@ -0,0 +1,46 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Shell variables.
+ *
+ * Variables live in a hash table owned by the shell, not in environ.
+ * Each name is interned once in a shell_var record that is never freed
+ * while the shell runs, so a caller that assigns the same variable
+ * repeatedly (a for loop) can look it up once and keep the handle.
+ * Values are kept in a growable buffer holding "NAME=VALUE", which is
+ * updated in place and doubles as the variable's environment entry.
+ *
+ * The envp array handed to execve()/posix_spawn() is rebuilt only when
+ * exported state changed since it was last built, which is tracked
+ * with a generation counter.
+ */
+
+struct shell_var;
+
+/* Import environ (all imported variables are exported) / release all. */
+void vars_init(void);
+void vars_done(void);
+
+/* Return the record for name, creating an unset one if needed. */
+struct shell_var *vars_intern(const char *name);
+
+/* Return the value of a variable, or NULL if it is unset. */
+const char *vars_get(const char *name);
+const char *var_value(const struct shell_var *v);
+
+/* Assign a value of len bytes. */
+void var_assign(struct shell_var *v, const char *val, size_t len);
+void vars_set(const char *name, const char *val);
+
+/* Mark a variable for export to the environment of commands. */
+void var_export(struct shell_var *v);
+
+/* Unset a variable; it also loses its export attribute. */
+void vars_unset(const char *name);
+
+/* A NULL-terminated "NAME=VALUE" array of the exported, set variables.
+   Valid until the next assignment or export. */
+char **vars_environ(void);
+
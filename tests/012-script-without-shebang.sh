@@ -0,0 +1,10 @@
+#
+# An executable file without a #! line is run by /bin/sh, as execvp
+# would run it
+#
+f=/tmp/minibash-noshebang.$$
+echo 'echo "ran with $# args: $1 $2"' > $f
+chmod +x $f
+$f one two
+echo "status $?"
+rm -f $f
@@ -15,3 +15,13 @@ echo $?
 die -divzero
 echo $?
 # 136
+
+# a stopped foreground child is waited for until it is continued and exits
+f=/tmp/minibash-stop-pid
+rm -f $f
+sh -c "while [ ! -s $f ]; do sleep 0.1; done; kill -CONT \$(cat $f)" &
+sh -c "echo \$\$ > $f; kill -STOP \$\$; exit 4"
+echo $?
+# 4
+wait
+rm -f $f
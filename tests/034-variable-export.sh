@@ -0,0 +1,24 @@
+#
+# Shell variables are only passed to commands once exported.
+#
+x=5
+printenv x
+echo "$x" $(echo $x)
+export x
+printenv x
+x=7
+printenv x
+unset x
+printenv x
+echo "[$x]"
+export y
+printenv y
+y=3
+printenv y
+for i in a b; do printenv i; echo $i; done
+export i
+for i in c d; do printenv i; done
+u=x
+n=3
+export V$((n))=$u W$n=$u X${n}y=1
+printenv V3 W3 X3y
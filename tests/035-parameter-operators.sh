@@ -0,0 +1,37 @@
+#
+# ${name<op>...}: length, defaults, substrings, prefix/suffix trimming,
+# replacement and case conversion.  ${name:?} ends the script.
+#
+v="hello world.tar.gz"
+p=/usr/local/lib/libfoo.so.1
+e=
+echo "${#v} ${#e} ${#nope}"
+echo "${e:-def} ${nope:-def} [${e-def}] ${v:-def}"
+echo "[${e:+alt}] ${v:+alt} ${e+alt} [${nope+alt}]"
+echo "${z:=assigned} $z"
+echo "${v:6} ${v:6:5} ${v: -6} ${v: -6:2} ${v:2:-3} [${v:100}]"
+echo "${v#*.} ${v##*.} ${v%.*} ${v%%.*}"
+echo "${p##*/} ${p%/*} ${p#/usr} ${p%.1}"
+echo "${v#h?l} ${v##h*o} ${v%[a-z]} ${v%%[.]*}"
+echo "${v/o/0} ${v//o/0} ${v/#hello/bye} ${v/%gz/xz} ${v//[aeiou]/_}"
+echo "${v/o*/X} ${v//l?/L} ${v/#/>} ${v/%/<} ${v//x/y} ${v//o}"
+pat='*.'
+echo "${v#$pat} ${v#"$pat"} ${v/"."/DOT}"
+s='a*b*c'
+echo "${s//\*/+} ${s//"*"/-} ${s#a\*}"
+w="  lead"
+echo "[${w#"${w%%[! ]*}"}]"
+echo "${v^^} ${v^} ${v,,}"
+m="MiXeD CaSe 123"
+echo "${m,,} ${m^^} ${m,}"
+i=2
+echo "${v:i:i+1} ${v/world/$i}"
+echo "[${e/*/r}] [${e//*/r}] [${e/?/r}] [${nope/*/r}] [${nope/#*/r}]"
+echo ${v:3:-20}
+echo "status $?"
+b=$(echo ${y:=set})
+echo "$b [$y]"
+b=$(echo ${nope:?in a subshell})
+echo "status $?"
+echo ${nope:?is required}
+echo "not reached"
@@ -0,0 +1,19 @@
+#
+# Test the command location cache and the hash builtin.
+#
+hash
+hash -p /bin/echo myecho
+myecho runs from the hashed path
+hash -t myecho
+hash -l
+hash -d myecho
+hash -t myecho
+echo $?
+hash -r
+hash
+hash -t nosuch 2>/dev/null
+echo "not found: $?"
+hash -p /bin/echo e2
+echo before
+hash -t e2 | cat
+echo after
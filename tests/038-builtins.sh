@@ -0,0 +1,29 @@
+#
+# Builtins that run inside the shell process.
+#
+true
+echo $?
+false
+echo $?
+test 3 -lt 5
+echo $?
+test abc = abd
+echo $?
+test -d / -a ! -f /
+echo $?
+printf "%s=%d|%-4s|%03x|%c\n" answer 42 ab 255 xyz
+printf "%s-" a b c
+printf "\n"
+export GREETING=hello
+printenv GREETING
+unset -f GREETING
+printenv GREETING
+unset GREETING
+printenv GREETING
+echo $?
+cd /
+pwd
+echo -n "no newline, "
+echo then newline
+exit 3
+echo not reached
@@ -0,0 +1,15 @@
+#
+# Word and list forms: concatenation, escapes, quoting inside words,
+# arguments after a redirection, and chained && / ||.
+#
+x=mini
+y="$x bash"
+echo "$y" '$y' a\ b "q\"q" "\$x" pre${x}post $x$x
+echo "  leading" "trailing  " "  "
+false || false && echo not printed
+false && echo not printed || echo recovered
+true && true && echo both
+echo file > .words.tmp arg; cat .words.tmp
+rm .words.tmp
+for w in one "two words" $x; do echo "<$w>"; done
+if false; then echo no; elif false; then echo no; else echo else-branch; fi
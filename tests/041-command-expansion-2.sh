@@ -0,0 +1,25 @@
+#
+# Command substitution runs in the shell's own evaluator, so it sees
+# unexported variables, and a subshell keeps its changes to itself.
+#
+x=hello
+echo "[$(echo $x)]"
+echo "[$(printf '%s\n\n\n' a b)]"
+echo $(true && echo yes || echo no)
+echo $(cd /; pwd)
+echo $(x=inner; echo $x) $x
+echo $(echo $(echo nested $(echo deep)))
+y=$(echo $x | tr a-z A-Z)
+echo $y
+echo "$(for i in 1 2 3; do printf $i; done)"
+echo $(echo one) "$(echo two; echo three)" $(printf four)
+echo $(sleep 0.2; echo slow) "$(echo fast)"
+x=$(false); echo "false: $?"
+x=$(exit 3); echo "exit 3: $?"
+x=$(echo hi); echo "echo: $?"
+x=$(sleep 0.1; exit 4) y=$(exit 5); echo "last of two: $?"
+for i in 1 2 3; do x=$(exit $i); echo "loop $?"; done
+echo $((j=5)) $(echo "j=$j")
+echo ${k:=7} "$(echo k=$k)"
+n=1
+echo "a$(echo $n)b$((n+=1))c$(echo $n)"
@@ -0,0 +1,31 @@
+#
+# $(( )) and (( )): precedence, assignment operators, ++/--, ternary,
+# comma and base literals.
+#
+echo $((1 + 2 * 3)) $(((1 + 2) * 3)) $((-2 ** 2)) $((2 ** 3 ** 2))
+echo $((7 / -2)) $((-7 % 3)) $((1 << 4 | 1)) $((~5)) $((!0))
+echo $((0x1f)) $((017)) $((2#101)) $((16#ff)) $((64#@))
+echo $((1 && 0)) $((0 || 3)) $((5 > 3 ? 10 : 20)) $((1 ? 0 ? 7 : 8 : 9))
+echo $((x = 3, x *= 2, x)) $((a = b = 4)) $a $b
+echo $((y++ + ++y)) $y
+n=10
+(( n -= 3, n <<= 2 ))
+echo "n=$n"
+e=1+2
+echo $((e * 3)) $(( $n + ${n} ))
+i=0
+while (( i < 3 )); do
+    echo "i=$i"
+    i=$((i + 1))
+done
+(( i == 3 )) && echo "i is 3"
+((0))
+echo "status $?"
+echo "max+1 wraps: $((9223372036854775807 + 1))"
+echo x | echo $((1/0)) never | tr a-z A-Z
+echo "middle stage: $?"
+echo x | cat - $((2/0))
+echo "last stage: $?"
+i=0
+a=$(echo $((i++)))
+echo "\$( ) keeps its ++ to itself: $a $i"
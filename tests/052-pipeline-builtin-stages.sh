@@ -0,0 +1,16 @@
+#
+# Output-only builtins in front of a pipe run in the shell itself.
+#
+echo hello | tr a-z A-Z
+printf '%s\n' c a b | sort | cat
+echo one | echo two | cat
+echo big | head -c 0; echo "status $?"
+echo fine | false; echo "status $?"
+false | echo next; echo "status $?"
+# more than a pipe holds, into stages that run shell code in a child
+big=0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRST
+big=$big$big$big$big$big$big$big$big$big$big
+big=$big$big$big$big$big$big$big$big$big$big
+big=$big$big$big$big$big$big$big$big$big$big
+echo "$big" | { cat; } | wc -c
+echo "$big" | if true; then wc -c; fi
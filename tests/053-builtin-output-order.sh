@@ -0,0 +1,13 @@
+#
+# Builtin output is buffered in the shell; it must still come out in
+# order with what commands run around it write.
+#
+echo a; /bin/echo b; echo c
+echo -n d; printf 'e\n'
+x=$(echo f; /bin/echo g)
+echo "$x"
+echo h | cat
+for i in 1 2 3; do echo loop $i; done; /bin/echo after
+echo m; echo n >> /tmp/minibash-053.out; cat /tmp/minibash-053.out
+/bin/rm /tmp/minibash-053.out
+echo bg; sleep 0.1 & wait; echo done
@@ -0,0 +1,21 @@
+#
+# Descriptor numbers, duplication and closing, for builtins, external
+# commands and compound statements.
+#
+rm -f .log66 .out66
+echo one >>.log66 2>&1
+writetostderr >>.log66 2>&1
+cat .log66
+writetostderr 2>&1 >/dev/null | rev
+writetostderr &> .out66; cat .out66
+echo more &>> .out66; cat .out66
+writetostderr 3>&1 1>&2 2>&3 | rev
+echo closed >&-; echo "status $?"
+cat .nosuchfile66 2>&-; echo "status $?"
+for i in 1 2; do echo loop $i; writetostderr; done > .out66 2>&1; cat .out66
+v=before; for i in 1; do v=after; done > /dev/null; echo "v=$v"
+x=$(writetostderr 2>&1); echo "$x"
+missing_cmd 2>/dev/null; echo "status $?"
+missing_cmd 2>.out66; wc -l < .out66
+./missing_cmd 2>&1 | wc -l
+rm -f .log66 .out66
@@ -0,0 +1,14 @@
+#
+# >> targets are kept open across a loop, but must never outlive the
+# file they were opened for.
+#
+rm -f .log67 .other67
+for i in 1 2 3; do echo a$i >> .log67; done
+cat .log67
+for i in 1 2; do echo b$i >> .log67; rm .log67; done
+cat .log67
+for i in 1 2; do echo d$i >> .log67; for j in 1; do echo e$i >> .log67; done 3>.other67; done
+cat .log67
+echo f >> .log67 3>&-; echo g 3>>.log67 >&3; cat .log67
+x=$(echo h >> .log67; echo in-sub); echo $x; cat .log67
+rm -f .log67 .other67
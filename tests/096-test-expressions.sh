@@ -0,0 +1,35 @@
+#
+# [ ] and [[ ]]: binary operators, !, -a/-o and &&/||, grouping.
+#
+dir=/tmp/minibash-test-096
+rm -rf $dir
+mkdir $dir
+echo hi > $dir/f
+echo -n > $dir/empty
+[ -f $dir/f -a -s $dir/f ] && echo "f is a non-empty file"
+[ -f $dir/empty -a -s $dir/empty ] || echo "empty is empty"
+[ ! -d $dir/f ] && echo "f is not a directory"
+[ -d $dir/none -o -d $dir ] && echo "dir is a directory"
+[ 3 -lt 10 -a ! 3 -gt 4 ] && echo "3 < 10, 3 <= 4"
+[ abc = abc -a abc != abd ] && echo "string compare"
+[ a = b -o c = c ] && echo "-o is below -a"
+[ "(" = "(" ] && echo "parenthesis as an operand"
+[ ]
+echo "empty test: $?"
+[[ abc == a* && abc != b* ]] && echo "patterns"
+[[ abc == "a*" ]] || echo "quoted pattern is literal"
+[[ ! abc =~ ^b ]] && echo "negated regex"
+p="a*"
+[[ abc == "$p"* ]] || echo "quoted expansion in a pattern is literal"
+[[ 'a*c' == "$p"* ]] && echo "unquoted part still matches"
+[[ abc =~ "a.c" ]] || echo "quoted regex is literal"
+y=a.c
+[[ abc =~ "$y" ]] || echo "quoted expansion in a regex is literal"
+[[ abc =~ ^$y$ ]] && echo "unquoted expansion is a regex"
+[[ ( -z "" || -n "" ) && x < y ]] && echo "grouping"
+i=0
+while [ $i -lt 3 ]; do
+    echo "i=$i"
+    i=$(expr $i + 1)
+done
+rm -rf $dir
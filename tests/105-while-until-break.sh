@@ -0,0 +1,26 @@
+#
+# while/until loops, and break N / continue N out of nested loops.
+#
+i=0
+while test $i -lt 3; do echo w$i; i=$(expr $i + 1); done
+until test $i -eq 0; do i=$(expr $i - 1); echo u$i; done
+for a in 1 2 3; do
+    for b in x y z; do
+        test $b = y && continue
+        test $a = 2 && continue 2
+        test $a = 3 && break 2
+        echo $a$b
+    done
+    echo end$a
+done
+echo "status $?"
+while true; do while true; do break 2; done; echo never; done; echo out
+while false; do echo never; done; echo "status $?"
+while break; do echo never; done; echo after
+for i in 1 2; do break 5; done; echo "status $?"
+n=0
+while :; do
+    n=$(expr $n + 1)
+    if test $n -gt 2; then break; fi
+    echo n$n
+done
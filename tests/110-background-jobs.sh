@@ -0,0 +1,47 @@
+#
+# Commands followed by & run in the background; wait collects them.
+#
+sleep 0.3 &
+p=$!
+echo started
+wait $p
+echo "wait pid: $?"
+sh -c 'exit 3' &
+wait $!
+echo "wait \$!: $?"
+sleep 0.4 && sh -c 'exit 4' &
+sleep 0.1 && sh -c 'exit 5' &
+wait -n
+echo "wait -n: $?"
+wait -n
+echo "wait -n: $?"
+wait -n
+echo "wait -n without jobs: $?"
+for i in 1 2 3; do sleep 0.2 & done
+jobs
+wait
+echo "wait: $?"
+jobs
+sleep 0.3 & sleep 0.3 &
+jobs | wc -l
+jobs -p | wc -l
+echo "$(jobs -r)"
+jobs -s
+wait
+MINIBASH_MAX_JOBS=1
+echo first > /dev/null &
+sh -c 'exit 6' &
+wait %2
+echo "wait %2: $?"
+n=0
+echo "bg $((n++))" &
+wait
+echo "n=$n"
+f=/tmp/minibash-bg-count
+rm -f $f
+echo builtin $(echo x >> $f; echo once) &
+wait
+nosuchcommand $(echo y >> $f) 2>/dev/null &
+wait
+wc -l < $f
+rm -f $f
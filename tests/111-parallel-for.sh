@@ -0,0 +1,13 @@
+#
+# parallel_for runs a loop body per word in forked workers.
+#
+parallel_for -j 4 -k d 'sleep 0.$d; echo "item $d"; echo "  done $d"' 3 1 2 0
+echo "status $?"
+parallel_for -j 2 d 'sleep 0.$d; echo $d' 3 1
+parallel_for -j 3 -k i 'echo $i; test $i != 2 || exit 7' 1 2 3 4
+echo "status $?"
+x=outer
+parallel_for -k x 'echo in $x; y=set' a b
+echo "$x [$y]"
+parallel_for -k x 'echo never'
+echo "status $?"